@@ -0,0 +1,1543 @@
+/*
+ * binlog.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Binary log of a recording, so it can be rendered later and elsewhere
+ * with bootchartd --render. Everything is little endian:
+ *
+ *   "BOOTCHRT" u32 version
+ *   then sections: u32 tag, u32 size, size bytes of payload
+ *
+ *   HEAD  settings and counters of the recording
+ *   INFO  the system description strings of the chart title
+ *   DMSG  the initcall lines of dmesg
+ *   TOPO  i32 cpu_group_kind, i32 count, then the group of each cpu
+ *   SYST  system series, one after the other, samples + 1 values each
+ *         (the last one is the sample that was taken when we stopped)
+ *   PROC  process table, with the encoded sample blocks of each
+ *   TASK  tasks mode: the tgid of every entry of PROC, 0 for processes
+ *   PSI   the PSI_* stall totals, as series of samples + 1 f64 each
+ *   DISK  diskstats: per disk its name, i32 first sample, and then the
+ *         DISK_* counters as series of samples + 1 f64 each
+ *   CGRP  cgroups mode: for every entry of PROC its path, f64 bytes
+ *         read, f64 bytes written
+ *
+ * A streaming log (--stream) is written while recording instead:
+ *
+ *   STRM  the settings of the recording
+ *   RECS  records, as many sections as it takes, see below
+ *   INFO, DMSG and HEAD with the final counters, when we stopped
+ *         cleanly. Without them, the reader works out what it can.
+ *
+ * A record is a type byte followed by its fields. uv is an unsigned
+ * varint, sv a zigzag varint, and "d" marks a delta from the same
+ * field of the previous record of its kind for the same process (sid)
+ * or cpu, or of the previous sample record:
+ *
+ *   SAMPLE  sv d sample, f64 time, uv skip, sv d bi, sv d bo, sv d entropy
+ *   CPU     uv cpu, sv d runtime, sv d waittime (of the last SAMPLE)
+ *   PS      uv sid, sv d sample, sv d runtime, sv d waittime
+ *   PSS     uv sid, sv d sample, sv d pss
+ *   PSINFO  uv sid, uv parent sid, sv pid, sv ppid, sv first, sv last,
+ *           uv final, 16 bytes name, f64 starttime, exittime, blkio,
+ *           swapin, sv tgid. The final one has the last sample that
+ *           counts.
+ *   CLOCK   f64 graph_start, f64 log_start
+ *   PSI     sv d of each PSI_* total (of the last SAMPLE)
+ *   DISKINFO uv disk, 16 bytes name, sv first
+ *   DISK    uv disk, sv d of each DISK_* counter (of the last SAMPLE)
+ *   CGINFO  uv sid, f64 bytes read, f64 bytes written, sv peak memory,
+ *           uv length and the path. Follows each PSINFO of a cgroup.
+ *
+ * Processes are numbered (sid) from 1 in the order they were found,
+ * disks from 0.
+ * Records of different threads interleave, so a process can have
+ * samples before its first PSINFO.
+ *
+ * Readers skip sections they don't know, and ignore fields at the end
+ * of a section they don't know, so both can be extended. The version
+ * only changes when existing fields change meaning.
+ */
+#define BINLOG_MAGIC "BOOTCHRT"
+#define BINLOG_VERSION 1
+
+#define TAG(a, b, c, d) ((a) | ((b) << 8) | ((c) << 16) | ((uint32_t)(d) << 24))
+#define TAG_HEAD TAG('H', 'E', 'A', 'D')
+#define TAG_INFO TAG('I', 'N', 'F', 'O')
+#define TAG_DMSG TAG('D', 'M', 'S', 'G')
+#define TAG_SYST TAG('S', 'Y', 'S', 'T')
+#define TAG_PROC TAG('P', 'R', 'O', 'C')
+#define TAG_STRM TAG('S', 'T', 'R', 'M')
+#define TAG_RECS TAG('R', 'E', 'C', 'S')
+#define TAG_TASK TAG('T', 'A', 'S', 'K')
+#define TAG_DISK TAG('D', 'I', 'S', 'K')
+#define TAG_PSI  TAG('P', 'S', 'I', ' ')
+#define TAG_TOPO TAG('T', 'O', 'P', 'O')
+#define TAG_CGRP TAG('C', 'G', 'R', 'P')
+
+/* more than any machine has, a damaged log may say otherwise */
+#define BINLOG_DISKS 4096
+
+/* seconds from graph_start to the last sample, a longer chart is gigabytes */
+#define BINLOG_SPAN (14 * 24 * 3600.0)
+
+static FILE *bf;
+
+
+static void put_u32(uint32_t v)
+{
+	unsigned char b[4];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+	fwrite(b, 4, 1, bf);
+}
+
+
+static void put_i32(int v)
+{
+	put_u32((uint32_t)v);
+}
+
+
+static void put_f64(double d)
+{
+	uint64_t v;
+
+	memcpy(&v, &d, sizeof(v));
+	put_u32((uint32_t)v);
+	put_u32((uint32_t)(v >> 32));
+}
+
+
+static void put_str(const char *s)
+{
+	put_u32(strlen(s));
+	fwrite(s, strlen(s), 1, bf);
+}
+
+
+/* start a section, returns where to put its size */
+static long section_start(uint32_t tag)
+{
+	long pos;
+
+	put_u32(tag);
+	pos = ftell(bf);
+	put_u32(0);
+
+	return pos;
+}
+
+
+static void section_end(long pos)
+{
+	long end = ftell(bf);
+
+	fseek(bf, pos, SEEK_SET);
+	put_u32(end - pos - 4);
+	fseek(bf, end, SEEK_SET);
+}
+
+
+static int ps_cmp(const void *a, const void *b)
+{
+	struct ps_struct *x = *(struct ps_struct **)a;
+	struct ps_struct *y = *(struct ps_struct **)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* 1 based position of ps in the process list, 0 for none */
+static int ps_index(struct ps_struct **sorted, int n, struct ps_struct *ps)
+{
+	struct ps_struct **p;
+
+	if (!ps || (ps == ps_first))
+		return 0;
+
+	p = bsearch(&ps, sorted, n, sizeof(struct ps_struct *), ps_cmp);
+
+	return p ? (*p)->pos_x : 0;
+}
+
+
+static void binlog_write_procs(void)
+{
+	struct ps_struct **sorted;
+	struct ps_struct *ps;
+	int n = 0;
+	int i;
+
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps)
+		n++;
+
+	sorted = malloc((n ? n : 1) * sizeof(struct ps_struct *));
+	if (!sorted) {
+		perror("malloc(binlog)");
+		exit (EXIT_FAILURE);
+	}
+
+	/* the renderer sets pos_x/pos_y again, borrow pos_x for the index */
+	i = 0;
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps) {
+		sorted[i++] = ps;
+		ps->pos_x = i;
+	}
+	qsort(sorted, n, sizeof(struct ps_struct *), ps_cmp);
+
+	put_i32(n);
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps) {
+		struct ps_store_struct *st = &ps->store;
+		struct ps_block_struct *b;
+		int blocks = 0;
+
+		put_i32(ps->pid);
+		put_i32(ps->ppid);
+		put_i32(ps->first);
+		put_i32(ps->last);
+		fwrite(ps->name, 16, 1, bf);
+		put_f64(ps->starttime);
+		put_f64(ps->exittime);
+		put_f64(ps->total);
+		put_f64(ps->blkio);
+		put_f64(ps->swapin);
+		put_i32(ps->pss_max);
+		put_i32(ps_index(sorted, n, ps->parent));
+		put_i32(ps_index(sorted, n, ps->children));
+		put_i32(ps_index(sorted, n, ps->next));
+
+		put_i32(st->npss);
+		for (i = 0; i < st->npss; i++) {
+			put_i32(st->pss[i].sample);
+			put_i32(st->pss[i].pss);
+		}
+
+		for (b = st->head; b; b = b->next)
+			blocks++;
+		put_i32(blocks);
+		for (b = st->head; b; b = b->next) {
+			put_i32(b->first);
+			put_i32(b->count);
+			put_f64(b->runtime);
+			put_f64(b->waittime);
+			put_i32(b->size);
+			fwrite(b->data, b->size, 1, bf);
+		}
+	}
+
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps)
+		ps->pos_x = 0.0;
+	free(sorted);
+}
+
+
+static void binlog_write_head(void)
+{
+	long pos;
+
+	pos = section_start(TAG_HEAD);
+	put_f64(hz);
+	put_i32(len);
+	put_i32(samples);
+	put_i32(cpus);
+	put_f64(interval);
+	put_f64(graph_start);
+	put_f64(log_start);
+	put_i32(relative);
+	put_i32(pss);
+	put_i32(entropy);
+	put_i32(taskstats);
+	put_i32(overrun);
+	put_i32(dropped);
+	put_f64(collector_cpu);
+	put_i32(adaptive);
+	put_i32(probes);
+	put_i32(probes_skipped);
+	put_i32(fd_budget);
+	put_i32(fd_hits);
+	put_i32(fd_misses);
+	put_i32(fd_reopens);
+	put_i32(fd_evictions);
+	put_i32(stream_lost);
+	put_i32(collector_pid);
+	section_end(pos);
+}
+
+
+/* the chart title and the initcalls */
+static void binlog_write_info(void)
+{
+	long pos;
+	int c;
+
+	if (!sysdesc.date[0])
+		svg_sysdesc_read();
+
+	pos = section_start(TAG_INFO);
+	put_str(sysdesc.host);
+	put_str(sysdesc.system);
+	put_str(sysdesc.cpu);
+	put_str(sysdesc.disk);
+	put_str(sysdesc.cmdline);
+	put_str(sysdesc.build);
+	put_str(sysdesc.date);
+	section_end(pos);
+
+	pos = section_start(TAG_DMSG);
+	if (initcalls_size)
+		fwrite(initcalls, initcalls_size, 1, bf);
+	section_end(pos);
+
+	pos = section_start(TAG_TOPO);
+	put_i32(cpu_group_kind);
+	put_i32(cpu_groups);
+	for (c = 0; c < cpu_groups; c++)
+		put_i32(cpu_group[c]);
+	section_end(pos);
+}
+
+
+int binlog_write(const char *filename)
+{
+	long pos;
+	int c;
+	int i;
+
+	bf = fopen(filename, "w");
+	if (!bf) {
+		perror("open binary log");
+		return -1;
+	}
+
+	fwrite(BINLOG_MAGIC, 8, 1, bf);
+	put_u32(BINLOG_VERSION);
+
+	binlog_write_head();
+	binlog_write_info();
+
+	pos = section_start(TAG_SYST);
+	for (i = 0; i <= samples; i++)
+		put_f64(sample_time(i));
+	for (i = 0; i <= samples; i++)
+		put_i32(series_int(&sampleskip, i));
+	for (i = 0; i <= samples; i++)
+		put_i32(series_int(&blockstat_bi, i));
+	for (i = 0; i <= samples; i++)
+		put_i32(series_int(&blockstat_bo, i));
+	for (i = 0; i <= samples; i++)
+		put_i32(series_int(&entropy_avail, i));
+	for (c = 0; c < cpus; c++) {
+		for (i = 0; i <= samples; i++)
+			put_f64(series_double(&cpu_runtime[c], i));
+		for (i = 0; i <= samples; i++)
+			put_f64(series_double(&cpu_waittime[c], i));
+	}
+	section_end(pos);
+
+	pos = section_start(TAG_PROC);
+	binlog_write_procs();
+	section_end(pos);
+
+	if (tasks) {
+		struct ps_struct *ps;
+
+		pos = section_start(TAG_TASK);
+		for (ps = ps_first->next_ps; ps; ps = ps->next_ps)
+			put_i32(ps->tgid);
+		section_end(pos);
+	}
+
+	if (cgroups) {
+		struct ps_struct *ps;
+
+		pos = section_start(TAG_CGRP);
+		for (ps = ps_first->next_ps; ps; ps = ps->next_ps) {
+			put_str(ps->cgroup ? ps->cgroup : "");
+			put_f64(ps->rbytes);
+			put_f64(ps->wbytes);
+		}
+		section_end(pos);
+	}
+
+	if (psi) {
+		pos = section_start(TAG_PSI);
+		for (c = 0; c < PSI_FIELDS; c++)
+			for (i = 0; i <= samples; i++)
+				put_f64(series_double(&psi_total[c], i));
+		section_end(pos);
+	}
+
+	if (ndisks) {
+		pos = section_start(TAG_DISK);
+		for (c = 0; c < ndisks; c++) {
+			int f;
+
+			put_str(disks[c].name);
+			put_i32(disks[c].first);
+			for (f = 0; f < DISK_FIELDS; f++)
+				for (i = 0; i <= samples; i++)
+					put_f64(series_double(&disks[c].s[f], i));
+		}
+		section_end(pos);
+	}
+
+	if (ferror(bf)) {
+		perror("write binary log");
+		fclose(bf);
+		return -1;
+	}
+
+	return fclose(bf) ? -1 : 0;
+}
+
+
+/* a streaming log starts with the settings, see stream.c */
+int binlog_stream_open(const char *filename)
+{
+	long pos;
+
+	bf = fopen(filename, "w");
+	if (!bf) {
+		perror("open binary log");
+		return -1;
+	}
+
+	fwrite(BINLOG_MAGIC, 8, 1, bf);
+	put_u32(BINLOG_VERSION);
+
+	pos = section_start(TAG_STRM);
+	put_f64(hz);
+	put_i32(len);
+	put_f64(interval);
+	put_i32(relative);
+	put_i32(pss);
+	put_i32(entropy);
+	put_i32(taskstats);
+	put_i32(adaptive);
+	put_i32(collector_pid);
+	section_end(pos);
+
+	return fflush(bf) ? -1 : 0;
+}
+
+
+/* from the encoder thread, one section of records */
+int binlog_stream_recs(const unsigned char *buf, size_t n)
+{
+	put_u32(TAG_RECS);
+	put_u32(n);
+	fwrite(buf, n, 1, bf);
+
+	if (fflush(bf) || ferror(bf))
+		return -1;
+
+	return 0;
+}
+
+
+int binlog_stream_close(void)
+{
+	binlog_write_info();
+	binlog_write_head();
+
+	if (ferror(bf)) {
+		perror("write binary log");
+		fclose(bf);
+		return -1;
+	}
+
+	return fclose(bf) ? -1 : 0;
+}
+
+
+/* a bounds checked reader over a section */
+struct cursor_struct {
+	const unsigned char *p;
+	const unsigned char *end;
+	int err;
+};
+
+static const unsigned char *get_bytes(struct cursor_struct *c, size_t n)
+{
+	const unsigned char *p = c->p;
+
+	if ((size_t)(c->end - c->p) < n) {
+		c->err = 1;
+		c->p = c->end;
+		return NULL;
+	}
+	c->p += n;
+
+	return p;
+}
+
+
+static uint32_t get_u32(struct cursor_struct *c)
+{
+	const unsigned char *b = get_bytes(c, 4);
+
+	if (!b)
+		return 0;
+
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+
+static int get_i32(struct cursor_struct *c)
+{
+	return (int)get_u32(c);
+}
+
+
+static unsigned long long get_uv(struct cursor_struct *c)
+{
+	unsigned long long u = 0;
+	const unsigned char *b;
+	int shift = 0;
+
+	do {
+		b = get_bytes(c, 1);
+		if (!b || (shift > 63)) {
+			c->err = 1;
+			return 0;
+		}
+		u |= (unsigned long long)(*b & 0x7f) << shift;
+		shift += 7;
+	} while (*b & 0x80);
+
+	return u;
+}
+
+
+static long long get_sv(struct cursor_struct *c)
+{
+	unsigned long long u = get_uv(c);
+
+	return (long long)(u >> 1) ^ -(long long)(u & 1);
+}
+
+
+static double get_f64(struct cursor_struct *c)
+{
+	uint64_t v;
+	double d;
+
+	v = get_u32(c);
+	v |= (uint64_t)get_u32(c) << 32;
+	memcpy(&d, &v, sizeof(d));
+
+	return d;
+}
+
+
+static void get_str(struct cursor_struct *c, char *s, size_t size)
+{
+	uint32_t n = get_u32(c);
+	const unsigned char *b = get_bytes(c, n);
+
+	if (!b)
+		return;
+	if (n >= size)
+		n = size - 1;
+	memcpy(s, b, n);
+	s[n] = '\0';
+}
+
+
+/* asking for a relative chart of an absolute recording */
+static void binlog_read_relative(int rel)
+{
+	if (relative && !rel)
+		relative = 2;
+	else
+		relative = rel;
+}
+
+
+static void binlog_read_head(struct cursor_struct *c)
+{
+
+	hz = get_f64(c);
+	len = get_i32(c);
+	samples = get_i32(c);
+	cpus = get_i32(c);
+	interval = get_f64(c);
+	graph_start = get_f64(c);
+	log_start = get_f64(c);
+	binlog_read_relative(get_i32(c));
+	pss = get_i32(c);
+	entropy = get_i32(c);
+	taskstats = get_i32(c);
+	overrun = get_i32(c);
+	dropped = get_i32(c);
+	collector_cpu = get_f64(c);
+	adaptive = get_i32(c);
+	probes = get_i32(c);
+	probes_skipped = get_i32(c);
+	fd_budget = get_i32(c);
+	fd_hits = get_i32(c);
+	fd_misses = get_i32(c);
+	fd_reopens = get_i32(c);
+	fd_evictions = get_i32(c);
+	/* not in older logs */
+	if (c->p < c->end)
+		stream_lost = get_i32(c);
+	collector_pid = 0;
+	if (c->p < c->end)
+		collector_pid = get_i32(c);
+
+	if ((samples < 1) || (len < 1) || (len > (1 << 24)) || (samples > len + 1) ||
+	    (cpus < 0) || (cpus > 65536))
+		c->err = 1;
+}
+
+
+static void binlog_read_info(struct cursor_struct *c)
+{
+	get_str(c, sysdesc.host, sizeof(sysdesc.host));
+	get_str(c, sysdesc.system, sizeof(sysdesc.system));
+	get_str(c, sysdesc.cpu, sizeof(sysdesc.cpu));
+	get_str(c, sysdesc.disk, sizeof(sysdesc.disk));
+	get_str(c, sysdesc.cmdline, sizeof(sysdesc.cmdline));
+	get_str(c, sysdesc.build, sizeof(sysdesc.build));
+	get_str(c, sysdesc.date, sizeof(sysdesc.date));
+}
+
+
+static void binlog_read_dmsg(struct cursor_struct *c)
+{
+	size_t n = c->end - c->p;
+
+	free(initcalls);
+	initcalls = malloc(n + 1);
+	if (!initcalls) {
+		perror("malloc(initcalls)");
+		exit (EXIT_FAILURE);
+	}
+	memcpy(initcalls, get_bytes(c, n), n);
+	initcalls[n] = '\0';
+	initcalls_size = n;
+}
+
+
+static void binlog_read_topo(struct cursor_struct *c)
+{
+	int kind = get_i32(c);
+	int n = get_i32(c);
+	int i;
+
+	if ((kind < CPU_GROUP_NONE) || (kind > CPU_GROUP_NODE) ||
+	    (n < 0) || (n > 65536) || ((size_t)(c->end - c->p) / 4 < (size_t)n)) {
+		c->err = 1;
+		return;
+	}
+
+	free(cpu_group);
+	cpu_group = malloc((n ? n : 1) * sizeof(int));
+	if (!cpu_group) {
+		perror("malloc(binlog)");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++)
+		cpu_group[i] = get_i32(c);
+	cpu_groups = n;
+	cpu_group_kind = kind;
+}
+
+
+static void binlog_read_syst(struct cursor_struct *c)
+{
+	int i;
+	int n;
+
+	/* check the size first, samples and cpus come from the file */
+	if ((size_t)(c->end - c->p) / (8 + 4 * 4 + 16 * (size_t)cpus) < (size_t)samples + 1) {
+		c->err = 1;
+		return;
+	}
+
+	if (cpus)
+		store_cpus(cpus - 1);
+
+	for (i = 0; i <= samples; i++) {
+		double t = get_f64(c);
+
+		/* the chart divides by the time between samples */
+		if ((i > 0) && (i < samples) && !(t > sample_time(i - 1)))
+			c->err = 1;
+		if (!isfinite(t))
+			c->err = 1;
+		series_set_double(&sampletime, i, t);
+	}
+	for (i = 0; i <= samples; i++)
+		series_set_int(&sampleskip, i, get_i32(c));
+	for (i = 0; i <= samples; i++)
+		series_set_int(&blockstat_bi, i, get_i32(c));
+	for (i = 0; i <= samples; i++)
+		series_set_int(&blockstat_bo, i, get_i32(c));
+	for (i = 0; i <= samples; i++)
+		series_set_int(&entropy_avail, i, get_i32(c));
+	for (n = 0; n < cpus; n++) {
+		for (i = 0; i <= samples; i++)
+			series_set_double(&cpu_runtime[n], i, get_f64(c));
+		for (i = 0; i <= samples; i++)
+			series_set_double(&cpu_waittime[n], i, get_f64(c));
+	}
+}
+
+
+static struct ps_struct *ps_at(struct ps_struct **list, int n, int i, struct cursor_struct *c)
+{
+	if ((i < 0) || (i > n)) {
+		c->err = 1;
+		return NULL;
+	}
+
+	return i ? list[i - 1] : NULL;
+}
+
+
+/*
+ * The links must make a tree, or walking it never ends. Every process
+ * is in the child list of its parent, once, and following parents
+ * ends at a process without one.
+ */
+static int binlog_check_tree(struct ps_struct **list, int n)
+{
+	char *seen;
+	int err = 0;
+	int i;
+
+	seen = calloc(n ? n : 1, 1);
+	if (!seen) {
+		perror("calloc(binlog)");
+		exit (EXIT_FAILURE);
+	}
+
+	/* the renderer sets pos_x again, borrow it for the index */
+	for (i = 0; i < n; i++)
+		list[i]->pos_x = i;
+
+	for (i = 0; (i < n) && !err; i++) {
+		struct ps_struct *ps = list[i];
+		struct ps_struct *p;
+		int k = 0;
+
+		for (p = ps->parent; p && !err; p = p->parent)
+			if (++k > n)
+				err = 1;
+
+		for (p = ps->children; p && !err; p = p->next) {
+			if ((p->parent != ps) || seen[(int)p->pos_x])
+				err = 1;
+			seen[(int)p->pos_x] = 1;
+		}
+
+		/* top level processes can only be siblings of each other */
+		if (ps->parent || seen[i])
+			continue;
+		for (p = ps; p && !err; p = p->next) {
+			if (p->parent || ((p != ps) && seen[(int)p->pos_x]))
+				err = 1;
+			seen[(int)p->pos_x] = 1;
+		}
+	}
+
+	free(seen);
+
+	return err ? -1 : 0;
+}
+
+
+static void binlog_read_procs(struct cursor_struct *c)
+{
+	struct ps_struct **list;
+	struct ps_struct *last = ps_first;
+	int *links;
+	int n;
+	int i;
+
+	n = get_i32(c);
+	if ((n < 0) || (n > (c->end - c->p) / 64)) {
+		c->err = 1;
+		return;
+	}
+
+	list = malloc((n ? n : 1) * sizeof(struct ps_struct *));
+	links = malloc((n ? n : 1) * 3 * sizeof(int));
+	if (!list || !links) {
+		perror("malloc(binlog)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (i = 0; (i < n) && !c->err; i++) {
+		struct ps_struct *ps = log_ps_alloc();
+		const unsigned char *name;
+		int blocks;
+		int k;
+
+		list[i] = ps;
+		last->next_ps = ps;
+		last = ps;
+		pscount++;
+
+		ps->pid = get_i32(c);
+		ps->ppid = get_i32(c);
+		ps->first = get_i32(c);
+		ps->last = get_i32(c);
+		name = get_bytes(c, 16);
+		if (name)
+			memcpy(ps->name, name, 16);
+		ps->name[15] = '\0';
+		ps->starttime = get_f64(c);
+		ps->exittime = get_f64(c);
+		ps->total = get_f64(c);
+		ps->blkio = get_f64(c);
+		ps->swapin = get_f64(c);
+		ps->pss_max = get_i32(c);
+		links[i * 3] = get_i32(c);
+		links[i * 3 + 1] = get_i32(c);
+		links[i * 3 + 2] = get_i32(c);
+
+		for (k = get_i32(c); (k > 0) && !c->err; k--) {
+			int sample = get_i32(c);
+			int kb = get_i32(c);
+
+			if (kb < 0)
+				c->err = 1;
+			else
+				ps_store_pss(ps, sample, kb);
+		}
+
+		for (blocks = get_i32(c); (blocks > 0) && !c->err; blocks--) {
+			struct ps_block_struct b;
+			const unsigned char *data;
+
+			b.first = get_i32(c);
+			b.count = get_i32(c);
+			b.runtime = get_f64(c);
+			b.waittime = get_f64(c);
+			b.size = get_i32(c);
+			if ((b.size < 0) || (b.size > PS_BLOCK_DATA)) {
+				c->err = 1;
+				break;
+			}
+			data = get_bytes(c, b.size);
+			if (!data)
+				break;
+			memcpy(b.data, data, b.size);
+			if (ps_store_load(ps, &b))
+				c->err = 1;
+		}
+
+		if ((ps->pid < 0) || (ps->first < 0) || (ps->last < ps->first) ||
+		    (ps->last > samples))
+			c->err = 1;
+	}
+
+	for (i = 0; (i < n) && !c->err; i++) {
+		list[i]->parent = ps_at(list, n, links[i * 3], c);
+		list[i]->children = ps_at(list, n, links[i * 3 + 1], c);
+		list[i]->next = ps_at(list, n, links[i * 3 + 2], c);
+	}
+
+	if (!c->err && binlog_check_tree(list, n))
+		c->err = 1;
+
+	free(links);
+	free(list);
+}
+
+
+/* tasks mode, in the order of PROC */
+static void binlog_read_tasks(struct cursor_struct *c)
+{
+	struct ps_struct *ps;
+
+	for (ps = ps_first->next_ps; ps && (c->p < c->end); ps = ps->next_ps)
+		ps->tgid = get_i32(c);
+}
+
+
+/* cgroups mode, in the order of PROC */
+static void binlog_read_cgroups(struct cursor_struct *c)
+{
+	struct ps_struct *ps;
+	char path[PATH_MAX];
+
+	for (ps = ps_first->next_ps; ps && (c->p < c->end) && !c->err; ps = ps->next_ps) {
+		path[0] = '\0';
+		get_str(c, path, sizeof(path));
+		ps->rbytes = get_f64(c);
+		ps->wbytes = get_f64(c);
+		free(ps->cgroup);
+		ps->cgroup = strdup(path);
+		if (!ps->cgroup) {
+			perror("strdup(cgroup)");
+			exit (EXIT_FAILURE);
+		}
+	}
+	cgroups = 1;
+}
+
+
+static void binlog_read_psi(struct cursor_struct *c)
+{
+	int f;
+	int i;
+
+	if ((size_t)(c->end - c->p) / (8 * PSI_FIELDS) < (size_t)samples + 1) {
+		c->err = 1;
+		return;
+	}
+
+	for (f = 0; f < PSI_FIELDS; f++)
+		for (i = 0; i <= samples; i++)
+			series_set_double(&psi_total[f], i, get_f64(c));
+	psi = 1;
+}
+
+
+static void binlog_read_disks(struct cursor_struct *c)
+{
+	while ((c->p < c->end) && !c->err) {
+		struct disk_struct *d;
+		char name[16];
+		int first;
+		int f;
+		int i;
+
+		get_str(c, name, sizeof(name));
+		first = get_i32(c);
+		if (c->err || (ndisks >= BINLOG_DISKS) ||
+		    ((size_t)(c->end - c->p) / (8 * DISK_FIELDS) < (size_t)samples + 1)) {
+			c->err = 1;
+			return;
+		}
+
+		d = store_disk(ndisks);
+		strcpy(d->name, name);
+		d->first = (first < 0) ? 0 : first;
+		for (f = 0; f < DISK_FIELDS; f++)
+			for (i = 0; i <= samples; i++)
+				series_set_double(&d->s[f], i, get_f64(c));
+	}
+}
+
+
+/*
+ * Streaming logs. Decoding keeps the same delta state as stream.c,
+ * processes are indexed by sid until the log is read completely.
+ */
+#define STREAM_SIDS (1 << 22)
+
+static struct ps_struct **stream_procs;
+static struct stream_state_struct *stream_st;
+static int *stream_parent;
+static char *stream_final;
+static int stream_nprocs;
+static long long *stream_cpu;
+static int stream_ncpu;
+static long long *stream_disk;
+static int stream_ndisk;
+static long long stream_psi[PSI_FIELDS];
+static int stream_last;      /* sample of the last SAMPLE record */
+static long long stream_bi;
+static long long stream_bo;
+static long long stream_entropy;
+
+
+static void binlog_read_strm(struct cursor_struct *c)
+{
+	hz = get_f64(c);
+	len = get_i32(c);
+	interval = get_f64(c);
+	binlog_read_relative(get_i32(c));
+	pss = get_i32(c);
+	entropy = get_i32(c);
+	taskstats = get_i32(c);
+	adaptive = get_i32(c);
+	/* not in older logs */
+	collector_pid = 0;
+	if (c->p < c->end)
+		collector_pid = get_i32(c);
+
+	samples = 0;
+	cpus = 0;
+	stream_last = -1;
+
+	if ((len < 1) || (len > (1 << 24)) || !(hz > 0.0))
+		c->err = 1;
+}
+
+
+static struct ps_struct *stream_ps_get(unsigned long long sid, struct cursor_struct *c)
+{
+	struct ps_struct *ps;
+
+	if ((sid < 1) || (sid >= STREAM_SIDS)) {
+		c->err = 1;
+		return NULL;
+	}
+
+	if (sid >= (unsigned long long)stream_nprocs) {
+		int n = stream_nprocs ? stream_nprocs : 1024;
+
+		while ((unsigned long long)n <= sid)
+			n *= 2;
+		stream_procs = realloc(stream_procs, n * sizeof(struct ps_struct *));
+		stream_st = realloc(stream_st, n * sizeof(struct stream_state_struct));
+		stream_parent = realloc(stream_parent, n * sizeof(int));
+		stream_final = realloc(stream_final, n);
+		if (!stream_procs || !stream_st || !stream_parent || !stream_final) {
+			perror("realloc(binlog)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&stream_procs[stream_nprocs], 0, (n - stream_nprocs) * sizeof(struct ps_struct *));
+		memset(&stream_st[stream_nprocs], 0, (n - stream_nprocs) * sizeof(struct stream_state_struct));
+		memset(&stream_parent[stream_nprocs], 0, (n - stream_nprocs) * sizeof(int));
+		memset(&stream_final[stream_nprocs], 0, n - stream_nprocs);
+		stream_nprocs = n;
+	}
+
+	/* samples may come before we're told who it is */
+	ps = stream_procs[sid];
+	if (!ps) {
+		ps = log_ps_alloc();
+		ps->sid = sid;
+		ps->first = -1;
+		stream_procs[sid] = ps;
+	}
+
+	return ps;
+}
+
+
+static long long *stream_cpu_get(unsigned long long c, struct cursor_struct *c2)
+{
+	if (c >= 65536) {
+		c2->err = 1;
+		return NULL;
+	}
+
+	if (c >= (unsigned long long)stream_ncpu) {
+		int n = c + 1;
+
+		stream_cpu = realloc(stream_cpu, n * 2 * sizeof(long long));
+		if (!stream_cpu) {
+			perror("realloc(binlog)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&stream_cpu[stream_ncpu * 2], 0, (n - stream_ncpu) * 2 * sizeof(long long));
+		stream_ncpu = n;
+	}
+
+	return &stream_cpu[c * 2];
+}
+
+
+static long long *stream_disk_get(unsigned long long n, struct cursor_struct *c)
+{
+	if (n >= BINLOG_DISKS) {
+		c->err = 1;
+		return NULL;
+	}
+
+	if (n >= (unsigned long long)stream_ndisk) {
+		int size = n + 1;
+
+		stream_disk = realloc(stream_disk, size * DISK_FIELDS * sizeof(long long));
+		if (!stream_disk) {
+			perror("realloc(binlog)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&stream_disk[stream_ndisk * DISK_FIELDS], 0,
+		       (size - stream_ndisk) * DISK_FIELDS * sizeof(long long));
+		stream_ndisk = size;
+	}
+
+	/* the DISKINFO may have been lost, the disk has no name then */
+	store_disk(n);
+
+	return &stream_disk[n * DISK_FIELDS];
+}
+
+
+/*
+ * Samples of processes and pss passes can run ahead of SAMPLE, in an
+ * older log or at the very end. They're kept, and what's past the last
+ * SAMPLE is cut off when the log is done.
+ */
+static int stream_sample_ok(long long sample)
+{
+	return (sample >= 0) && (sample <= len + 1);
+}
+
+
+static void binlog_read_recs(struct cursor_struct *c)
+{
+	while ((c->p < c->end) && !c->err) {
+		const unsigned char *type = get_bytes(c, 1);
+		struct stream_state_struct *st;
+		struct ps_struct *ps;
+		const unsigned char *name;
+		unsigned long long sid;
+		long long sample;
+		long long *cs;
+		double t;
+		int parent;
+		int f;
+
+		switch (*type) {
+		case STREAM_SAMPLE:
+			sample = stream_last + get_sv(c);
+			if ((sample <= stream_last) || (sample > len + 1)) {
+				c->err = 1;
+				break;
+			}
+			t = get_f64(c);
+			if (!isfinite(t) || ((stream_last >= 0) && !(t > sample_time(stream_last)))) {
+				c->err = 1;
+				break;
+			}
+			stream_last = sample;
+			series_set_double(&sampletime, sample, t);
+			series_set_int(&sampleskip, sample, get_uv(c));
+			stream_bi += get_sv(c);
+			stream_bo += get_sv(c);
+			stream_entropy += get_sv(c);
+			series_set_int(&blockstat_bi, sample, stream_bi);
+			series_set_int(&blockstat_bo, sample, stream_bo);
+			series_set_int(&entropy_avail, sample, stream_entropy);
+			break;
+		case STREAM_CPU:
+			sid = get_uv(c);
+			cs = stream_cpu_get(sid, c);
+			if (!cs || (stream_last < 0)) {
+				c->err = 1;
+				break;
+			}
+			cs[0] += get_sv(c);
+			cs[1] += get_sv(c);
+			store_cpus(sid);
+			series_set_double(&cpu_runtime[sid], stream_last, cs[0]);
+			series_set_double(&cpu_waittime[sid], stream_last, cs[1]);
+			if ((int)sid >= cpus)
+				cpus = sid + 1;
+			break;
+		case STREAM_PS:
+			ps = stream_ps_get(get_uv(c), c);
+			if (!ps)
+				break;
+			st = &stream_st[ps->sid];
+			sample = st->sample + get_sv(c);
+			st->runtime += get_sv(c);
+			st->waittime += get_sv(c);
+			if (!stream_sample_ok(sample)) {
+				c->err = 1;
+				break;
+			}
+			st->sample = sample;
+			ps_store_append(ps, sample, st->runtime, st->waittime);
+			if ((sample > ps->last) && !stream_final[ps->sid])
+				ps->last = sample;
+			break;
+		case STREAM_PSS:
+			ps = stream_ps_get(get_uv(c), c);
+			if (!ps)
+				break;
+			st = &stream_st[ps->sid];
+			sample = st->pss_sample + get_sv(c);
+			st->pss += get_sv(c);
+			if (!stream_sample_ok(sample) || (st->pss < 0) || (st->pss > INT_MAX)) {
+				c->err = 1;
+				break;
+			}
+			st->pss_sample = sample;
+			ps_store_pss(ps, sample, st->pss);
+			if (st->pss > ps->pss_max)
+				ps->pss_max = st->pss;
+			break;
+		case STREAM_PSINFO:
+			ps = stream_ps_get(get_uv(c), c);
+			if (!ps)
+				break;
+			/* the parent it had when we found it, it might be gone later */
+			parent = get_uv(c);
+			if (!stream_parent[ps->sid])
+				stream_parent[ps->sid] = parent;
+			ps->pid = get_sv(c);
+			ps->ppid = get_sv(c);
+			sample = get_sv(c);
+			if ((ps->pid < 0) || !stream_sample_ok(sample)) {
+				c->err = 1;
+				break;
+			}
+			if (ps->first < 0)
+				ps->first = sample;
+			sample = get_sv(c);
+			if (!stream_sample_ok(sample)) {
+				c->err = 1;
+				break;
+			}
+			if (get_uv(c)) {
+				/* samples after the process exited don't count */
+				ps->last = sample;
+				stream_final[ps->sid] = 1;
+			} else if ((sample > ps->last) && !stream_final[ps->sid]) {
+				ps->last = sample;
+			}
+			name = get_bytes(c, 16);
+			if (name)
+				memcpy(ps->name, name, 16);
+			ps->name[15] = '\0';
+			ps->starttime = get_f64(c);
+			ps->exittime = get_f64(c);
+			ps->blkio = get_f64(c);
+			ps->swapin = get_f64(c);
+			ps->tgid = get_sv(c);
+			break;
+		case STREAM_CLOCK:
+			graph_start = get_f64(c);
+			log_start = get_f64(c);
+			break;
+		case STREAM_PSI:
+			if (stream_last < 0) {
+				c->err = 1;
+				break;
+			}
+			for (f = 0; f < PSI_FIELDS; f++) {
+				stream_psi[f] += get_sv(c);
+				series_set_double(&psi_total[f], stream_last, stream_psi[f]);
+			}
+			psi = 1;
+			break;
+		case STREAM_DISKINFO:
+			sid = get_uv(c);
+			if (!stream_disk_get(sid, c))
+				break;
+			name = get_bytes(c, 16);
+			if (name)
+				memcpy(disks[sid].name, name, 16);
+			disks[sid].name[15] = '\0';
+			sample = get_sv(c);
+			if (!stream_sample_ok(sample)) {
+				c->err = 1;
+				break;
+			}
+			disks[sid].first = sample;
+			break;
+		case STREAM_DISK:
+			sid = get_uv(c);
+			cs = stream_disk_get(sid, c);
+			if (!cs || (stream_last < 0)) {
+				c->err = 1;
+				break;
+			}
+			for (f = 0; f < DISK_FIELDS; f++) {
+				cs[f] += get_sv(c);
+				series_set_double(&disks[sid].s[f], stream_last, cs[f]);
+			}
+			break;
+		case STREAM_CGINFO:
+			ps = stream_ps_get(get_uv(c), c);
+			if (!ps)
+				break;
+			ps->rbytes = get_f64(c);
+			ps->wbytes = get_f64(c);
+			f = get_sv(c);
+			if (f > ps->pss_max)
+				ps->pss_max = f;
+			sid = get_uv(c);
+			if (sid >= PATH_MAX) {
+				c->err = 1;
+				break;
+			}
+			name = get_bytes(c, sid);
+			if (!name)
+				break;
+			free(ps->cgroup);
+			ps->cgroup = malloc(sid + 1);
+			if (!ps->cgroup) {
+				perror("malloc(cgroup)");
+				exit (EXIT_FAILURE);
+			}
+			memcpy(ps->cgroup, name, sid);
+			ps->cgroup[sid] = '\0';
+			cgroups = 1;
+			break;
+		default:
+			c->err = 1;
+			break;
+		}
+	}
+}
+
+
+/* build the process list and tree, like the collector had them */
+static int binlog_stream_finish(int info)
+{
+	struct ps_struct *last = ps_first;
+	int sid;
+
+	if (samples < stream_last + 1)
+		samples = stream_last + 1;
+	if (samples < 1)
+		return -1;
+
+	for (sid = 1; sid < stream_nprocs; sid++) {
+		struct ps_struct *ps = stream_procs[sid];
+		struct ps_struct *parent = NULL;
+		int p = stream_parent[sid];
+
+		if (!ps)
+			continue;
+
+		last->next_ps = ps;
+		last = ps;
+		pscount++;
+
+		if (ps->first < 0)
+			ps->first = ps->store.head ? ps->store.head->first : 0;
+		if (ps->last >= samples)
+			ps->last = samples - 1;
+		if (ps->first > ps->last)
+			ps->first = ps->last;
+		if (ps->store.head)
+			ps->total = (ps->store.runtime - ps->store.head->runtime) / 1000000000.0;
+
+		/* parents are always found before their children */
+		if ((p > 0) && (p < sid))
+			parent = stream_procs[p];
+		if (!parent)
+			continue;
+
+		ps->parent = parent;
+		if (!parent->children)
+			parent->children = ps;
+		else
+			parent->last_child->next = ps;
+		parent->last_child = ps;
+	}
+
+	/* stopped before we could describe the system */
+	if (!info) {
+		strcpy(sysdesc.host, "Unknown");
+		strcpy(sysdesc.system, "Unknown");
+		strcpy(sysdesc.cpu, "Unknown");
+		strcpy(sysdesc.disk, "Unknown");
+		strcpy(sysdesc.cmdline, "Unknown");
+		strcpy(sysdesc.build, "Unknown");
+		strcpy(sysdesc.date, "Unknown");
+	}
+
+	return 0;
+}
+
+
+static void binlog_stream_free(void)
+{
+	free(stream_procs);
+	free(stream_st);
+	free(stream_parent);
+	free(stream_final);
+	free(stream_cpu);
+	free(stream_disk);
+	stream_procs = NULL;
+	stream_st = NULL;
+	stream_parent = NULL;
+	stream_final = NULL;
+	stream_cpu = NULL;
+	stream_disk = NULL;
+	stream_nprocs = 0;
+	stream_ncpu = 0;
+	stream_ndisk = 0;
+}
+
+
+/*
+ * Load a binary log into the same globals a recording fills, so
+ * svg_do() can draw it. The log is mapped, not read.
+ */
+int binlog_read(const char *filename)
+{
+	struct cursor_struct c;
+	struct stat st;
+	const unsigned char *map;
+	int head = 0;
+	int syst = 0;
+	int strm = 0;
+	int info = 0;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		perror("open binary log");
+		return -1;
+	}
+	if (fstat(fd, &st) || (st.st_size < 12)) {
+		fprintf(stderr, "bootchartd: %s is not a bootchart log\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap binary log");
+		return -1;
+	}
+
+	c.p = map;
+	c.end = map + st.st_size;
+	c.err = 0;
+
+	/* only if the log has them, whatever the config file says */
+	psi = 0;
+	cgroups = 0;
+
+	if (memcmp(get_bytes(&c, 8), BINLOG_MAGIC, 8)) {
+		fprintf(stderr, "bootchartd: %s is not a bootchart log\n", filename);
+		munmap((void *)map, st.st_size);
+		return -1;
+	}
+	if (get_u32(&c) != BINLOG_VERSION) {
+		fprintf(stderr, "bootchartd: %s has an unsupported log version\n", filename);
+		munmap((void *)map, st.st_size);
+		return -1;
+	}
+
+	while ((c.p < c.end) && !c.err) {
+		struct cursor_struct s;
+		uint32_t tag = get_u32(&c);
+		uint32_t size = get_u32(&c);
+
+		s.p = get_bytes(&c, size);
+		s.end = s.p + size;
+		s.err = c.err;
+		if (s.err && strm) {
+			/* the recording was cut short, draw what made it */
+			fprintf(stderr, "bootchartd: %s is incomplete\n", filename);
+			c.err = 0;
+			break;
+		}
+		if (s.err)
+			break;
+
+		/* everything else depends on the recording settings */
+		if ((tag != TAG_HEAD) && (tag != TAG_STRM) && !head)
+			s.err = 1;
+
+		switch (tag) {
+		case TAG_HEAD:
+			binlog_read_head(&s);
+			if (!s.err && !head) {
+				store_init();
+				head = 1;
+			}
+			break;
+		case TAG_STRM:
+			if (head) {
+				s.err = 1;
+				break;
+			}
+			binlog_read_strm(&s);
+			if (!s.err) {
+				store_init();
+				head = 1;
+				strm = 1;
+			}
+			break;
+		case TAG_RECS:
+			if (strm)
+				binlog_read_recs(&s);
+			break;
+		case TAG_INFO:
+			binlog_read_info(&s);
+			info = 1;
+			break;
+		case TAG_DMSG:
+			binlog_read_dmsg(&s);
+			break;
+		case TAG_TOPO:
+			binlog_read_topo(&s);
+			break;
+		case TAG_SYST:
+			binlog_read_syst(&s);
+			syst = 1;
+			break;
+		case TAG_PROC:
+			binlog_read_procs(&s);
+			break;
+		case TAG_TASK:
+			binlog_read_tasks(&s);
+			break;
+		case TAG_CGRP:
+			binlog_read_cgroups(&s);
+			break;
+		case TAG_PSI:
+			binlog_read_psi(&s);
+			break;
+		case TAG_DISK:
+			binlog_read_disks(&s);
+			break;
+		default:
+			break;
+		}
+		c.err = s.err;
+	}
+
+	munmap((void *)map, st.st_size);
+
+	if (strm && !c.err && binlog_stream_finish(info))
+		c.err = 1;
+	binlog_stream_free();
+
+	if (c.err || !head || !(syst || strm)) {
+		fprintf(stderr, "bootchartd: %s is truncated or damaged\n", filename);
+		return -1;
+	}
+
+	if (relative == 2) {
+		relative = 1;
+		graph_start = sample_time(0);
+	}
+
+	/* a damaged clock can't be drawn */
+	if (!(hz > 0.0) || !isfinite(hz) || !(interval > 0.0) || !isfinite(interval) ||
+	    !isfinite(graph_start) || !isfinite(log_start) ||
+	    !(sample_time(samples - 1) - graph_start < BINLOG_SPAN)) {
+		fprintf(stderr, "bootchartd: %s is truncated or damaged\n", filename);
+		return -1;
+	}
+
+	return 0;
+}
@@ -28,37 +28,60 @@
 
 #include "bootchart.h"
 
-double graph_start;
-double log_start;
-double sampletime[MAXSAMPLES];
-struct ps_struct *ps_first;
-struct block_stat_struct blockstat[MAXSAMPLES];
-int entropy_avail[MAXSAMPLES];
-struct cpu_stat_struct cpustat[MAXCPUS];
-int pscount;
-int cpus;
-double interval;
-FILE *of;
-int overrun = 0;
 static int exiting = 0;
-
-/* graph defaults */
-int entropy = 0;
-int initcall = 1;
-int relative;
-int filter = 1;
-int pss = 0;
-int samples;
-int len = 500; /* we record len+1 (1 start sample) */
-double hz = 25.0;   /* 20 seconds log time */
-double scale_x = 100.0; /* 100px = 1sec */
-double scale_y = 20.0;  /* 16px = 1 process bar */
-
-char init_path[PATH_MAX] = "/sbin/init";
-char output_path[PATH_MAX] = "/var/log";
+static int dump_requested = 0;
+static char render_path[PATH_MAX];
 
 static struct rlimit rlim;
 
+/* wakeup latency per tick, bucket b holds [2^(b-1), 2^b) usec */
+#define LATENCY_BUCKETS 20
+static int latency[LATENCY_BUCKETS];
+
+static long long tick_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+static void latency_add(long long ns)
+{
+	long long us = ns / 1000;
+	int b = 0;
+
+	while (us && (b < LATENCY_BUCKETS - 1)) {
+		us >>= 1;
+		b++;
+	}
+	latency[b]++;
+}
+
+
+static void latency_report(void)
+{
+	int total = 0;
+	int b;
+
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+		total += latency[b];
+	if (!total)
+		return;
+
+	fprintf(stderr, "bootchartd: tick latency over %i ticks:\n", total);
+	for (b = 0; b < LATENCY_BUCKETS; b++) {
+		if (!latency[b])
+			continue;
+		if (b == LATENCY_BUCKETS - 1)
+			fprintf(stderr, "  >= %7ius %7i\n", 1 << (b - 1), latency[b]);
+		else
+			fprintf(stderr, "  <  %7ius %7i\n", 1 << b, latency[b]);
+	}
+}
+
 static void signal_handler(int sig)
 {
 	if (sig++)
@@ -67,17 +90,133 @@ static void signal_handler(int sig)
 }
 
 
+static void dump_handler(int sig)
+{
+	if (sig++)
+		sig--;
+	dump_requested = 1;
+}
+
+
+static void output_name(char *output_file, const char *datefmt, const char *ext)
+{
+	char datestr[200];
+	time_t t;
+
+	t = time(NULL);
+	strftime(datestr, sizeof(datestr), datefmt, localtime(&t));
+	path_printf(output_file, PATH_MAX, "%s/bootchart-%s.%s", output_path, datestr, ext);
+}
+
+
+/* with --profile, what the collector and the chart cost goes next to them */
+static int profile_write(const char *output_file)
+{
+	int r;
+
+	if (!profile)
+		return 0;
+
+	r = prof_write(output_file);
+	if (r < 0)
+		return -1;
+	if (!r)
+		fprintf(stderr, "bootchartd: Wrote %s\n", output_file);
+
+	return 0;
+}
+
+
+/* write the chart, or with --log the binary log to draw it from later */
+static int chart_write(const char *datefmt)
+{
+	char output_file[PATH_MAX];
+	char profile_file[PATH_MAX];
+	int r;
+
+	/* named together, the chart may take a while */
+	output_name(output_file, datefmt, binlog ? "log" : "svg");
+	output_name(profile_file, datefmt, "profile");
+
+	if (binlog) {
+		if (binlog_write(output_file))
+			return -1;
+		fprintf(stderr, "bootchartd: Wrote %s\n", output_file);
+		return profile_write(profile_file);
+	}
+
+	of = fopen(output_file, "w");
+	if (!of) {
+		perror("open output_file");
+		return -1;
+	}
+
+	r = svg_do();
+	if (fclose(of) || r) {
+		perror("write output_file");
+		return -1;
+	}
+	fprintf(stderr, "bootchartd: Wrote %s\n", output_file);
+
+	return profile_write(profile_file);
+}
+
+
+/*
+ * Flight recorder: turn the last len samples in the ring into a plain
+ * recording the renderer understands. There's no sampling after this.
+ */
+static void ring_rewind(void)
+{
+	int base = (samples > len) ? samples - len : 0;
+	int n = samples - base;
+
+	log_rewind(base, n);
+	store_rewind(base, n);
+	ring = 0;
+	window = 0;
+	samples = n;
+
+	/* draw the window, not everything since boot */
+	if (base) {
+		relative = 1;
+		graph_start = sample_time(0);
+	}
+}
+
+
+/*
+ * Write out the ring from a forked copy of ourselves, so sampling
+ * goes on while the chart is drawn.
+ */
+static void ring_dump(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork()");
+		return;
+	}
+	if (pid)
+		return;
+
+	ring_rewind();
+	_exit(chart_write("%Y%m%d-%H%M%S") ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
 int main(int argc, char *argv[])
 {
 	struct sigaction sig;
 	struct ps_struct *ps;
-	char output_file[PATH_MAX];
-	char datestr[200];
-	time_t t;
+	const char *datefmt = "%Y%m%d-%H%M";
+	long long tick_start;
+	long long tick = 0;
+	int lost = 0;
+	size_t n;
 	FILE *f;
 
-	memset(&t, 0, sizeof(time_t));
-
 	rlim.rlim_cur = 4096;
 	rlim.rlim_max = 4096;
 	(void) setrlimit(RLIMIT_NOFILE, &rlim);
@@ -116,16 +255,50 @@ int main(int argc, char *argv[])
 				filter = atoi(val);
 			if (!strcmp(key, "pss"))
 				pss = atoi(val);
+			if (!strcmp(key, "pss_freq"))
+				pss_hz = atof(val);
 			if (!strcmp(key, "output"))
 				strncpy(output_path, val, PATH_MAX - 1);
 			if (!strcmp(key, "init"))
 				strncpy(init_path, val, PATH_MAX - 1);
+			if (!strcmp(key, "root"))
+				strncpy(root_path, val, PATH_MAX - 1);
 			if (!strcmp(key, "scale_x"))
 				scale_x = atof(val);
 			if (!strcmp(key, "scale_y"))
 				scale_y = atof(val);
 			if (!strcmp(key, "entropy"))
 				entropy = atoi(val);
+			if (!strcmp(key, "diskstats"))
+				diskstats = atoi(val);
+			if (!strcmp(key, "heatmap"))
+				heatmap = atoi(val);
+			if (!strcmp(key, "pressure"))
+				psi = atoi(val);
+			if (!strcmp(key, "events"))
+				events = atoi(val);
+			if (!strcmp(key, "taskstats"))
+				taskstats = atoi(val);
+			if (!strcmp(key, "threads"))
+				threads = atoi(val);
+			if (!strcmp(key, "uring"))
+				uring = atoi(val);
+			if (!strcmp(key, "ring"))
+				ring = atoi(val);
+			if (!strcmp(key, "adaptive"))
+				adaptive = atoi(val);
+			if (!strcmp(key, "fds"))
+				fd_budget = atoi(val);
+			if (!strcmp(key, "log"))
+				binlog = atoi(val);
+			if (!strcmp(key, "stream"))
+				stream = atoi(val);
+			if (!strcmp(key, "tasks"))
+				tasks = atoi(val);
+			if (!strcmp(key, "cgroups"))
+				cgroups = atoi(val);
+			if (!strcmp(key, "profile"))
+				profile = atoi(val);
 		}
 		fclose(f);
 	}
@@ -136,19 +309,37 @@ int main(int argc, char *argv[])
 			{"freq", 1, NULL, 'f'},
 			{"samples", 1, NULL, 'n'},
 			{"pss", 0, NULL, 'p'},
+			{"pss-freq", 1, NULL, 'P'},
 			{"output", 1, NULL, 'o'},
 			{"init", 1, NULL, 'i'},
+			{"root", 1, NULL, 'C'},
 			{"filter", 0, NULL, 'F'},
 			{"help", 0, NULL, 'h'},
 			{"scale-x", 1, NULL, 'x'},
 			{"scale-y", 1, NULL, 'y'},
 			{"entropy", 0, NULL, 'e'},
+			{"diskstats", 0, NULL, 'D'},
+			{"heatmap", 0, NULL, 'H'},
+			{"pressure", 0, NULL, 'S'},
+			{"events", 0, NULL, 'E'},
+			{"taskstats", 0, NULL, 't'},
+			{"threads", 1, NULL, 'T'},
+			{"uring", 0, NULL, 'u'},
+			{"ring", 0, NULL, 'R'},
+			{"adaptive", 1, NULL, 'a'},
+			{"fds", 1, NULL, 'd'},
+			{"log", 0, NULL, 'l'},
+			{"render", 1, NULL, 'L'},
+			{"stream", 0, NULL, 's'},
+			{"tasks", 0, NULL, 'k'},
+			{"cgroups", 0, NULL, 'g'},
+			{"profile", 0, NULL, 'O'},
 			{NULL, 0, NULL, 0}
 		};
 
 		int index = 0, c;
 
-		c = getopt_long(argc, argv, "erpf:n:o:i:Fhx:y:", opts, &index);
+		c = getopt_long(argc, argv, "a:C:d:DeEgHkrlL:ORpP:f:n:o:i:FhsStT:ux:y:", opts, &index);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -170,9 +361,15 @@ int main(int argc, char *argv[])
 		case 'i':
 			strncpy(init_path, optarg, PATH_MAX - 1);
 			break;
+		case 'C':
+			strncpy(root_path, optarg, PATH_MAX - 1);
+			break;
 		case 'p':
 			pss = 1;
 			break;
+		case 'P':
+			pss_hz = atof(optarg);
+			break;
 		case 'x':
 			scale_x = atof(optarg);
 			break;
@@ -182,6 +379,54 @@ int main(int argc, char *argv[])
 		case 'e':
 			entropy = 1;
 			break;
+		case 'D':
+			diskstats = 1;
+			break;
+		case 'H':
+			heatmap = 1;
+			break;
+		case 'S':
+			psi = 1;
+			break;
+		case 'E':
+			events = 1;
+			break;
+		case 't':
+			taskstats = 1;
+			break;
+		case 'T':
+			threads = atoi(optarg);
+			break;
+		case 'u':
+			uring = 1;
+			break;
+		case 'R':
+			ring = 1;
+			break;
+		case 'a':
+			adaptive = atoi(optarg);
+			break;
+		case 'd':
+			fd_budget = atoi(optarg);
+			break;
+		case 'l':
+			binlog = 1;
+			break;
+		case 'L':
+			strncpy(render_path, optarg, PATH_MAX - 1);
+			break;
+		case 's':
+			stream = 1;
+			break;
+		case 'k':
+			tasks = 1;
+			break;
+		case 'g':
+			cgroups = 1;
+			break;
+		case 'O':
+			profile = 1;
+			break;
 		case 'h':
 			fprintf(stderr, "Usage: %s [OPTIONS]\n", argv[0]);
 			fprintf(stderr, " --rel,     -r            Record time relative to recording\n");
@@ -190,9 +435,31 @@ int main(int argc, char *argv[])
 			fprintf(stderr, " --scale-x, -x N          Scale the graph horizontally [%f] \n", scale_x);
 			fprintf(stderr, " --scale-y, -y N          Scale the graph vertically [%f] \n", scale_y);
 			fprintf(stderr, " --pss,     -p            Enable PSS graph (CPU intensive)\n");
+			fprintf(stderr, " --pss-freq, -P N         PSS sample frequency [%f]\n", pss_hz);
 			fprintf(stderr, " --entropy, -e            Enable the entropy_avail graph\n");
+			fprintf(stderr, " --diskstats, -D          Enable per disk throughput and latency graphs\n");
+			fprintf(stderr, " --heatmap, -H            Draw the utilization of every cpu\n");
+			fprintf(stderr, " --pressure, -S           Enable the CPU, IO and memory pressure graph\n");
+			fprintf(stderr, " --events,  -E            Track processes through the proc connector\n");
+			fprintf(stderr, " --taskstats, -t          Use taskstats for per process CPU and delays\n");
+			fprintf(stderr, " --threads, -T N          Sample processes with N threads [%d]\n", threads);
+			fprintf(stderr, " --tasks,   -k            Sample and draw every thread of a process\n");
+			fprintf(stderr, " --cgroups, -g            Sample and draw cgroups instead of processes\n");
+			fprintf(stderr, " --uring,   -u            Batch all reads of a sample through io_uring\n");
+			fprintf(stderr, " --ring,    -R            Keep recording the last [%d] samples until\n", len);
+			fprintf(stderr, "                          stopped, write a chart on SIGUSR1\n");
+			fprintf(stderr, " --adaptive, -a N         Probe processes that didn't run for N\n");
+			fprintf(stderr, "                          samples less often\n");
+			fprintf(stderr, " --fds,     -d N          Keep at most N process files open [%d]\n", fd_budget);
+			fprintf(stderr, "                          (0 = all but 256 of the fd limit)\n");
+			fprintf(stderr, " --log,     -l            Write a binary log instead of the chart\n");
+			fprintf(stderr, " --render,  -L [FILE]     Draw the chart of a binary log and exit\n");
+			fprintf(stderr, " --stream,  -s            Write the binary log while recording\n");
+			fprintf(stderr, " --profile, -O            Time every phase of the collector and every\n");
+			fprintf(stderr, "                          part of the chart, write a summary next to it\n");
 			fprintf(stderr, " --output,  -o [PATH]     Path to output files [%s]\n", output_path);
 			fprintf(stderr, " --init,    -i [PATH]     Path to init executable [%s]\n", init_path);
+			fprintf(stderr, " --root,    -C [PATH]     Read proc and sys below PATH instead of /\n");
 			fprintf(stderr, " --filter,  -F            Disable filtering of processes from the graph\n");
 			fprintf(stderr, "                          that are of less importance or short-lived\n");
 			fprintf(stderr, " --help,    -h            Display this message\n");
@@ -204,8 +471,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (len > MAXSAMPLES) {
-		fprintf(stderr, "Error: samples exceeds maximum\n");
+	if (len < 1) {
+		fprintf(stderr, "Error: samples needs to be > 0\n");
 		exit(EXIT_FAILURE);
 	}
 
@@ -214,6 +481,68 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (threads < 1) {
+		fprintf(stderr, "Error: threads needs to be > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fd_budget < 0) {
+		fprintf(stderr, "Error: fds needs to be >= 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* leave room for the files we open once, and PSS/ring children */
+	if (!fd_budget) {
+		getrlimit(RLIMIT_NOFILE, &rlim);
+		fd_budget = (rlim.rlim_cur > 512) ? (int)rlim.rlim_cur - 256 : (int)rlim.rlim_cur / 2;
+	}
+
+	if (adaptive < 0) {
+		fprintf(stderr, "Error: adaptive needs to be >= 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pss_hz <= 0.0) {
+		fprintf(stderr, "Error: PSS frequency needs to be > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ring && stream) {
+		fprintf(stderr, "Error: ring and stream can't be used together\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* "/" and "" are the same, and the longest file we read must fit */
+	while ((n = strlen(root_path)) && (root_path[n - 1] == '/'))
+		root_path[n - 1] = '\0';
+	if (strlen(root_path) > PATH_MAX / 2) {
+		fprintf(stderr, "Error: root path too long\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a copied or generated /proc has no kernel behind it to talk to */
+	if (root_path[0] && (events || taskstats)) {
+		fprintf(stderr, "bootchartd: events and taskstats are not used with a root\n");
+		events = 0;
+		taskstats = 0;
+	}
+
+	/* cgroups are found and sampled on their own */
+	if (cgroups && (tasks || events || taskstats || uring || (threads > 1))) {
+		fprintf(stderr, "bootchartd: cgroups mode doesn't use tasks, events, taskstats, uring or threads\n");
+		tasks = 0;
+		events = 0;
+		taskstats = 0;
+		uring = 0;
+		threads = 1;
+	}
+
+	/* keep only the samples we may still need */
+	if (ring)
+		window = len + 1;
+	else if (stream)
+		window = SERIES_CHUNK;
+
 	/*
 	 * If the kernel executed us through init=/sbin/bootchartd, then
 	 * fork:
@@ -227,6 +556,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* the charts are drawn in forked copies, they need to know us */
+	collector_pid = getpid();
+
 	/* start with empty ps LL */
 	ps_first = malloc(sizeof(struct ps_struct));
 	if (!ps_first) {
@@ -235,115 +567,188 @@ int main(int argc, char *argv[])
 	}
 	memset(ps_first, 0, sizeof(struct ps_struct));
 
+	/* draw a recording made earlier, maybe somewhere else */
+	if (render_path[0]) {
+		binlog = 0;
+		stream = 0;
+		window = 0;
+		if (binlog_read(render_path) || chart_write("%Y%m%d-%H%M%S"))
+			exit (EXIT_FAILURE);
+		log_cleanup();
+		store_free();
+		prof_free();
+		free(ps_first);
+		return 0;
+	}
+
+	store_init();
+
 	/* handle TERM/INT nicely */
 	memset(&sig, 0, sizeof(struct sigaction));
 	sig.sa_handler = signal_handler;
 	sigaction(SIGHUP, &sig, NULL);
 
+	if (ring) {
+		sig.sa_handler = dump_handler;
+		sigaction(SIGUSR1, &sig, NULL);
+		/* nobody waits for the dump children */
+		sig.sa_handler = SIG_IGN;
+		sigaction(SIGCHLD, &sig, NULL);
+	}
+
 	interval = (1.0 / hz) * 1000000000.0;
 
 	log_uptime();
 
+	if (stream) {
+		char output_file[PATH_MAX];
+
+		output_name(output_file, datefmt, "log");
+		if (stream_start(output_file))
+			exit (EXIT_FAILURE);
+		fprintf(stderr, "bootchartd: Writing %s\n", output_file);
+	}
+
+	tick_start = tick_now();
+
 	/* main program loop */
 	while (!exiting) {
-		int res;
-		double sample_stop;
 		struct timespec req;
-		time_t newint_s;
-		long newint_ns;
-		double elapsed;
-		double timeleft;
+		struct timespec cpu;
+		long long deadline;
+		long long now;
+		int res;
 
-		sampletime[samples] = gettime_ns();
+		series_set_double(&sampletime, samples, gettime_ns());
+		series_set_int(&sampleskip, samples, lost);
 
 		/* wait for /proc to become available, discarding samples */
-		if (!graph_start)
+		if (!graph_start) {
 			log_uptime();
-		else
+		} else {
+			clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+			collector_cpu -= cpu.tv_sec + cpu.tv_nsec / 1000000000.0;
 			log_sample(samples);
-
-		sample_stop = gettime_ns();
-
-		elapsed = (sample_stop - sampletime[samples]) * 1000000000.0;
-		timeleft = interval - elapsed;
-
-		newint_s = (time_t)(timeleft / 1000000000.0);
-		newint_ns = (long)(timeleft - (newint_s * 1000000000.0));
+			clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+			collector_cpu += cpu.tv_sec + cpu.tv_nsec / 1000000000.0;
+			prof_phase(PROF_STREAM);
+			stream_sample(samples);
+			prof_tick();
+		}
 
 		/*
-		 * check if we have not consumed our entire timeslice. If we
-		 * do, don't sleep and take a new sample right away.
-		 * we'll lose all the missed samples and overrun our total
-		 * time
+		 * Samples are taken on a fixed grid of ticks, so time spent
+		 * sampling doesn't make us drift. If we're already past the
+		 * next tick, the ticks we missed are lost: we note them in
+		 * front of the next sample and wait for the first tick ahead.
 		 */
-		if ((newint_ns > 0) || (newint_s > 0)) {
-			req.tv_sec = newint_s;
-			req.tv_nsec = newint_ns;
-
-			res = nanosleep(&req, NULL);
-			if (res) {
-				if (errno == EINTR) {
-					/* caught signal, probably HUP! */
-					break;
-				}
-				perror("nanosleep()");
+		tick++;
+		deadline = tick_start + (long long)(tick * interval);
+		now = tick_now();
+		lost = 0;
+		if (now >= deadline) {
+			lost = (int)((now - deadline) / interval) + 1;
+			overrun++;
+			dropped += lost;
+			tick += lost;
+			deadline = tick_start + (long long)(tick * interval);
+		}
+
+		req.tv_sec = deadline / 1000000000LL;
+		req.tv_nsec = deadline % 1000000000LL;
+		while ((res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL))) {
+			if (res != EINTR) {
+				errno = res;
+				perror("clock_nanosleep()");
 				exit (EXIT_FAILURE);
 			}
-		} else {
-			overrun++;
-			/* calculate how many samples we lost and scrap them */
-			len = len + ((int)(newint_ns / interval));
+			/* caught signal, probably HUP! */
+			if (exiting)
+				break;
 		}
+		if (exiting)
+			break;
+
+		latency_add(tick_now() - deadline);
 
 		samples++;
 
-		if (samples > len)
+		if (ring) {
+			/* forget what the next sample overwrites */
+			if (samples > len) {
+				prof_phase(PROF_STREAM);
+				log_evict(samples - len);
+				prof_phase(PROF_NONE);
+			}
+			if (dump_requested) {
+				dump_requested = 0;
+				ring_dump();
+			}
+			continue;
+		}
+
+		/* what exited is in the log by now */
+		if (stream) {
+			prof_phase(PROF_STREAM);
+			log_evict(samples - 1);
+			prof_phase(PROF_NONE);
+		}
+
+		/* len ticks of recording time, lost ticks included */
+		if (tick > len)
 			break;
 
 	}
 
+	pss_stop();
+	shards_stop();
+	uring_close();
+
+	if (ring) {
+		ring_rewind();
+		datefmt = "%Y%m%d-%H%M%S";
+	}
+
 	/* do some cleanup, close fd's */
 	ps = ps_first;
 	while (ps->next_ps) {
 		ps = ps->next_ps;
+		stream_ps_info(ps);
 		if (ps->schedstat)
 			close(ps->schedstat);
 		if (ps->sched)
 			close(ps->sched);
+		if (ps->iostat)
+			close(ps->iostat);
 		if (ps->smaps)
 			fclose(ps->smaps);
 	}
-	closedir(proc);
-
-	t = time(NULL);
-	strftime(datestr, sizeof(datestr), "%Y%m%d-%H%M", localtime(&t));
-	snprintf(output_file, PATH_MAX, "%s/bootchart-%s.svg", output_path, datestr);
-
-	of = fopen(output_file, "w");
-	if (!of) {
-		perror("open output_file");
+	if (proc)
+		closedir(proc);
+	events_close();
+	taskstats_close();
+
+	if (stream) {
+		char profile_file[PATH_MAX];
+
+		output_name(profile_file, datefmt, "profile");
+		if (stream_stop() || profile_write(profile_file))
+			exit (EXIT_FAILURE);
+	} else if (chart_write(datefmt)) {
 		exit (EXIT_FAILURE);
 	}
 
-	svg_do();
-
-	fprintf(stderr, "bootchartd: Wrote %s\n", output_file);
-	fclose(of);
-
 	/* nitpic cleanups */
-	ps = ps_first;
-	while (ps->next_ps) {
-		struct ps_struct *old = ps;
-		ps = ps->next_ps;
-		free(old->sample);
-		free(old);
-	}
-	free(ps->sample);
-	free(ps);
+	log_cleanup();
+	store_free();
+	prof_free();
+	free(ps_first);
 
 	/* don't complain when overrun once, happens most commonly on 1st sample */
 	if (overrun > 1)
-		fprintf(stderr, "bootchartd: Warning: sample time overrun %i times\n", overrun);
+		fprintf(stderr, "bootchartd: Warning: sample time overrun %i times, %i samples lost\n",
+			overrun, dropped);
+	latency_report();
 
 	return 0;
 }
@@ -11,56 +11,212 @@
  * of the License.
  */
 
+#include <stdarg.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "config.h"
 
-#define MAXCPUS        16
-#define MAXPIDS     65535
-#define MAXSAMPLES   8192
+/*
+ * Per sample system data is kept in growable series, one per value,
+ * in chunks of SERIES_CHUNK samples. See store.c.
+ */
+#define SERIES_CHUNK 1024
+
+struct series_struct {
+	int width;      /* bytes per sample */
+	int nchunks;
+	char **chunk;
+};
+
+extern void *series_slot(struct series_struct *s, int i);
+
+/*
+ * Storage slot of sample i. In ring mode (flight recorder) only the
+ * last len + 1 samples are kept and sample numbers wrap around, when
+ * streaming only the last SERIES_CHUNK. window is 0 otherwise.
+ */
+extern int ring;
+extern int len;
+extern int window;
+#define sample_slot(i) (window ? (i) % window : (i))
+
+/* samples that were never written read as 0 */
+static inline const void *series_peek(const struct series_struct *s, int i)
+{
+	int c;
+
+	if (i < 0)
+		return NULL;
 
+	i = sample_slot(i);
+	c = i / SERIES_CHUNK;
+	if ((c >= s->nchunks) || !s->chunk[c])
+		return NULL;
 
-struct block_stat_struct {
-	/* /proc/vmstat pgpgin & pgpgout */
-	int bi;
-	int bo;
+	return s->chunk[c] + (i % SERIES_CHUNK) * s->width;
+}
+
+static inline double series_double(const struct series_struct *s, int i)
+{
+	const double *d = series_peek(s, i);
+
+	return d ? *d : 0.0;
+}
+
+static inline int series_int(const struct series_struct *s, int i)
+{
+	const int *d = series_peek(s, i);
+
+	return d ? *d : 0;
+}
+
+static inline void series_set_double(struct series_struct *s, int i, double v)
+{
+	*(double *)series_slot(s, sample_slot(i)) = v;
+}
+
+static inline void series_set_int(struct series_struct *s, int i, int v)
+{
+	*(int *)series_slot(s, sample_slot(i)) = v;
+}
+
+#define sample_time(i) series_double(&sampletime, (i))
+
+/* process lifetime events, from the proc connector */
+#define PS_EVENT_FORK  1
+#define PS_EVENT_EXEC  2
+#define PS_EVENT_COMM  3
+#define PS_EVENT_EXIT  4
+#define PS_EVENT_LOST  5 /* kernel dropped events, rescan /proc */
+
+struct ps_event_struct {
+	int what;
+	int pid;
+	int ppid;
+	/* CLOCK_MONOTONIC, same base as gettime_ns() */
+	double time;
+	char comm[16];
 };
 
-struct cpu_stat_sample_struct {
-	/* /proc/schedstat fields 10 & 11 (after name) */
+/* taskstats numbers for one task, all in ns */
+struct ps_taskstats_struct {
+	int pid;
 	double runtime;
 	double waittime;
+	double blkio;
+	double swapin;
+
+	/* cgroups mode: bytes read and written, from io.stat */
+	double rbytes;
+	double wbytes;
 };
 
-struct cpu_stat_struct {
-	/* per cpu array */
-	struct cpu_stat_sample_struct sample[MAXSAMPLES];
+/* one read in an io_uring batch */
+struct uring_read_struct {
+	int fd;
+	int size;   /* including room for the terminating '\0' */
+	char *buf;  /* set by uring_read() */
+	int res;    /* like the return value of pread() */
+	/* caller's bookkeeping */
+	int what;
+	struct ps_struct *ps;
+};
+
+/* fixed size object pools, see pool.c */
+#define POOL_SLAB (64 * 1024)
+
+struct pool_struct {
+	size_t size;
+	char *slab;           /* newest slab, they're chained */
+	size_t used;          /* bytes handed out of it */
+	void *free;           /* released objects */
+	pthread_mutex_t lock;
 };
 
-/* per process, per sample data we will log */
-struct ps_sched_struct {
-	/* /proc/<n>/schedstat fields 1 & 2 */
+#define POOL_INIT(type) { sizeof(type), NULL, 0, NULL, PTHREAD_MUTEX_INITIALIZER }
+
+extern void *pool_alloc(struct pool_struct *p);
+extern void pool_free(struct pool_struct *p, void *obj);
+extern void pool_destroy(struct pool_struct *p);
+
+/*
+ * Per process samples. Run and wait time are stored as zigzag varint
+ * deltas from the previous sample, in blocks of up to PS_BLOCK samples
+ * that start with the absolute values. Storage only covers the samples
+ * a process was alive for, and old blocks can be dropped. PSS is only
+ * sampled now and then, and kept as a list of (sample, value) pairs.
+ * See store.c, the renderer reads through ps_runtime() and friends.
+ */
+#define PS_BLOCK 64
+#define PS_BLOCK_DATA 216 /* makes a block 256 bytes */
+
+struct ps_block_struct {
+	struct ps_block_struct *next;
+	int first;            /* sample number of entry 0 */
+	int count;
+	/* /proc/<n>/schedstat fields 1 & 2 of entry 0 */
 	double runtime;
 	double waittime;
+	/* entries 1 .. count - 1 */
+	int size;
+	unsigned char data[PS_BLOCK_DATA];
+};
+
+struct ps_pss_struct {
+	int sample;
 	int pss;
 };
 
+struct ps_store_struct {
+	struct ps_block_struct *head;
+	struct ps_block_struct *tail;
+	int next;             /* sample number of the next entry */
+	double runtime;       /* last appended values */
+	double waittime;
+
+	struct ps_pss_struct *pss;
+	int npss;
+	int pss_alloc;
+
+	/* read cursors, sample ri and the one before it */
+	struct ps_block_struct *rblock;
+	int ri;
+	int rpos;
+	double rruntime;
+	double rwaittime;
+	int rprev;
+	double rprev_runtime;
+	double rprev_waittime;
+	int rpss;
+};
+
 /* process info */
 struct ps_struct {
 	struct ps_struct *next_ps;    /* SLL pointer */
 	struct ps_struct *parent;     /* ppid ref */
 	struct ps_struct *children;   /* children */
+	struct ps_struct *last_child; /* tail of children */
 	struct ps_struct *next;       /* siblings */
+	struct ps_struct *next_shard; /* collector thread SLL */
 
 	/* must match - otherwise it's a new process with same PID */
 	char name[16];
 	int pid;
 	int ppid;
+	int tgid;     /* tasks mode: the process of a thread, 0 for a process */
+	char *cgroup; /* cgroups mode: path below cgroup_root, NULL for a process */
 
-	/* cache fd's */
+	/*
+	 * cache fd's: 0 = not open, -1 = process gone, see fdcache.c. In
+	 * cgroups mode, schedstat is cpu.stat and sched is memory.current.
+	 */
 	int sched;
 	int schedstat;
+	int iostat;
 	FILE *smaps;
+	int fd_used;
+	int fd_evicted;
 
 	/* index to first/last seen timestamps */
 	int first;
@@ -69,9 +225,29 @@ struct ps_struct {
 	/* records actual start time, may be way before bootchart runs */
 	double starttime;
 
+	/* exit time, only known with the proc connector */
+	double exittime;
+
 	/* record human readable total cpu time */
 	double total;
 
+	/* block IO and swap-in delay totals, taskstats only */
+	double blkio;
+	double swapin;
+
+	/* cgroups mode: bytes read and written, from io.stat */
+	double rbytes;
+	double wbytes;
+
+	/* number in the streaming log, and whether it was announced */
+	int sid;
+	int announced;
+
+	/* adaptive cadence: sample last probed, next probe, idle probes */
+	int probed;
+	int next_probe;
+	int idle;
+
 	/* largest PSS size found */
 	int pss_max;
 
@@ -79,41 +255,284 @@ struct ps_struct {
 	double pos_x;
 	double pos_y;
 
-	struct ps_sched_struct *sample;
+	struct ps_store_struct store;
 };
 
-extern int entropy_avail[];
 
 extern double graph_start;
 extern double log_start;
-extern double sampletime[];
 extern struct ps_struct *ps_first;
-extern struct block_stat_struct blockstat[];
-extern struct cpu_stat_struct cpustat[];
+
+/* store.c */
+extern struct series_struct sampletime;         /* double */
+extern struct series_struct blockstat_bi;       /* int, /proc/vmstat pgpgin */
+extern struct series_struct blockstat_bo;       /* int, /proc/vmstat pgpgout */
+extern struct series_struct entropy_avail;      /* int */
+extern struct series_struct sampleskip;         /* int, ticks lost before each sample */
+extern struct series_struct *cpu_runtime;       /* double, [cpus_max] */
+extern struct series_struct *cpu_waittime;      /* double, [cpus_max] */
+extern int cpus_max;
+
+/* /proc/pressure stall totals, in usec, "some" and "full" per resource */
+#define PSI_CPU_SOME 0
+#define PSI_CPU_FULL 1
+#define PSI_IO_SOME  2
+#define PSI_IO_FULL  3
+#define PSI_MEM_SOME 4
+#define PSI_MEM_FULL 5
+#define PSI_FIELDS   6
+
+extern struct series_struct psi_total[PSI_FIELDS]; /* double */
+
+/*
+ * Per device /proc/diskstats counters, whole disks only. A device that
+ * shows up during the recording has no samples before first.
+ */
+#define DISK_RD_IOS     0
+#define DISK_RD_SECTORS 1
+#define DISK_RD_TICKS   2 /* ms */
+#define DISK_WR_IOS     3
+#define DISK_WR_SECTORS 4
+#define DISK_WR_TICKS   5
+#define DISK_IN_FLIGHT  6
+#define DISK_IO_TICKS   7 /* ms spent doing I/O */
+#define DISK_QUEUE      8 /* ms, weighted by requests in flight */
+#define DISK_FIELDS     9
+
+struct disk_struct {
+	char name[16];
+	int first;
+	struct series_struct s[DISK_FIELDS]; /* double */
+};
+
+extern struct disk_struct *disks;
+extern int ndisks;
+extern struct disk_struct *store_disk(int n);
+extern void store_init(void);
+extern void store_cpus(int c);
+extern void store_free(void);
+extern void store_rewind(int base, int n);
+extern void ps_store_append(struct ps_struct *ps, int sample, double runtime, double waittime);
+extern int ps_store_load(struct ps_struct *ps, const struct ps_block_struct *in);
+extern void ps_store_pss(struct ps_struct *ps, int sample, int pss);
+extern void ps_store_trim(struct ps_struct *ps, int base);
+extern void ps_store_rebase(struct ps_struct *ps, int base);
+extern void ps_store_free(struct ps_struct *ps);
+extern double ps_runtime(struct ps_struct *ps, int i);
+extern double ps_waittime(struct ps_struct *ps, int i);
+extern int ps_pss(struct ps_struct *ps, int i);
+
+/* parse.c */
+#define SCHEDSTAT_SIZE (256 * 1024) /* about 1K per cpu with sched domains */
+extern int parse_vmstat(const char *buf, size_t n, int *bi, int *bo);
+extern int parse_schedstat(const char *buf, size_t n,
+			   void (*fn)(int cpu, double runtime, double waittime, void *data),
+			   void *data);
+extern int parse_diskstats(const char *buf, size_t n,
+			   void (*fn)(const char *name, size_t len, const unsigned long long *v, void *data),
+			   void *data);
+extern int parse_pressure(const char *buf, size_t n, double *some, double *full);
+extern int parse_ps_schedstat(const char *buf, size_t n, double *runtime, double *waittime);
+extern int parse_ps_sched(const char *buf, size_t n, char name[16], double *starttime);
+extern int parse_ps_stat_ppid(const char *buf, size_t n, int *ppid);
+extern int parse_cgroup_cpu(const char *buf, size_t n, double *usage, double *throttled);
+extern void parse_cgroup_io(const char *buf, size_t n, double *rbytes, double *wbytes);
+
 extern int pscount;
 extern int relative;
 extern int filter;
 extern int pss;
 extern int entropy;
+extern int diskstats;
+extern int psi;
+extern int heatmap;
+extern int events;
+extern int taskstats;
+extern int threads;
+extern int uring;
+extern int adaptive;
+extern int tasks;
+extern int cgroups;
+extern int binlog;
+extern int probes;
+extern int probes_skipped;
+extern double collector_cpu;
+extern int collector_pid;
 extern int initcall;
 extern int samples;
 extern int cpus;
-extern int len;
 extern double hz;
+extern double pss_hz;
 extern double scale_x;
 extern double scale_y;
 extern int overrun;
+extern int dropped;
 extern double interval;
 
 extern char output_path[PATH_MAX];
 extern char init_path[PATH_MAX];
+extern char root_path[PATH_MAX];
+extern char cgroup_root[PATH_MAX];
 
 extern FILE *of;
 extern DIR *proc;
 
 extern double gettime_ns(void);
+extern int path_printf(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
 extern void log_uptime(void);
 extern void log_sample(int sample);
+extern struct ps_struct *log_ps_alloc(void);
+extern void log_cleanup(void);
+extern double probes_saved(void);
+extern void log_evict(int base);
+extern void log_rewind(int base, int n);
+extern void pss_stop(void);
+extern void shards_stop(void);
+
+extern int events_open(void);
+extern int events_read(struct ps_event_struct *ev);
+extern void events_close(void);
+
+extern int taskstats_open(void);
+extern int taskstats_get(int pid, struct ps_taskstats_struct *out);
+extern int taskstats_read_exit(struct ps_taskstats_struct *out);
+extern void taskstats_close(void);
+extern void taskstats_close_thread(void);
+
+extern int fd_budget;
+extern int fd_hits;
+extern int fd_misses;
+extern int fd_reopens;
+extern int fd_evictions;
+extern int fdcache_open(struct ps_struct *ps, int *fd, const char *file);
+extern void fdcache_release(struct ps_struct *ps, int *fd);
+extern void fdcache_close(int *fd);
+extern void fdcache_count(int n);
+extern int fdcache_full(void);
+extern void fdcache_trim(void);
+extern void fdcache_forget(struct ps_struct *ps);
+
+extern int uring_open(void);
+extern int uring_read(struct uring_read_struct *reads, int n);
+extern void uring_forget(int fd);
+extern void uring_close(void);
+
+/*
+ * Collector self profiling, see profile.c. The phases of a tick, and
+ * per phase usec, syscalls and bytes read, then tick usec, collector
+ * cpu usec and resident kB make up the metrics of every tick.
+ */
+#define PROF_NONE   -1
+#define PROF_SYSTEM 0 /* vmstat, schedstat, entropy, diskstats, pressure */
+#define PROF_SCAN   1 /* finding processes, threads or cgroups */
+#define PROF_PS     2 /* sampling them, io_uring batches included */
+#define PROF_RENAME 3 /* rename checks */
+#define PROF_PSS    4 /* the PSS thread */
+#define PROF_STREAM 5 /* handing samples to the encoder, evicting */
+#define PROF_PHASES 6
+#define PROF_METRICS (PROF_PHASES * 3 + 3)
+
+extern int profile;
+extern void prof_phase(int phase);
+extern void prof_io(int calls, long long bytes);
+extern void prof_tick(void);
+extern void prof_metric_name(int m, char *name, size_t size);
+extern int prof_stats(int m, long long *p50, long long *p99, long long *max);
+extern int prof_overruns(void);
+extern void prof_section(const char *section, long long offset);
+extern int prof_write(const char *filename);
+extern void prof_free(void);
+
+/*
+ * Streaming log records, see stream.c. Values are deltas from the
+ * previous record for the same process or cpu, the encoder and the
+ * decoder in binlog.c keep the same state for that.
+ */
+#define STREAM_SAMPLE 1
+#define STREAM_CPU    2
+#define STREAM_PS     3
+#define STREAM_PSS    4
+#define STREAM_PSINFO 5
+#define STREAM_CLOCK  6
+#define STREAM_DISKINFO 7
+#define STREAM_DISK   8
+#define STREAM_PSI    9
+#define STREAM_CGINFO 10
+
+struct stream_state_struct {
+	int sample;
+	int pss_sample;
+	long long runtime;
+	long long waittime;
+	long long pss;
+};
+
+extern int stream;
+extern int stream_lost;
+extern int stream_start(const char *filename);
+extern void stream_thread(int n);
+extern void stream_sample(int sample);
+extern void stream_ps(struct ps_struct *ps, int sample, double runtime, double waittime);
+extern void stream_pss(struct ps_struct *ps, int sample, int pss);
+extern void stream_ps_info(struct ps_struct *ps);
+extern void stream_disk_info(int n);
+extern int stream_stop(void);
+
+extern int binlog_write(const char *filename);
+extern int binlog_read(const char *filename);
+extern int binlog_stream_open(const char *filename);
+extern int binlog_stream_recs(const unsigned char *buf, size_t n);
+extern int binlog_stream_close(void);
+
+/* what the chart title says about the system, see svg.c */
+struct sysdesc_struct {
+	char host[65];
+	char system[260]; /* the four utsname fields, 64 chars each */
+	char cpu[256];
+	char disk[256];
+	char cmdline[256];
+	char build[256];
+	char date[256];
+};
+
+extern struct sysdesc_struct sysdesc;
+
+/*
+ * How the cpu heatmap groups cpus: by NUMA node when there's more than
+ * one, otherwise by package. cpu_group[c] is the node or package of c.
+ */
+#define CPU_GROUP_NONE    0
+#define CPU_GROUP_PACKAGE 1
+#define CPU_GROUP_NODE    2
+
+extern int cpu_group_kind;
+extern int *cpu_group;
+extern int cpu_groups; /* entries in cpu_group */
+extern char *initcalls;
+extern int initcalls_size;
+
+extern void svg_sysdesc_read(void);
+extern int svg_do(void);
+
+/* buffered output, see outbuf.c. f is NULL to keep it all in memory */
+#define OUTBUF_SIZE (256 * 1024)
+
+struct outbuf_struct {
+	FILE *f;
+	char *buf;
+	size_t size;
+	size_t used;
+	long long flushed;    /* bytes written to f before buf */
+	int err;
+};
 
-extern void svg_do(void);
+extern void outbuf_init(struct outbuf_struct *ob, FILE *f);
+extern void outbuf_write(struct outbuf_struct *ob, const char *s, size_t n);
+extern void outbuf_printf(struct outbuf_struct *ob, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern void outbuf_vprintf(struct outbuf_struct *ob, const char *fmt, va_list ap);
+extern long long outbuf_tell(const struct outbuf_struct *ob);
+extern int outbuf_flush(struct outbuf_struct *ob);
+extern void outbuf_free(struct outbuf_struct *ob);
 
@@ -0,0 +1,193 @@
+/*
+ * events.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Process lifetime events through the kernel proc connector. This
+ * requires CONFIG_PROC_EVENTS and CAP_NET_ADMIN, the caller falls
+ * back to scanning /proc when we can't get it.
+ */
+static int nl = -1;
+static char nl_buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+static struct nlmsghdr *nl_msg;
+static ssize_t nl_left;
+
+
+static int events_send_op(enum proc_cn_mcast_op op)
+{
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))];
+	struct nlmsghdr *nlh;
+	struct cn_msg *cn;
+
+	memset(buf, 0, sizeof(buf));
+	nlh = (struct nlmsghdr *)buf;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_pid = getpid();
+
+	cn = NLMSG_DATA(nlh);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+
+	if (send(nl, nlh, nlh->nlmsg_len, 0) != (ssize_t)nlh->nlmsg_len)
+		return -1;
+
+	return 0;
+}
+
+
+int events_open(void)
+{
+	struct sockaddr_nl addr;
+	int rcvbuf = 4 * 1024 * 1024;
+
+	nl = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_CONNECTOR);
+	if (nl == -1)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = getpid();
+
+	if (bind(nl, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+
+	/* fork storms at boot easily overflow the default buffer */
+	(void) setsockopt(nl, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf));
+
+	if (events_send_op(PROC_CN_MCAST_LISTEN))
+		goto fail;
+
+	return 0;
+
+fail:
+	close(nl);
+	nl = -1;
+	return -1;
+}
+
+
+void events_close(void)
+{
+	if (nl == -1)
+		return;
+
+	(void) events_send_op(PROC_CN_MCAST_IGNORE);
+	close(nl);
+	nl = -1;
+}
+
+
+/*
+ * Fetch the next interesting event. Returns 0 when there is nothing
+ * left to read right now.
+ */
+int events_read(struct ps_event_struct *ev)
+{
+	while (1) {
+		struct cn_msg *cn;
+		struct proc_event *pe;
+
+		if (nl == -1)
+			return 0;
+
+		if (!nl_left || !NLMSG_OK(nl_msg, nl_left)) {
+			struct sockaddr_nl from;
+			socklen_t fromlen = sizeof(from);
+
+			nl_left = recvfrom(nl, nl_buf, sizeof(nl_buf), 0,
+					   (struct sockaddr *)&from, &fromlen);
+			prof_io(1, nl_left);
+			if (nl_left <= 0) {
+				nl_left = 0;
+				if (errno == ENOBUFS) {
+					memset(ev, 0, sizeof(*ev));
+					ev->what = PS_EVENT_LOST;
+					return 1;
+				}
+				return 0;
+			}
+
+			/* only trust the kernel */
+			if (from.nl_pid != 0) {
+				nl_left = 0;
+				continue;
+			}
+
+			nl_msg = (struct nlmsghdr *)nl_buf;
+		}
+
+		cn = NLMSG_DATA(nl_msg);
+		pe = (struct proc_event *)cn->data;
+		nl_msg = NLMSG_NEXT(nl_msg, nl_left);
+
+		if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+			continue;
+
+		memset(ev, 0, sizeof(*ev));
+		ev->time = pe->timestamp_ns / 1000000000.0;
+
+		switch (pe->what) {
+		case PROC_EVENT_FORK:
+			/* new threads are not new processes */
+			if (pe->event_data.fork.child_pid !=
+			    pe->event_data.fork.child_tgid)
+				continue;
+			ev->what = PS_EVENT_FORK;
+			ev->pid = pe->event_data.fork.child_tgid;
+			ev->ppid = pe->event_data.fork.parent_tgid;
+			return 1;
+		case PROC_EVENT_EXEC:
+			ev->what = PS_EVENT_EXEC;
+			ev->pid = pe->event_data.exec.process_tgid;
+			return 1;
+		case PROC_EVENT_COMM:
+			if (pe->event_data.comm.process_pid !=
+			    pe->event_data.comm.process_tgid)
+				continue;
+			ev->what = PS_EVENT_COMM;
+			ev->pid = pe->event_data.comm.process_tgid;
+			memcpy(ev->comm, pe->event_data.comm.comm, 16);
+			ev->comm[15] = '\0';
+			return 1;
+		case PROC_EVENT_EXIT:
+			if (pe->event_data.exit.process_pid !=
+			    pe->event_data.exit.process_tgid)
+				continue;
+			ev->what = PS_EVENT_EXIT;
+			ev->pid = pe->event_data.exit.process_tgid;
+			return 1;
+		default:
+			continue;
+		}
+	}
+}
@@ -0,0 +1,181 @@
+/*
+ * fdcache.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Budget for the /proc/<pid>/ handles we keep open between samples.
+ * Every tracked process holds up to three of them, so without a limit
+ * a few thousand processes exhaust RLIMIT_NOFILE.
+ *
+ * Handles are opened on demand. A handle that's released while we're
+ * over budget is closed right away, and between samples fdcache_trim()
+ * closes the handles of processes that weren't read since the last
+ * trim, so the budget goes to processes we actually sample. A closed
+ * handle is 0 again and simply reopened when needed.
+ */
+int fd_budget;
+int fd_hits;
+int fd_misses;
+int fd_reopens;
+int fd_evictions;
+
+static int fd_open;
+
+/* where the last trim stopped */
+static struct ps_struct *fd_hand;
+
+
+void fdcache_count(int n)
+{
+	__atomic_add_fetch(&fd_open, n, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Open /proc/<pid>/<file>, or <file> of the cgroup in cgroups mode,
+ * into *fd unless it's open already. Returns
+ * the fd, -1 if the process is gone, or 0 if we're out of fds and the
+ * read should be tried again next time.
+ */
+int fdcache_open(struct ps_struct *ps, int *fd, const char *file)
+{
+	char filename[PATH_MAX];
+
+	ps->fd_used = 1;
+
+	if (*fd > 0) {
+		__atomic_add_fetch(&fd_hits, 1, __ATOMIC_RELAXED);
+		return *fd;
+	}
+	if (*fd < 0)
+		return -1;
+
+	if (ps->cgroup)
+		path_printf(filename, sizeof(filename), "%s%s/%s",
+			    cgroup_root, ps->cgroup, file);
+	else
+		path_printf(filename, sizeof(filename), "%s/proc/%d/%s",
+			    root_path, ps->pid, file);
+	*fd = open(filename, O_RDONLY);
+	prof_io(1, 0);
+	if (*fd == -1) {
+		if ((errno == EMFILE) || (errno == ENFILE)) {
+			*fd = 0;
+			return 0;
+		}
+		return -1;
+	}
+
+	__atomic_add_fetch(&fd_misses, 1, __ATOMIC_RELAXED);
+	if (ps->fd_evicted)
+		__atomic_add_fetch(&fd_reopens, 1, __ATOMIC_RELAXED);
+	fdcache_count(1);
+
+	return *fd;
+}
+
+
+static void fdcache_evict(struct ps_struct *ps, int *fd)
+{
+	if (*fd <= 0)
+		return;
+
+	uring_forget(*fd);
+	close(*fd);
+	prof_io(1, 0);
+	*fd = 0;
+	ps->fd_evicted = 1;
+	fdcache_count(-1);
+	__atomic_add_fetch(&fd_evictions, 1, __ATOMIC_RELAXED);
+}
+
+
+int fdcache_full(void)
+{
+	return __atomic_load_n(&fd_open, __ATOMIC_RELAXED) > fd_budget;
+}
+
+
+/* done reading *fd for now, only keep it if we're within budget */
+void fdcache_release(struct ps_struct *ps, int *fd)
+{
+	if (fdcache_full())
+		fdcache_evict(ps, fd);
+}
+
+
+/* the process is gone, *fd won't be opened again */
+void fdcache_close(int *fd)
+{
+	if (*fd > 0) {
+		uring_forget(*fd);
+		close(*fd);
+		prof_io(1, 0);
+		fdcache_count(-1);
+	}
+	*fd = -1;
+}
+
+
+/*
+ * Called between samples, from the thread that samples. Once we're
+ * close to the budget, close the handles of every process that wasn't
+ * read since the last trim until we're down to 7/8 of it. smaps is left
+ * alone, it belongs to the PSS thread.
+ */
+void fdcache_trim(void)
+{
+	int low = fd_budget - (fd_budget / 8);
+	struct ps_struct *ps = fd_hand;
+	int n;
+
+	if (__atomic_load_n(&fd_open, __ATOMIC_RELAXED) <= low)
+		return;
+
+	for (n = 0; n < pscount; n++) {
+		ps = (ps && ps->next_ps) ? ps->next_ps : ps_first->next_ps;
+		if (!ps)
+			break;
+
+		if (ps->fd_used) {
+			ps->fd_used = 0;
+			continue;
+		}
+
+		fdcache_evict(ps, &ps->schedstat);
+		fdcache_evict(ps, &ps->sched);
+		fdcache_evict(ps, &ps->iostat);
+		if (__atomic_load_n(&fd_open, __ATOMIC_RELAXED) <= low)
+			break;
+	}
+
+	fd_hand = ps;
+}
+
+
+/* ps is about to be freed */
+void fdcache_forget(struct ps_struct *ps)
+{
+	if (fd_hand == ps)
+		fd_hand = NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ * globals.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <stdio.h>
+#include <limits.h>
+
+
+#include "bootchart.h"
+
+/*
+ * The settings and the state of a recording. Apart from main() in
+ * bootchart.c, so tests/genlog can fill them in and write a log.
+ */
+
+double graph_start;
+double log_start;
+struct ps_struct *ps_first;
+int pscount;
+int cpus;
+double interval;
+FILE *of;
+int overrun = 0;
+int dropped = 0;
+double collector_cpu;
+int collector_pid;
+
+/* graph defaults */
+int entropy = 0;
+int diskstats = 0;
+int psi = 0;
+int heatmap = 0;
+int events = 0;
+int taskstats = 0;
+int threads = 1;
+int uring = 0;
+int adaptive = 0;
+int tasks = 0;
+int cgroups = 0;
+int ring = 0;
+int window = 0;
+int binlog = 0;
+int initcall = 1;
+int relative;
+int filter = 1;
+int pss = 0;
+int samples;
+int len = 500; /* we record len+1 (1 start sample) */
+double hz = 25.0;   /* 20 seconds log time */
+double pss_hz = 1.0;
+double scale_x = 100.0; /* 100px = 1sec */
+double scale_y = 20.0;  /* 16px = 1 process bar */
+
+char init_path[PATH_MAX] = "/sbin/init";
+char output_path[PATH_MAX] = "/var/log";
+char root_path[PATH_MAX] = "";
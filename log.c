@@ -18,10 +18,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 
 #include "bootchart.h"
@@ -34,6 +38,71 @@
 static char smaps_buf[4096];
 DIR *proc;
 
+/*
+ * PID -> ps_struct index. Open addressed, linear probing, sized to a
+ * power of two and grown when half full, so lookups stay O(1) no matter
+ * how many processes we've seen or how large pid_max is.
+ */
+static struct ps_struct **ps_hash;
+static unsigned int ps_hash_size;
+static unsigned int ps_hash_count;
+
+/* tail of the ps_first SLL, so appending doesn't walk the list */
+static struct ps_struct *ps_last;
+
+/* all process records */
+static struct pool_struct ps_pool = POOL_INIT(struct ps_struct);
+
+/* processes found so far, numbers them for the streaming log */
+static int ps_sids;
+
+/* taskstats backend: 0 = not tried yet, 1 = in use, -1 = unavailable */
+static int ts_state;
+
+/* io_uring batched reads: 0 = not tried yet, 1 = in use, -1 = unavailable */
+static int ur_state;
+
+/*
+ * adaptive cadence: processes probed and samples recorded unprobed.
+ * One probe in PROBE_TIMING is timed, to tell what a skipped one saves.
+ */
+#define PROBE_TIMING 64
+int probes;
+int probes_skipped;
+static int probe_seq;
+static int probes_timed;
+static long long probe_ns;
+
+/* system wide files we keep open */
+static int vmstat;
+static int schedstat;
+static int e_fd;
+static int diskstats_fd;
+static int psi_fd[3];   /* cpu, io, memory */
+
+/*
+ * Names seen in /proc/diskstats, and their disk number, -1 for what we
+ * don't graph. The lines come in the same order every time, so the
+ * entry after the last one found is nearly always the next one.
+ */
+struct disk_seen_struct {
+	char name[16];
+	int disk;
+};
+
+static struct disk_seen_struct *disk_seen;
+static int ndisk_seen;
+static int disk_next;
+
+/* process discovery state */
+static int ev_state;
+static int scanned;
+
+/* cgroups mode: the cgroup v2 hierarchy we sample instead of processes */
+char cgroup_root[PATH_MAX];
+
+static void shard_add(struct ps_struct *ps);
+
 
 double gettime_ns(void)
 {
@@ -45,13 +114,37 @@ double gettime_ns(void)
 }
 
 
+/*
+ * Format a file name into buf, like snprintf(). One that doesn't fit
+ * is left empty, so opening it fails instead of opening another file.
+ */
+int path_printf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+
+	if ((n < 0) || ((size_t)n >= size)) {
+		buf[0] = '\0';
+		return -1;
+	}
+
+	return 0;
+}
+
+
 void log_uptime(void)
 {
+	char filename[PATH_MAX];
 	FILE *f;
 	char str[32];
 	double uptime;
 
-	f = fopen("/proc/uptime", "r");
+	path_printf(filename, sizeof(filename), "%s/proc/uptime", root_path);
+	f = fopen(filename, "r");
 	if (!f)
 		return;
 	if (!fscanf(f, "%s %*s", str)) {
@@ -71,350 +164,1779 @@ void log_uptime(void)
 }
 
 
-static char *bufgetline(char *buf)
+static unsigned int ps_hash_slot(int pid, unsigned int size)
 {
-	char *c;
+	return ((unsigned int)pid * 2654435761u) & (size - 1);
+}
+
+
+static struct ps_struct *ps_hash_find(int pid)
+{
+	unsigned int i;
 
-	if (!buf)
+	if (!ps_hash)
 		return NULL;
 
-	c = strchr(buf, '\n');
-	if (c)
-		c++;
-	return c;
+	i = ps_hash_slot(pid, ps_hash_size);
+	while (ps_hash[i]) {
+		if (ps_hash[i]->pid == pid)
+			return ps_hash[i];
+		i = (i + 1) & (ps_hash_size - 1);
+	}
+
+	return NULL;
 }
 
 
-void log_sample(int sample)
+static void ps_hash_insert(struct ps_struct *ps)
 {
-	static int vmstat;
-	static int schedstat;
-	FILE *stat;
-	char buf[4095];
-	char key[256];
-	char val[256];
-	char rt[256];
-	char wt[256];
-	char *m;
-	int c;
-	int p;
-	int mod;
-	static int e_fd;
-	ssize_t s;
-	ssize_t n;
-	struct dirent *ent;
+	unsigned int i;
 
-	if (!vmstat) {
-		/* block stuff */
-		vmstat = open("/proc/vmstat", O_RDONLY);
-		if (vmstat == -1) {
-			perror("open /proc/vmstat");
+	if ((ps_hash_count + 1) * 2 > ps_hash_size) {
+		struct ps_struct **old = ps_hash;
+		unsigned int old_size = ps_hash_size;
+		unsigned int n;
+
+		ps_hash_size = old_size ? old_size * 2 : 1024;
+		ps_hash = calloc(ps_hash_size, sizeof(struct ps_struct *));
+		if (!ps_hash) {
+			perror("calloc(ps_hash)");
 			exit (EXIT_FAILURE);
 		}
+
+		for (n = 0; n < old_size; n++) {
+			if (!old[n])
+				continue;
+			i = ps_hash_slot(old[n]->pid, ps_hash_size);
+			while (ps_hash[i])
+				i = (i + 1) & (ps_hash_size - 1);
+			ps_hash[i] = old[n];
+		}
+		free(old);
 	}
 
-	n = pread(vmstat, buf, sizeof(buf) - 1, 0);
-	if (n <= 0) {
-		close(vmstat);
+	i = ps_hash_slot(ps->pid, ps_hash_size);
+	while (ps_hash[i] && ps_hash[i]->pid != ps->pid)
+		i = (i + 1) & (ps_hash_size - 1);
+	if (!ps_hash[i])
+		ps_hash_count++;
+	ps_hash[i] = ps;
+}
+
+
+static void ps_hash_remove(struct ps_struct *ps)
+{
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+
+	if (!ps_hash)
 		return;
-	}
-	buf[n] = '\0';
 
-	m = buf;
-	while (m) {
-		if (sscanf(m, "%s %s", key, val) < 2)
-			goto vmstat_next;
-		if (!strcmp(key, "pgpgin"))
-			blockstat[sample].bi = atoi(val);
-		if (!strcmp(key, "pgpgout")) {
-			blockstat[sample].bo = atoi(val);
-			break;
-		}
-vmstat_next:
-		m = bufgetline(m);
-		if (!m)
+	i = ps_hash_slot(ps->pid, ps_hash_size);
+	while (ps_hash[i] && ps_hash[i] != ps)
+		i = (i + 1) & (ps_hash_size - 1);
+	if (!ps_hash[i])
+		return; /* a newer record for the same pid took the slot */
+
+	ps_hash[i] = NULL;
+	ps_hash_count--;
+
+	/* move back any entry that probed past the hole we just made */
+	j = i;
+	while (1) {
+		j = (j + 1) & (ps_hash_size - 1);
+		if (!ps_hash[j])
 			break;
+		k = ps_hash_slot(ps_hash[j]->pid, ps_hash_size);
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		ps_hash[i] = ps_hash[j];
+		ps_hash[j] = NULL;
+		i = j;
 	}
+}
 
-	if (!schedstat) {
-		/* overall CPU utilization */
-		schedstat = open("/proc/schedstat", O_RDONLY);
-		if (schedstat == -1) {
-			perror("open /proc/schedstat");
-			exit (EXIT_FAILURE);
-		}
+
+/* an empty record, for processes loaded from a binary log */
+struct ps_struct *log_ps_alloc(void)
+{
+	return pool_alloc(&ps_pool);
+}
+
+
+/* release all process records at once, we're done with them */
+void log_cleanup(void)
+{
+	struct ps_struct *ps;
+
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps) {
+		free(ps->store.pss);
+		free(ps->cgroup);
 	}
+	ps_first->next_ps = NULL;
+	pool_destroy(&ps_pool);
+
+	free(ps_hash);
+	ps_hash = NULL;
+	ps_hash_size = 0;
+	ps_hash_count = 0;
+	ps_last = NULL;
+
+	free(disk_seen);
+	disk_seen = NULL;
+	ndisk_seen = 0;
+}
 
-	n = pread(schedstat, buf, sizeof(buf) - 1, 0);
-	if (n <= 0) {
-		close(schedstat);
+
+/*
+ * Take the process name, and optionally the start time, from the
+ * contents of /proc/<pid>/sched in buf. Leaves ps as it was if they
+ * don't parse.
+ */
+static void ps_parse_sched(struct ps_struct *ps, const char *buf, size_t n, int starttime)
+{
+	double t;
+
+	if (parse_ps_sched(buf, n, ps->name, starttime ? &t : NULL))
 		return;
-	}
-	buf[n] = '\0';
 
-	m = buf;
-	while (m) {
-		if (sscanf(m, "%s %*s %*s %*s %*s %*s %*s %s %s", key, rt, wt) < 3)
-			goto schedstat_next;
+	if (starttime)
+		ps->starttime = t / 1000.0;
+}
 
-		if (strstr(key, "cpu")) {
-			c = atoi((const char*)(key+3));
-			if (c > MAXCPUS)
-				/* Oops, we only have room for MAXCPUS data */
-				break;
-			cpustat[c].sample[sample].runtime = atoll(rt);
-			cpustat[c].sample[sample].waittime = atoll(wt);
 
-			if (c == cpus)
-				cpus = c + 1;
-		}
-schedstat_next:
-		m = bufgetline(m);
-		if (!m)
-			break;
+/*
+ * (re)read the process name, and optionally the start time from
+ * /proc/<pid>/sched. Returns -1 when the process is gone.
+ */
+static int ps_read_sched(struct ps_struct *ps, int starttime)
+{
+	char buf[4096];
+	ssize_t s;
+	int fd;
+
+	fd = fdcache_open(ps, &ps->sched, "sched");
+	if (fd <= 0)
+		return fd;
+
+	s = pread(fd, buf, sizeof(buf) - 1, 0);
+	prof_io(1, s);
+	if (s <= 0) {
+		fdcache_close(&ps->sched);
+		return -1;
 	}
 
-	if (entropy) {
-		if (!e_fd) {
-			e_fd = open("/proc/sys/kernel/random/entropy_avail", O_RDONLY);
-		}
+	ps_parse_sched(ps, buf, s, starttime);
+	fdcache_release(ps, &ps->sched);
 
-		if (e_fd) {
-			n = pread(e_fd, buf, sizeof(buf) - 1, 0);
-			if (n > 0)
-				entropy_avail[sample] = atoi(buf);
-		}
+	return 0;
+}
+
+
+/*
+ * Append a new process record for pid, index it and hook it into the
+ * process tree. If ppid is negative, it is looked up in /proc/<pid>/stat.
+ * For a thread, pid is its tid and ppid and tgid its process.
+ */
+static struct ps_struct *ps_new(int pid, int ppid, int tgid, int sample)
+{
+	char filename[PATH_MAX];
+	struct ps_struct *ps;
+	struct ps_struct *parent;
+
+	if (!ps_last)
+		ps_last = ps_first;
+
+	ps = pool_alloc(&ps_pool);
+	ps->pid = pid;
+	ps->tgid = tgid;
+	ps->sid = ++ps_sids;
+
+	pscount++;
+
+	/* mark our first sample */
+	ps->first = sample;
+	ps->last = sample;
+
+	/* get name, start time, a cgroup is named by its caller */
+	if (cgroups)
+		ps->starttime = gettime_ns();
+	else if (ps_read_sched(ps, 1) && ppid < 0)
+		goto publish;
+
+	/* ppid */
+	if (ppid < 0) {
+		char buf[1024];
+		ssize_t n;
+		int fd;
+
+		path_printf(filename, sizeof(filename), "%s/proc/%d/stat",
+			    root_path, pid);
+		fd = open(filename, O_RDONLY);
+		prof_io(1, 0);
+		if (fd == -1)
+			goto publish;
+		n = read(fd, buf, sizeof(buf));
+		close(fd);
+		prof_io(2, n);
+		if ((n <= 0) || parse_ps_stat_ppid(buf, n, &ppid))
+			goto publish;
+	}
+	ps->ppid = ppid;
+
+	/*
+	 * setup child pointers
+	 *
+	 * these are used to paint the tree coherently later
+	 * each parent has a LL of children, and a LL of siblings
+	 */
+	if (pid == 1)
+		goto publish; /* nothing to do for init atm */
+
+	/* kthreadd has ppid=0, which breaks our tree ordering */
+	if (ps->ppid == 0)
+		ps->ppid = 1;
+
+	parent = ps_hash_find(ps->ppid);
+
+	if (!parent) {
+		/* orphan */
+		ps->ppid = 1;
+		parent = ps_first->next_ps;
+		if (!parent)
+			goto publish; /* there's nothing to hang it below yet */
 	}
 
-	/* all the per-process stuff goes here */
-	if (!proc) {
-		/* find all processes */
-		proc = opendir("/proc");
-		if (!proc)
-			return;
+	ps->parent = parent;
+
+	/* a fork we saw before it could exec - inherit the parent name */
+	if (!ps->name[0])
+		strncpy(ps->name, parent->name, 16);
+
+	if (!parent->children) {
+		/* it's the first child */
+		parent->children = ps;
 	} else {
-		rewinddir(proc);
+		/* append to the end of the siblings */
+		parent->last_child->next = ps;
 	}
+	parent->last_child = ps;
 
-	while ((ent = readdir(proc)) != NULL) {
-		char filename[PATH_MAX];
-		int pid;
-		struct ps_struct *ps;
+publish:
+	/* the PSS thread walks this list, only publish complete records */
+	__atomic_store_n(&ps_last->next_ps, ps, __ATOMIC_RELEASE);
+	ps_last = ps;
+	ps_hash_insert(ps);
+	shard_add(ps);
 
-		if ((ent->d_name[0] < '0') || (ent->d_name[0] > '9'))
-			continue;
+	return ps;
+}
 
-		pid = atoi(ent->d_name);
 
-		if (pid >= MAXPIDS)
-			continue;
+static void ps_close(struct ps_struct *ps)
+{
+	fdcache_close(&ps->schedstat);
+	fdcache_close(&ps->sched);
+	fdcache_close(&ps->iostat);
+	/* smaps belongs to the PSS thread */
+}
 
-		ps = ps_first;
-		while (ps->next_ps) {
-			ps = ps->next_ps;
-			if (ps->pid == pid)
-				break;
-		}
 
-		/* end of our LL? then append a new record */
-		if (ps->pid != pid) {
-			char t[32];
-			struct ps_struct *parent;
+/*
+ * Adaptive cadence. Once a process' runtime hasn't moved for `adaptive`
+ * probes, the gap to its next probe doubles on every idle probe, up to
+ * half a second. The first probe that sees it run puts it back on every
+ * sample. Called before the new value is stored.
+ */
+static void ps_cadence(struct ps_struct *ps, int sample, double runtime)
+{
+	int step;
+	int max;
 
-			ps->next_ps = malloc(sizeof(struct ps_struct));
-			if (!ps->next_ps) {
-				perror("malloc(ps_struct)");
-				exit (EXIT_FAILURE);
-			}
-			memset(ps->next_ps, 0, sizeof(struct ps_struct));
-			ps = ps->next_ps;
-			ps->pid = pid;
+	if (!adaptive)
+		return;
 
-			ps->sample = malloc(sizeof(struct ps_sched_struct) * (len + 1));
-			if (!ps->sample) {
-				perror("malloc(ps_struct)");
-				exit (EXIT_FAILURE);
-			}
-			memset(ps->sample, 0, sizeof(struct ps_sched_struct) * (len + 1));
+	__atomic_add_fetch(&probes, 1, __ATOMIC_RELAXED);
+	ps->probed = sample;
 
-			pscount++;
+	if (!ps->store.tail || (runtime != ps->store.runtime)) {
+		ps->idle = 0;
+		ps->next_probe = sample + 1;
+		return;
+	}
 
-			/* mark our first sample */
-			ps->first = sample;
+	ps->idle++;
+	if (ps->idle < adaptive) {
+		ps->next_probe = sample + 1;
+		return;
+	}
 
-			/* get name, start time */
-			if (!ps->sched) {
-				sprintf(filename, "/proc/%d/sched", pid);
-				ps->sched = open(filename, O_RDONLY);
-				if (ps->sched == -1)
-					continue;
-			}
+	max = (hz < 4.0) ? 2 : (int)(hz / 2.0);
+	step = (ps->idle - adaptive < 16) ? 2 << (ps->idle - adaptive) : max;
+	ps->next_probe = sample + ((step < max) ? step : max);
+}
 
-			s = pread(ps->sched, buf, sizeof(buf) - 1, 0);
-			if (s <= 0) {
-				close(ps->sched);
-				continue;
-			}
 
-			if (!sscanf(buf, "%s %*s %*s", key))
-				continue;
+/*
+ * Samples between probes are recorded as unchanged, so the store looks
+ * just like full rate sampling of a process that didn't run.
+ */
+static int ps_skip(struct ps_struct *ps, int sample)
+{
+	if (!adaptive || (sample >= ps->next_probe) || !ps->store.tail)
+		return 0;
 
-			strncpy(ps->name, key, 16);
-			/* discard line 2 */
-			m = bufgetline(buf);
-			if (!m)
-				continue;
+	__atomic_add_fetch(&probes_skipped, 1, __ATOMIC_RELAXED);
+	ps->last = sample;
+	ps_store_append(ps, sample, ps->store.runtime, ps->store.waittime);
 
-			m = bufgetline(m);
-			if (!m)
-				continue;
+	return 1;
+}
 
-			if (!sscanf(m, "%*s %*s %s", t))
-				continue;
 
-			ps->starttime = strtod(t, NULL) / 1000.0;
+/* a probe found the process gone, it was last seen at the previous one */
+static void ps_exited(struct ps_struct *ps)
+{
+	if (adaptive && ps->probed && (ps->probed < ps->last))
+		ps->last = ps->probed;
 
-			/* ppid */
-			sprintf(filename, "/proc/%d/stat", pid);
-			stat = fopen(filename, "r");
-			if (!stat)
-				continue;
-			if (!fscanf(stat, "%*s %*s %*s %i", &p)) {
-				fclose(stat);
-				continue;
-			}
-			fclose(stat);
-			ps->ppid = p;
-
-			/*
-			 * setup child pointers
-			 *
-			 * these are used to paint the tree coherently later
-			 * each parent has a LL of children, and a LL of siblings
-			 */
-			if (pid == 1)
-				continue; /* nothing to do for init atm */
-
-			/* kthreadd has ppid=0, which breaks our tree ordering */
-			if (ps->ppid == 0)
-				ps->ppid = 1;
-
-			parent = ps_first;
-			while ((parent->next_ps && parent->pid != ps->ppid))
-				parent = parent->next_ps;
-
-			if ((!parent) || (parent->pid != ps->ppid)) {
-				/* orphan */
-				ps->ppid = 1;
-				parent = ps_first->next_ps;
-			}
+	ps->exittime = gettime_ns();
+}
 
-			ps->parent = parent;
-
-			if (!parent->children) {
-				/* it's the first child */
-				parent->children = ps;
-			} else {
-				/* walk all children and append */
-				struct ps_struct *children;
-				children = parent->children;
-				while (children->next)
-					children = children->next;
-				children->next = ps;
-			}
-		}
 
-		/* else -> found pid, append data in ps */
+/* returns -1 if this isn't the process we know anymore */
+static int ps_parse_schedstat(struct ps_struct *ps, int sample, const char *buf, size_t n)
+{
+	double rt;
+	double wt;
 
-		/* below here is all continuous logging parts - we get here on every
-		 * iteration */
+	if (parse_ps_schedstat(buf, n, &rt, &wt))
+		return 0;
 
-		/* rt, wt */
-		if (!ps->schedstat) {
-			sprintf(filename, "/proc/%d/schedstat", pid);
-			ps->schedstat = open(filename, O_RDONLY);
-			if (ps->schedstat == -1)
-				continue;
+	/* runtime never goes back, unless a reopened handle hit a reused pid */
+	if (ps->store.tail && (rt < ps->store.runtime))
+		return -1;
+
+	ps_cadence(ps, sample, rt);
+	ps->last = sample;
+	ps_store_append(ps, sample, rt, wt);
+
+	ps->total = (ps->store.runtime - ps->store.head->runtime) / 1000000000.0;
+
+	return 0;
+}
+
+
+/* catch process rename, try to randomize time */
+static int ps_rename_due(struct ps_struct *ps)
+{
+	int mod;
+
+	mod = (hz < 4.0) ? 4.0 : (hz / 4.0);
+
+	return (((samples - ps->first) + ps->pid) % (int)(mod) == 0);
+}
+
+
+/*
+ * Cgroups mode: the "some" stall time of a cgroup from its
+ * <resource>.pressure, in nsec like the taskstats delays. These only
+ * change slowly, so they're read now and then and not kept open.
+ */
+static void cg_pressure(struct ps_struct *ps, const char *file, double *total)
+{
+	char filename[PATH_MAX];
+	char buf[256];
+	double some;
+	double full;
+	ssize_t n;
+	int fd;
+
+	path_printf(filename, sizeof(filename), "%s%s/%s",
+		    cgroup_root, ps->cgroup, file);
+	fd = open(filename, O_RDONLY);
+	prof_io(1, 0);
+	if (fd == -1)
+		return;
+	n = read(fd, buf, sizeof(buf));
+	close(fd);
+	prof_io(2, n);
+
+	if ((n > 0) && !parse_pressure(buf, n, &some, &full))
+		*total = some * 1000.0;
+}
+
+
+/*
+ * Take one sample of a cgroup: cpu.stat goes where schedstat would,
+ * with usage as the runtime and throttled time as the wait time.
+ * io.stat and memory.current need their controllers enabled in the
+ * parent, without them the totals stay 0. Returns -1 if it's gone.
+ */
+static int cg_sample(struct ps_struct *ps, int sample)
+{
+	char buf[16384];
+	double usage;
+	double throttled;
+	ssize_t n;
+	int fd;
+
+	fd = fdcache_open(ps, &ps->schedstat, "cpu.stat");
+	if (fd <= 0)
+		return fd;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	prof_io(1, n);
+	if ((n <= 0) || parse_cgroup_cpu(buf, n, &usage, &throttled)) {
+		ps_close(ps);
+		return -1;
+	}
+	fdcache_release(ps, &ps->schedstat);
+
+	ps_cadence(ps, sample, usage * 1000.0);
+	ps->last = sample;
+	ps_store_append(ps, sample, usage * 1000.0, throttled * 1000.0);
+	ps->total = (ps->store.runtime - ps->store.head->runtime) / 1000000000.0;
+
+	fd = fdcache_open(ps, &ps->iostat, "io.stat");
+	if (fd > 0) {
+		n = pread(fd, buf, sizeof(buf) - 1, 0);
+		prof_io(1, n);
+		if (n >= 0)
+			parse_cgroup_io(buf, n, &ps->rbytes, &ps->wbytes);
+		fdcache_release(ps, &ps->iostat);
+	}
+
+	fd = fdcache_open(ps, &ps->sched, "memory.current");
+	if (fd > 0) {
+		n = pread(fd, buf, sizeof(buf) - 1, 0);
+		prof_io(1, n);
+		if (n > 0) {
+			int kb;
+
+			buf[n] = '\0';
+			kb = strtoull(buf, NULL, 10) / 1024;
+			if (kb > ps->pss_max)
+				ps->pss_max = kb;
+			/* the PSS graph stacks these, parents hold their children */
+			if (pss && !ps->children &&
+			    !(sample % (int)((hz > pss_hz) ? hz / pss_hz : 1)))
+				ps_store_pss(ps, sample, kb);
 		}
+		fdcache_release(ps, &ps->sched);
+	}
 
-		if (pread(ps->schedstat, buf, sizeof(buf) - 1, 0) <= 0) {
-			/* clean up our file descriptors - assume that the process exited */
-			close(ps->schedstat);
-			if (ps->sched)
-				close(ps->sched);
-			//if (ps->smaps)
-			//	fclose(ps->smaps);
-			continue;
+	if (ps_rename_due(ps)) {
+		prof_phase(PROF_RENAME);
+		cg_pressure(ps, "io.pressure", &ps->blkio);
+		cg_pressure(ps, "memory.pressure", &ps->swapin);
+		prof_phase(PROF_PS);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Take one sample of a known process. Returns -1 if the process is gone.
+ */
+static int ps_sample(struct ps_struct *ps, int sample)
+{
+	char buf[4096];
+	ssize_t n;
+	int fd;
+
+	if (ps->cgroup)
+		return cg_sample(ps, sample);
+
+	if (ts_state == 1) {
+		struct ps_taskstats_struct ts;
+
+		if (taskstats_get(ps->pid, &ts)) {
+			ps_close(ps);
+			return -1;
 		}
-		if (!sscanf(buf, "%s %s %*s", rt, wt))
-			continue;
 
+		ps_cadence(ps, sample, ts.runtime);
 		ps->last = sample;
-		ps->sample[sample].runtime = atoll(rt);
-		ps->sample[sample].waittime = atoll(wt);
+		ps_store_append(ps, sample, ts.runtime, ts.waittime);
+		ps->blkio = ts.blkio;
+		ps->swapin = ts.swapin;
+		ps->total = (ps->store.runtime - ps->store.head->runtime) / 1000000000.0;
+		goto catch_rename;
+	}
 
-		ps->total = (ps->sample[ps->last].runtime
-				 - ps->sample[ps->first].runtime)
-				 / 1000000000.0;
+	/* rt, wt, try again next sample if we're out of fds */
+	fd = fdcache_open(ps, &ps->schedstat, "schedstat");
+	if (fd <= 0)
+		return fd;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	prof_io(1, n);
+	if ((n <= 0) || ps_parse_schedstat(ps, sample, buf, n)) {
+		/* clean up our file descriptors - assume that the process exited */
+		ps_close(ps);
+		return -1;
+	}
+	fdcache_release(ps, &ps->schedstat);
 
-		if (!pss)
-			goto catch_rename;
-		/* Pss */
-		if (!ps->smaps) {
-			sprintf(filename, "/proc/%d/smaps", pid);
-			ps->smaps = fopen(filename, "r");
-			setvbuf(ps->smaps, smaps_buf, _IOFBF, sizeof(smaps_buf));
-			if (!ps->smaps)
-				continue;
-		} else {
-			rewind(ps->smaps);
+catch_rename:
+	if (ps_rename_due(ps)) {
+		/* re-fetch name */
+		prof_phase(PROF_RENAME);
+		if (ps_read_sched(ps, 0)) {
+			/* clean up file descriptors */
+			ps_close(ps);
+			prof_phase(PROF_PS);
+			return -1;
 		}
+		prof_phase(PROF_PS);
+	}
 
-		while (1) {
-			int p;
+	return 0;
+}
 
-			/* skip one line, this contains the object mapped */
-			if (fgets(buf, sizeof(buf), ps->smaps) == NULL)
-				break;
-			/* then there's a 28 char 14 line block */
-			if (fread(buf, 1, 28 * 14, ps->smaps) != 28 * 14)
-				break;
 
-			p = atoi(&buf[61]);
-			ps->sample[sample].pss += p;
-		}
+static long long thread_cpu_ns(void)
+{
+	struct timespec now;
 
-		if (ps->sample[sample].pss > ps->pss_max)
-			ps->pss_max = ps->sample[sample].pss;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
 
-catch_rename:
-		/* catch process rename, try to randomize time */
-		mod = (hz < 4.0) ? 4.0 : (hz / 4.0);
-		if (((samples - ps->first) + pid) % (int)(mod) == 0) {
-
-			/* re-fetch name */
-			/* get name, start time */
-			if (!ps->sched) {
-				sprintf(filename, "/proc/%d/sched", pid);
-				ps->sched = open(filename, O_RDONLY);
-				if (ps->sched == -1)
-					continue;
-			}
-			if (pread(ps->sched, buf, sizeof(buf) - 1, 0) <= 0) {
-				/* clean up file descriptors */
-				close(ps->sched);
-				if (ps->schedstat)
-					close(ps->schedstat);
-				//if (ps->smaps)
-				//	fclose(ps->smaps);
-				continue;
-			}
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
-			if (!sscanf(buf, "%s %*s %*s", key))
-				continue;
 
-			strncpy(ps->name, key, 16);
-		}
-	}
+static int ps_probe(struct ps_struct *ps, int sample)
+{
+	long long start;
+	int ret;
+
+	if (!adaptive || (__atomic_add_fetch(&probe_seq, 1, __ATOMIC_RELAXED) % PROBE_TIMING))
+		return ps_sample(ps, sample);
+
+	start = thread_cpu_ns();
+	ret = ps_sample(ps, sample);
+	__atomic_add_fetch(&probe_ns, thread_cpu_ns() - start, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&probes_timed, 1, __ATOMIC_RELAXED);
+
+	return ret;
+}
+
+
+/* estimated collector CPU time that skipped probes would have cost */
+double probes_saved(void)
+{
+	if (!probes_timed)
+		return 0.0;
+
+	return (double)probe_ns / probes_timed * probes_skipped / 1000000000.0;
+}
+
+
+static void pss_close(struct ps_struct *ps)
+{
+	if (!ps->smaps)
+		return;
+
+	fclose(ps->smaps);
+	ps->smaps = NULL;
+	fdcache_count(-1);
 }
 
+
+/*
+ * Find the Pss: total of a process. smaps_rollup already has the sum,
+ * on older kernels we add up the Pss: lines of every mapping in smaps.
+ * Returns -1 if the process is gone.
+ */
+static int pss_read(struct ps_struct *ps, int sample)
+{
+	char filename[PATH_MAX];
+	char buf[256];
+	long long bytes = 0;
+	int p = 0;
+
+	if (!ps->smaps) {
+		path_printf(filename, sizeof(filename), "%s/proc/%d/smaps_rollup",
+			    root_path, ps->pid);
+		ps->smaps = fopen(filename, "r");
+		prof_io(1, 0);
+		if (!ps->smaps) {
+			path_printf(filename, sizeof(filename), "%s/proc/%d/smaps",
+				    root_path, ps->pid);
+			ps->smaps = fopen(filename, "r");
+			prof_io(1, 0);
+			if (!ps->smaps)
+				return -1;
+			setvbuf(ps->smaps, smaps_buf, _IOFBF, sizeof(smaps_buf));
+		}
+		fdcache_count(1);
+	} else {
+		rewind(ps->smaps);
+	}
+
+	while (fgets(buf, sizeof(buf), ps->smaps) != NULL) {
+		bytes += strlen(buf);
+		/* "Pss:   1234 kB", but not Pss_Anon: or SwapPss: */
+		if (strncmp(buf, "Pss:", 4))
+			continue;
+		p += atoi(&buf[4]);
+	}
+	/* stdio reads a buffer at a time, and once more to see the end */
+	prof_io(bytes / sizeof(smaps_buf) + 2, bytes);
+
+	if (ferror(ps->smaps)) {
+		pss_close(ps);
+		return -1;
+	}
+
+	ps_store_pss(ps, sample, p);
+	if (p > ps->pss_max)
+		ps->pss_max = p;
+
+	/* smaps counts against the fd budget too */
+	if (fdcache_full())
+		pss_close(ps);
+
+	return 0;
+}
+
+
+/*
+ * PSS is far too expensive to collect on every sample, so a separate
+ * thread collects it at pss_hz, tagging each pass with the sample it
+ * started in. The renderer interpolates in between.
+ *
+ * A pass holds pss_lock, so records can be evicted from the process
+ * list (ring mode) and the process can fork with a consistent list.
+ */
+static pthread_t pss_thread;
+static pthread_mutex_t pss_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pss_running;
+static int pss_exiting;
+static int pss_sample;
+
+static void *pss_worker(void *arg)
+{
+	double period = 1.0 / pss_hz;
+	sigset_t set;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	stream_thread(threads);
+
+	while (!__atomic_load_n(&pss_exiting, __ATOMIC_ACQUIRE)) {
+		struct ps_struct *ps;
+		struct timespec req;
+		double start;
+		double left;
+		int sample;
+
+		start = gettime_ns();
+		sample = __atomic_load_n(&pss_sample, __ATOMIC_ACQUIRE);
+		if (!ring && (sample > len))
+			break;
+
+		pthread_mutex_lock(&pss_lock);
+		prof_phase(PROF_PSS);
+		ps = ps_first;
+		while ((ps = __atomic_load_n(&ps->next_ps, __ATOMIC_ACQUIRE))) {
+			if (ps->exittime) {
+				pss_close(ps);
+				continue;
+			}
+			/* threads share the memory of their process */
+			if (ps->tgid || (ps->first > sample))
+				continue;
+			if (pss_read(ps, sample))
+				pss_close(ps);
+		}
+		prof_phase(PROF_NONE);
+		pthread_mutex_unlock(&pss_lock);
+
+		left = period - (gettime_ns() - start);
+		if (left <= 0.0)
+			continue;
+		req.tv_sec = (time_t)left;
+		req.tv_nsec = (long)((left - req.tv_sec) * 1000000000.0);
+		nanosleep(&req, NULL);
+	}
+
+	return arg;
+}
+
+
+static void pss_fork_prepare(void)
+{
+	pthread_mutex_lock(&pss_lock);
+}
+
+
+static void pss_fork_done(void)
+{
+	pthread_mutex_unlock(&pss_lock);
+}
+
+
+static void pss_start(void)
+{
+	pthread_atfork(pss_fork_prepare, pss_fork_done, pss_fork_done);
+
+	if (pthread_create(&pss_thread, NULL, pss_worker, NULL)) {
+		perror("pthread_create(pss)");
+		exit (EXIT_FAILURE);
+	}
+	pss_running = 1;
+}
+
+
+void pss_stop(void)
+{
+	if (!pss_running)
+		return;
+
+	__atomic_store_n(&pss_exiting, 1, __ATOMIC_RELEASE);
+	pthread_join(pss_thread, NULL);
+	pss_running = 0;
+}
+
+
+/*
+ * Sharded collector. With threads > 1, every process is assigned to
+ * one of the shards when we first see it, and each shard only ever
+ * samples (and keeps the fds of) its own processes. The main thread is
+ * shard 0. Discovery stays single threaded, the shards only run between
+ * two barriers per sample, so every sample still has one sampletime[].
+ */
+struct shard_struct {
+	pthread_t thread;
+	struct ps_struct *first;
+	struct ps_struct *last;
+};
+
+static struct shard_struct *shards;
+static int shard_next;
+static int shard_sample;
+static int shard_exiting;
+static pthread_barrier_t shard_start;
+static pthread_barrier_t shard_done;
+
+
+static void shard_add(struct ps_struct *ps)
+{
+	struct shard_struct *sh;
+
+	if (!shards)
+		return;
+
+	sh = &shards[shard_next];
+	shard_next = (shard_next + 1) % threads;
+
+	if (sh->last)
+		sh->last->next_shard = ps;
+	else
+		sh->first = ps;
+	sh->last = ps;
+}
+
+
+static void shard_sample_all(struct shard_struct *sh, int sample)
+{
+	struct ps_struct *ps;
+
+	prof_phase(PROF_PS);
+	for (ps = sh->first; ps; ps = ps->next_shard) {
+		if (ps->exittime || ps_skip(ps, sample))
+			continue;
+		if (ps_probe(ps, sample))
+			ps_exited(ps);
+	}
+	prof_phase(PROF_NONE);
+}
+
+
+static void *shard_worker(void *arg)
+{
+	struct shard_struct *sh = arg;
+	sigset_t set;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	stream_thread(sh - shards);
+
+	while (1) {
+		pthread_barrier_wait(&shard_start);
+		if (shard_exiting)
+			break;
+		shard_sample_all(sh, shard_sample);
+		pthread_barrier_wait(&shard_done);
+	}
+
+	taskstats_close_thread();
+
+	return NULL;
+}
+
+
+static void shards_start(void)
+{
+	int i;
+
+	shards = calloc(threads, sizeof(struct shard_struct));
+	if (!shards) {
+		perror("calloc(shards)");
+		exit (EXIT_FAILURE);
+	}
+
+	pthread_barrier_init(&shard_start, NULL, threads);
+	pthread_barrier_init(&shard_done, NULL, threads);
+
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&shards[i].thread, NULL, shard_worker, &shards[i])) {
+			perror("pthread_create(shard)");
+			exit (EXIT_FAILURE);
+		}
+	}
+}
+
+
+static void shards_run(int sample)
+{
+	shard_sample = sample;
+	pthread_barrier_wait(&shard_start);
+	shard_sample_all(&shards[0], sample);
+	pthread_barrier_wait(&shard_done);
+}
+
+
+void shards_stop(void)
+{
+	int i;
+
+	if (!shards)
+		return;
+
+	shard_exiting = 1;
+	pthread_barrier_wait(&shard_start);
+	for (i = 1; i < threads; i++)
+		pthread_join(shards[i].thread, NULL);
+
+	pthread_barrier_destroy(&shard_start);
+	pthread_barrier_destroy(&shard_done);
+	free(shards);
+	shards = NULL;
+}
+
+
+/*
+ * Ring mode: a process that has no samples left at or after base is
+ * of no use to any chart we can still draw. Streaming, everything is
+ * on its way to the log, so we're done with a process once it exited,
+ * or a /proc scan hasn't found it for a second.
+ */
+static int ps_evictable(struct ps_struct *ps, int base)
+{
+	if (stream)
+		return (ps->exittime && (ps->last < base)) ||
+		       ((ps->pid != 1) && (ps->last < base - (int)hz));
+
+	return (ps->pid != 1) && (ps->last < base);
+}
+
+
+/* take ps out of the process tree, its children move up to its parent */
+static void ps_unlink_tree(struct ps_struct *ps)
+{
+	struct ps_struct *parent = ps->parent;
+	struct ps_struct *prev = NULL;
+	struct ps_struct *c;
+
+	for (c = ps->children; c; c = c->next)
+		c->parent = parent ? parent : ps_first->next_ps;
+
+	if (!parent) {
+		/* never hooked up, orphan the children to init */
+		parent = ps_first->next_ps;
+		if (!ps->children)
+			return;
+		if (parent->children)
+			parent->last_child->next = ps->children;
+		else
+			parent->children = ps->children;
+		parent->last_child = ps->last_child;
+		return;
+	}
+
+	for (c = parent->children; c && c != ps; c = c->next)
+		prev = c;
+	if (!c)
+		return;
+
+	if (ps->children) {
+		ps->last_child->next = ps->next;
+		c = ps->children;
+	} else {
+		c = ps->next;
+	}
+
+	if (prev)
+		prev->next = c;
+	else
+		parent->children = c;
+
+	if (parent->last_child == ps)
+		parent->last_child = ps->children ? ps->last_child : prev;
+}
+
+
+/*
+ * Drop every process that has rolled out of the ring, or exited while
+ * streaming, so memory use stays flat no matter how long we record.
+ */
+void log_evict(int base)
+{
+	struct ps_struct *ps;
+	struct ps_struct *prev;
+	int i;
+
+	if (pss_running)
+		pthread_mutex_lock(&pss_lock);
+
+	for (i = 0; shards && i < threads; i++) {
+		struct shard_struct *sh = &shards[i];
+
+		prev = NULL;
+		for (ps = sh->first; ps; ps = ps->next_shard) {
+			if (!ps_evictable(ps, base)) {
+				prev = ps;
+				continue;
+			}
+			if (prev)
+				prev->next_shard = ps->next_shard;
+			else
+				sh->first = ps->next_shard;
+			if (sh->last == ps)
+				sh->last = prev;
+		}
+	}
+
+	prev = ps_first;
+	while ((ps = prev->next_ps)) {
+		if (!ps_evictable(ps, base)) {
+			prev = ps;
+			continue;
+		}
+
+		prev->next_ps = ps->next_ps;
+		if (ps_last == ps)
+			ps_last = prev;
+		ps_hash_remove(ps);
+		ps_unlink_tree(ps);
+
+		stream_ps_info(ps);
+		ps_close(ps);
+		pss_close(ps);
+		fdcache_forget(ps);
+		ps_store_free(ps);
+		free(ps->cgroup);
+		pool_free(&ps_pool, ps);
+		pscount--;
+	}
+
+	/* and what live processes have from before the window */
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps)
+		ps_store_trim(ps, base);
+
+	if (pss_running)
+		pthread_mutex_unlock(&pss_lock);
+}
+
+
+/*
+ * Ring mode: renumber the samples of every process so sample base
+ * becomes 0, to go with store_rewind().
+ */
+void log_rewind(int base, int n)
+{
+	struct ps_struct *ps;
+
+	log_evict(base);
+
+	ps = ps_first;
+	while (ps->next_ps) {
+		ps = ps->next_ps;
+
+		/* clamp to the window, the sample in flight is not part of it */
+		if (ps->last > base + n - 1)
+			ps->last = base + n - 1;
+		if (ps->first < base)
+			ps->first = base;
+		if (ps->first > ps->last)
+			ps->first = ps->last;
+
+		ps_store_rebase(ps, base);
+		ps->first -= base;
+		ps->last -= base;
+		ps->total = (ps_runtime(ps, ps->last) - ps_runtime(ps, ps->first))
+			    / 1000000000.0;
+	}
+}
+
+
+/*
+ * Tasks mode: add the threads of ps we don't know yet. Every thread
+ * but the main one gets a record of its own, as a child of its
+ * process, and is sampled like a process through /proc/<tid>.
+ */
+static void ps_scan_tasks(struct ps_struct *ps, int sample)
+{
+	char filename[PATH_MAX];
+	struct dirent *ent;
+	DIR *d;
+
+	path_printf(filename, sizeof(filename), "%s/proc/%d/task",
+		    root_path, ps->pid);
+	d = opendir(filename);
+	if (!d)
+		return;
+
+	while ((ent = readdir(d)) != NULL) {
+		struct ps_struct *t;
+		int tid;
+
+		if ((ent->d_name[0] < '0') || (ent->d_name[0] > '9'))
+			continue;
+
+		tid = atoi(ent->d_name);
+		if (tid == ps->pid)
+			continue;
+
+		t = ps_hash_find(tid);
+		if (!t || t->exittime)
+			ps_new(tid, ps->pid, ps->pid, sample);
+	}
+
+	closedir(d);
+}
+
+
+/* look for new threads of new processes, and of the others now and then */
+static void log_tasks(int sample)
+{
+	struct ps_struct *ps;
+
+	for (ps = ps_first->next_ps; ps; ps = ps->next_ps) {
+		if (ps->tgid || ps->exittime)
+			continue;
+		if ((ps->first == sample) || ps_rename_due(ps))
+			ps_scan_tasks(ps, sample);
+	}
+}
+
+
+/*
+ * Cgroups mode: add the cgroups below path (relative to cgroup_root,
+ * "" for the root) we don't know yet, as children of the cgroup with
+ * id ppid. A cgroup's id is the inode of its directory, the root is 1
+ * so it sits where init would. A cgroup that's removed and made again
+ * has a new inode, and a new record.
+ */
+static void cg_scan(const char *path, int ppid, int sample)
+{
+	char filename[PATH_MAX];
+	struct dirent *ent;
+	DIR *d;
+
+	path_printf(filename, sizeof(filename), "%s%s", cgroup_root, path);
+	d = opendir(filename);
+	if (!d)
+		return;
+
+	while ((ent = readdir(d)) != NULL) {
+		struct ps_struct *ps;
+		char *sub;
+		int id;
+
+		if ((ent->d_type != DT_DIR) || (ent->d_name[0] == '.'))
+			continue;
+
+		/* room for the longest file name we read below it */
+		if (strlen(filename) + strlen(ent->d_name) + 32 > PATH_MAX)
+			continue;
+
+		id = (int)(ent->d_ino & 0x7fffffff);
+		ps = ps_hash_find(id);
+		if (!ps || ps->exittime) {
+			sub = malloc(strlen(path) + strlen(ent->d_name) + 2);
+			if (!sub) {
+				perror("malloc(cgroup)");
+				exit (EXIT_FAILURE);
+			}
+			sprintf(sub, "%s/%s", path, ent->d_name);
+
+			ps = ps_new(id, ppid, 0, sample);
+			ps->cgroup = sub;
+			snprintf(ps->name, sizeof(ps->name), "%s", ent->d_name);
+		}
+
+		cg_scan(ps->cgroup, id, sample);
+	}
+
+	closedir(d);
+}
+
+
+/* walk the whole hierarchy, a few times a second */
+static void log_cgroups(int sample)
+{
+	struct ps_struct *ps;
+	int mod;
+
+	mod = (hz < 4.0) ? 1 : (int)(hz / 4.0);
+	if (scanned && (sample % mod))
+		return;
+
+	ps = ps_hash_find(1);
+	if (!ps) {
+		ps = ps_new(1, 0, 0, sample);
+		ps->cgroup = strdup("");
+		if (!ps->cgroup) {
+			perror("strdup(cgroup)");
+			exit (EXIT_FAILURE);
+		}
+		strcpy(ps->name, "/");
+	}
+
+	cg_scan("", 1, sample);
+	scanned = 1;
+}
+
+
+/*
+ * Drain the proc connector and update our process list. Returns -1 if
+ * the kernel dropped events and we need to rescan /proc.
+ */
+static int log_events(int sample)
+{
+	struct ps_event_struct ev;
+	struct ps_struct *ps;
+	int lost = 0;
+
+	while (events_read(&ev)) {
+		switch (ev.what) {
+		case PS_EVENT_FORK:
+			ps = ps_hash_find(ev.pid);
+			if (ps && !ps->exittime)
+				break; /* already found by a /proc scan */
+			ps = ps_new(ev.pid, ev.ppid, 0, sample);
+			ps->starttime = ev.time;
+			break;
+		case PS_EVENT_EXEC:
+			ps = ps_hash_find(ev.pid);
+			if (ps && !ps->exittime)
+				ps_read_sched(ps, 0);
+			break;
+		case PS_EVENT_COMM:
+			ps = ps_hash_find(ev.pid);
+			if (ps && !ps->exittime)
+				strncpy(ps->name, ev.comm, 16);
+			break;
+		case PS_EVENT_EXIT:
+			ps = ps_hash_find(ev.pid);
+			if (ps && !ps->exittime) {
+				ps->exittime = ev.time;
+				ps_close(ps);
+			}
+			break;
+		case PS_EVENT_LOST:
+			lost = 1;
+			break;
+		}
+	}
+
+	return lost ? -1 : 0;
+}
+
+
+static void log_vmstat(const char *buf, size_t n, int sample)
+{
+	int bi;
+	int bo;
+
+	if (parse_vmstat(buf, n, &bi, &bo))
+		return;
+
+	series_set_int(&blockstat_bi, sample, bi);
+	series_set_int(&blockstat_bo, sample, bo);
+}
+
+
+static void log_cpu(int c, double runtime, double waittime, void *data)
+{
+	int sample = *(int *)data;
+
+	store_cpus(c);
+	series_set_double(&cpu_runtime[c], sample, runtime);
+	series_set_double(&cpu_waittime[c], sample, waittime);
+
+	if (c == cpus)
+		cpus = c + 1;
+}
+
+
+static void log_schedstat(const char *buf, size_t n, int sample)
+{
+	parse_schedstat(buf, n, log_cpu, &sample);
+}
+
+
+/* whole disks, not partitions, and nothing that only lives in memory */
+static int disk_whole(const char *name)
+{
+	char filename[PATH_MAX];
+	char *c;
+
+	if (!strncmp(name, "loop", 4) || !strncmp(name, "ram", 3) ||
+	    !strncmp(name, "zram", 4))
+		return 0;
+
+	/* sysfs spells "cciss/c0d0" as "cciss!c0d0" */
+	path_printf(filename, sizeof(filename), "%s/sys/block/", root_path);
+	c = filename + strlen(filename);
+	snprintf(c, sizeof(filename) - (c - filename), "%s", name);
+	for (; *c; c++)
+		if (*c == '/')
+			*c = '!';
+
+	return !access(filename, F_OK);
+}
+
+
+static int disk_find(const char *name, size_t l, int sample)
+{
+	struct disk_seen_struct *ds;
+	int i;
+
+	if (l > 15)
+		l = 15;
+
+	if ((disk_next < ndisk_seen) &&
+	    !strncmp(disk_seen[disk_next].name, name, l) && !disk_seen[disk_next].name[l])
+		return disk_seen[disk_next++].disk;
+
+	for (i = 0; i < ndisk_seen; i++)
+		if (!strncmp(disk_seen[i].name, name, l) && !disk_seen[i].name[l]) {
+			disk_next = i + 1;
+			return disk_seen[i].disk;
+		}
+
+	disk_seen = realloc(disk_seen, (ndisk_seen + 1) * sizeof(struct disk_seen_struct));
+	if (!disk_seen) {
+		perror("realloc(disk_seen)");
+		exit (EXIT_FAILURE);
+	}
+	ds = &disk_seen[ndisk_seen++];
+	memcpy(ds->name, name, l);
+	ds->name[l] = '\0';
+	ds->disk = -1;
+	disk_next = ndisk_seen;
+
+	if (disk_whole(ds->name)) {
+		struct disk_struct *d = store_disk(ndisks);
+
+		strcpy(d->name, ds->name);
+		d->first = sample;
+		ds->disk = ndisks - 1;
+		if (stream)
+			stream_disk_info(ds->disk);
+	}
+
+	return ds->disk;
+}
+
+
+static void log_disk(const char *name, size_t l, const unsigned long long *v, void *data)
+{
+	int sample = *(int *)data;
+	struct disk_struct *d;
+	int n = disk_find(name, l, sample);
+	int f;
+
+	if (n < 0)
+		return;
+
+	d = &disks[n];
+	for (f = 0; f < DISK_FIELDS; f++)
+		series_set_double(&d->s[f], sample, v[f]);
+}
+
+
+static void log_diskstats(const char *buf, size_t n, int sample)
+{
+	disk_next = 0;
+	parse_diskstats(buf, n, log_disk, &sample);
+}
+
+
+static const char *psi_file[3] = {
+	"cpu",
+	"io",
+	"memory"
+};
+
+
+/* r is the resource, the PSI_* fields of each are next to each other */
+static void log_psi(int r, const char *buf, size_t n, int sample)
+{
+	double some;
+	double full;
+
+	if (parse_pressure(buf, n, &some, &full))
+		return;
+
+	series_set_double(&psi_total[r * 2], sample, some);
+	series_set_double(&psi_total[r * 2 + 1], sample, full);
+}
+
+
+/* system wide numbers, read one by one. Returns -1 on failure */
+static int log_system(int sample)
+{
+	static char buf[SCHEDSTAT_SIZE];
+	ssize_t n;
+	int r;
+
+	n = pread(vmstat, buf, sizeof(buf) - 1, 0);
+	prof_io(1, n);
+	if (n <= 0) {
+		close(vmstat);
+		return -1;
+	}
+	buf[n] = '\0';
+	log_vmstat(buf, n, sample);
+
+	n = pread(schedstat, buf, sizeof(buf) - 1, 0);
+	prof_io(1, n);
+	if (n <= 0) {
+		close(schedstat);
+		return -1;
+	}
+	buf[n] = '\0';
+	log_schedstat(buf, n, sample);
+
+	if (entropy && e_fd) {
+		n = pread(e_fd, buf, sizeof(buf) - 1, 0);
+		prof_io(1, n);
+		if (n > 0)
+			series_set_int(&entropy_avail, sample, atoi(buf));
+	}
+
+	if (diskstats && (diskstats_fd > 0)) {
+		n = pread(diskstats_fd, buf, sizeof(buf) - 1, 0);
+		prof_io(1, n);
+		if (n > 0)
+			log_diskstats(buf, n, sample);
+	}
+
+	for (r = 0; psi && (r < 3); r++) {
+		if (psi_fd[r] <= 0)
+			continue;
+		n = pread(psi_fd[r], buf, sizeof(buf) - 1, 0);
+		prof_io(1, n);
+		if (n > 0)
+			log_psi(r, buf, n, sample);
+	}
+
+	return 0;
+}
+
+
+/*
+ * io_uring path: queue the system files and the schedstat (and sched,
+ * when a rename check is due) of every live process, read them all
+ * with one submit, then parse. Returns -1 if the ring failed us.
+ */
+#define UR_VMSTAT       1
+#define UR_SCHEDSTAT    2
+#define UR_ENTROPY      3
+#define UR_PS_SCHEDSTAT 4
+#define UR_PS_SCHED     5
+#define UR_DISKSTATS    6
+#define UR_PSI          7 /* + resource */
+
+static struct uring_read_struct *ur_reads;
+static int ur_reads_size;
+
+static void ur_queue(int *n, int what, int fd, int size, struct ps_struct *ps)
+{
+	if (*n == ur_reads_size) {
+		ur_reads_size = ur_reads_size ? ur_reads_size * 2 : 1024;
+		ur_reads = realloc(ur_reads, ur_reads_size * sizeof(struct uring_read_struct));
+		if (!ur_reads) {
+			perror("realloc(ur_reads)");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	ur_reads[*n].what = what;
+	ur_reads[*n].fd = fd;
+	ur_reads[*n].size = size;
+	ur_reads[*n].ps = ps;
+	(*n)++;
+}
+
+
+static int log_uring(int sample)
+{
+	struct ps_struct *ps;
+	int n = 0;
+	int fd;
+	int i;
+
+	ur_queue(&n, UR_VMSTAT, vmstat, 4096, NULL);
+	ur_queue(&n, UR_SCHEDSTAT, schedstat, SCHEDSTAT_SIZE, NULL);
+	if (entropy && (e_fd > 0))
+		ur_queue(&n, UR_ENTROPY, e_fd, 32, NULL);
+	if (diskstats && (diskstats_fd > 0))
+		ur_queue(&n, UR_DISKSTATS, diskstats_fd, SCHEDSTAT_SIZE, NULL);
+	for (i = 0; psi && (i < 3); i++)
+		if (psi_fd[i] > 0)
+			ur_queue(&n, UR_PSI + i, psi_fd[i], 256, NULL);
+
+	ps = ps_first;
+	while (ps->next_ps) {
+		ps = ps->next_ps;
+		if (ps->exittime || ps_skip(ps, sample))
+			continue;
+
+		fd = fdcache_open(ps, &ps->schedstat, "schedstat");
+		if (fd == 0)
+			continue;
+		if (fd < 0) {
+			ps_close(ps);
+			ps_exited(ps);
+			continue;
+		}
+		ur_queue(&n, UR_PS_SCHEDSTAT, ps->schedstat, 256, ps);
+
+		/* the name is all we want, it's on the first line */
+		if (ps_rename_due(ps) && (ps->sched > 0))
+			ur_queue(&n, UR_PS_SCHED, ps->sched, 256, ps);
+	}
+
+	if (uring_read(ur_reads, n))
+		return -1;
+
+	/*
+	 * A gone process reads as nothing, or ESRCH. Any other error is
+	 * the ring's, nothing is recorded then and pread() takes over.
+	 */
+	for (i = 0; i < n; i++) {
+		int res = ur_reads[i].res;
+
+		if ((res < 0) && (res != -ENOENT) && (res != -ESRCH))
+			return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct uring_read_struct *r = &ur_reads[i];
+
+		ps = r->ps;
+
+		if (r->res <= 0) {
+			if (ps && !ps->exittime) {
+				ps_close(ps);
+				ps_exited(ps);
+			}
+			continue;
+		}
+
+		switch (r->what) {
+		case UR_VMSTAT:
+			log_vmstat(r->buf, r->res, sample);
+			break;
+		case UR_SCHEDSTAT:
+			log_schedstat(r->buf, r->res, sample);
+			break;
+		case UR_ENTROPY:
+			series_set_int(&entropy_avail, sample, atoi(r->buf));
+			break;
+		case UR_DISKSTATS:
+			log_diskstats(r->buf, r->res, sample);
+			break;
+		case UR_PSI:
+		case UR_PSI + 1:
+		case UR_PSI + 2:
+			log_psi(r->what - UR_PSI, r->buf, r->res, sample);
+			break;
+		case UR_PS_SCHEDSTAT:
+			if (ps->exittime)
+				break;
+			if (ps_parse_schedstat(ps, sample, r->buf, r->res)) {
+				ps_close(ps);
+				ps_exited(ps);
+				break;
+			}
+			fdcache_release(ps, &ps->schedstat);
+			break;
+		case UR_PS_SCHED:
+			if (!ps->exittime)
+				ps_parse_sched(ps, r->buf, r->res, 0);
+			fdcache_release(ps, &ps->sched);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+void log_sample(int sample)
+{
+	char filename[PATH_MAX];
+	struct dirent *ent;
+	struct ps_struct *ps;
+
+	/* the last sample is done, make room for this one */
+	prof_phase(PROF_PS);
+	fdcache_trim();
+	prof_phase(PROF_SYSTEM);
+
+	if (cgroups && !cgroup_root[0]) {
+		/* the unified hierarchy, or next to the v1 ones of a hybrid setup */
+		path_printf(cgroup_root, sizeof(cgroup_root), "%s/sys/fs/cgroup",
+			    root_path);
+		path_printf(filename, sizeof(filename), "%s/cgroup.controllers",
+			    cgroup_root);
+		if (access(filename, F_OK)) {
+			strcat(cgroup_root, "/unified");
+			path_printf(filename, sizeof(filename), "%s/cgroup.controllers",
+				    cgroup_root);
+		}
+		if (access(filename, F_OK)) {
+			cgroup_root[0] = '\0';
+			fprintf(stderr, "bootchartd: no cgroup v2 hierarchy, sampling processes\n");
+			cgroups = 0;
+		}
+	}
+
+	if (!vmstat) {
+		/* block stuff */
+		path_printf(filename, sizeof(filename), "%s/proc/vmstat",
+			    root_path);
+		vmstat = open(filename, O_RDONLY);
+		if (vmstat == -1) {
+			perror("open /proc/vmstat");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	if (!schedstat) {
+		/* overall CPU utilization */
+		path_printf(filename, sizeof(filename), "%s/proc/schedstat",
+			    root_path);
+		schedstat = open(filename, O_RDONLY);
+		if (schedstat == -1) {
+			perror("open /proc/schedstat");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	if (entropy && !e_fd) {
+		path_printf(filename, sizeof(filename), "%s/proc/sys/kernel/random/entropy_avail",
+			    root_path);
+		e_fd = open(filename, O_RDONLY);
+	}
+
+	if (diskstats && !diskstats_fd) {
+		path_printf(filename, sizeof(filename), "%s/proc/diskstats",
+			    root_path);
+		diskstats_fd = open(filename, O_RDONLY);
+		if (diskstats_fd == -1)
+			fprintf(stderr, "bootchartd: /proc/diskstats unavailable, no disk graphs\n");
+	}
+
+	if (psi && !psi_fd[0]) {
+		int r;
+
+		/* without CONFIG_PSI, or with psi=0 on the cmdline, reads fail */
+		for (r = 0; r < 3; r++) {
+			char c;
+
+			path_printf(filename, sizeof(filename), "%s/proc/pressure/%s",
+				    root_path, psi_file[r]);
+			psi_fd[r] = open(filename, O_RDONLY);
+			if ((psi_fd[r] > 0) && (pread(psi_fd[r], &c, 1, 0) != 1)) {
+				close(psi_fd[r]);
+				psi_fd[r] = -1;
+			}
+		}
+		if ((psi_fd[0] < 0) && (psi_fd[1] < 0) && (psi_fd[2] < 0)) {
+			fprintf(stderr, "bootchartd: /proc/pressure unavailable, no pressure graph\n");
+			psi = 0;
+		}
+	}
+
+	if (uring && !ur_state) {
+		if ((threads > 1) || taskstats) {
+			fprintf(stderr, "bootchartd: io_uring is not used with threads or taskstats\n");
+			ur_state = -1;
+		} else if (uring_open()) {
+			fprintf(stderr, "bootchartd: io_uring unavailable, using pread()\n");
+			ur_state = -1;
+		} else {
+			ur_state = 1;
+		}
+	}
+
+	/* with io_uring these are read in the same batch as the processes */
+	if ((ur_state != 1) && log_system(sample))
+		return;
+
+	if ((threads > 1) && !shards)
+		shards_start();
+
+	/* start the PSS thread once we know the initial process set */
+	__atomic_store_n(&pss_sample, sample, __ATOMIC_RELEASE);
+	if (pss && !pss_running && scanned && !cgroups)
+		pss_start();
+
+	if (taskstats && !ts_state) {
+		if (taskstats_open()) {
+			fprintf(stderr, "bootchartd: taskstats unavailable, using /proc/<pid>/schedstat\n");
+			ts_state = -1;
+		} else {
+			ts_state = 1;
+		}
+	}
+
+	/*
+	 * taskstats hands us the final numbers of exited tasks, use them
+	 * to close off the last interval those processes were alive.
+	 */
+	if (ts_state == 1) {
+		struct ps_taskstats_struct ts;
+
+		while (taskstats_read_exit(&ts)) {
+			ps = ps_hash_find(ts.pid);
+			if (!ps || ps->last >= sample)
+				continue;
+			/* stale record for a reused pid */
+			if (!ps->store.head || (ts.runtime < ps->store.runtime))
+				continue;
+			ps->last = sample;
+			ps_store_append(ps, sample, ts.runtime, ts.waittime);
+			ps->blkio = ts.blkio;
+			ps->swapin = ts.swapin;
+			ps->total = (ps->store.runtime - ps->store.head->runtime) / 1000000000.0;
+		}
+	}
+
+	/*
+	 * With the proc connector, the kernel tells us about new and exited
+	 * processes, so after the initial /proc scan we only need to visit
+	 * the processes we already know about.
+	 */
+	if (events && !ev_state) {
+		if (events_open()) {
+			fprintf(stderr, "bootchartd: proc connector unavailable, scanning /proc instead\n");
+			ev_state = -1;
+		} else {
+			ev_state = 1;
+		}
+	}
+
+	prof_phase(PROF_SCAN);
+
+	/* cgroups take the place of processes */
+	if (cgroups) {
+		log_cgroups(sample);
+		goto sample_known;
+	}
+
+	if ((ev_state == 1) && scanned && (log_events(sample) == 0))
+		goto sample_known;
+	/* else we lost events, resync with a full scan */
+
+	/* all the per-process stuff goes here */
+	if (!proc) {
+		/* find all processes */
+		path_printf(filename, sizeof(filename), "%s/proc", root_path);
+		proc = opendir(filename);
+		if (!proc)
+			return;
+	} else {
+		rewinddir(proc);
+	}
+
+	/* orphans go below the first record: /proc lists init first, a --root tree needn't */
+	if (!ps_first->next_ps)
+		ps_new(1, -1, 0, sample);
+
+	while ((ent = readdir(proc)) != NULL) {
+		int pid;
+
+		if ((ent->d_name[0] < '0') || (ent->d_name[0] > '9'))
+			continue;
+
+		pid = atoi(ent->d_name);
+
+		ps = ps_hash_find(pid);
+
+		/* not seen before? then append a new record */
+		if (!ps || ps->exittime)
+			ps = ps_new(pid, -1, 0, sample);
+
+		/* the shards or the loop below will sample it */
+		if ((threads > 1) || (ev_state == 1) || (ur_state == 1) || tasks)
+			continue;
+
+		/* below here is all continuous logging parts - we get here on every
+		 * iteration */
+		prof_phase(PROF_PS);
+		if (!ps_skip(ps, sample) && ps_probe(ps, sample))
+			ps_exited(ps);
+		prof_phase(PROF_SCAN);
+	}
+
+	scanned = 1;
+
+	if ((threads == 1) && (ev_state != 1) && (ur_state != 1) && !tasks)
+		return;
+
+sample_known:
+	/* threads are found per process, then sampled with the rest */
+	if (tasks)
+		log_tasks(sample);
+
+	prof_phase(PROF_PS);
+
+	/* sample every process we believe is still alive */
+	if (threads > 1) {
+		shards_run(sample);
+		return;
+	}
+
+	if (ur_state == 1) {
+		if (log_uring(sample) == 0)
+			return;
+		fprintf(stderr, "bootchartd: io_uring failed, using pread()\n");
+		uring_close();
+		ur_state = -1;
+		prof_phase(PROF_SYSTEM);
+		if (log_system(sample))
+			return;
+		prof_phase(PROF_PS);
+	}
+
+	ps = ps_first;
+	while (ps->next_ps) {
+		ps = ps->next_ps;
+		if (ps->exittime || ps_skip(ps, sample))
+			continue;
+		if (ps_probe(ps, sample))
+			ps_exited(ps);
+	}
+}
@@ -0,0 +1,328 @@
+/*
+ * outbuf.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Buffered output, for the chart. Everything is formatted straight
+ * into one large buffer, which is written out when full, instead of a
+ * stdio write for every element. Without a file the buffer grows and
+ * keeps everything, for callers that want the output in memory.
+ *
+ * Formats made of only the conversions the chart uses, %d, %i, %s
+ * and %.<n>f, are formatted here. Any other format goes to vsnprintf()
+ * whole, and so does a double that's too close to halfway between two
+ * results to tell how printf would round it: the output is the same as
+ * printf's.
+ */
+
+static const double outbuf_pow10[7] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+
+
+void outbuf_init(struct outbuf_struct *ob, FILE *f)
+{
+	memset(ob, 0, sizeof(struct outbuf_struct));
+	ob->f = f;
+
+	/* we buffer, stdio doesn't need to copy it all again */
+	if (f)
+		setvbuf(f, NULL, _IONBF, 0);
+}
+
+
+/* write out what we have, a memory buffer keeps it. -1 on write errors */
+int outbuf_flush(struct outbuf_struct *ob)
+{
+	if (!ob->f)
+		return ob->err;
+
+	if (ob->used && (fwrite(ob->buf, ob->used, 1, ob->f) != 1))
+		ob->err = -1;
+	ob->flushed += ob->used;
+	ob->used = 0;
+
+	return ob->err;
+}
+
+
+/* make room for n more bytes */
+static void outbuf_reserve(struct outbuf_struct *ob, size_t n)
+{
+	size_t size;
+	char *buf;
+
+	if (ob->used + n <= ob->size)
+		return;
+
+	if (ob->f)
+		outbuf_flush(ob);
+	if (ob->used + n <= ob->size)
+		return;
+
+	size = ob->size ? ob->size : OUTBUF_SIZE;
+	while (size < ob->used + n)
+		size *= 2;
+
+	buf = realloc(ob->buf, size);
+	if (!buf) {
+		perror("realloc(outbuf)");
+		exit (EXIT_FAILURE);
+	}
+	ob->buf = buf;
+	ob->size = size;
+}
+
+
+void outbuf_write(struct outbuf_struct *ob, const char *s, size_t n)
+{
+	outbuf_reserve(ob, n);
+	memcpy(ob->buf + ob->used, s, n);
+	ob->used += n;
+}
+
+
+/* bytes written so far, flushed or not */
+long long outbuf_tell(const struct outbuf_struct *ob)
+{
+	return ob->flushed + ob->used;
+}
+
+
+static void outbuf_int(struct outbuf_struct *ob, long long v)
+{
+	char tmp[24];
+	char *p = tmp + sizeof(tmp);
+	unsigned long long u = (v < 0) ? -(unsigned long long)v : (unsigned long long)v;
+
+	do {
+		*--p = '0' + (u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0)
+		*--p = '-';
+
+	outbuf_write(ob, p, tmp + sizeof(tmp) - p);
+}
+
+
+/*
+ * v as %.<prec>f. Returns -1 if printf has to do it: v is out of range,
+ * or v * 10^prec is within the rounding error of the multiplication
+ * from a tie, which printf breaks on the exact binary value.
+ */
+static int outbuf_fixed(struct outbuf_struct *ob, double v, int prec)
+{
+	char tmp[32];
+	char *p = tmp + sizeof(tmp);
+	unsigned long long i;
+	double x;
+	double frac;
+	int d;
+
+	if ((prec > 6) || !isfinite(v))
+		return -1;
+
+	/* below 2^42 the product is off by less than 2^-12 */
+	x = fabs(v) * outbuf_pow10[prec];
+	if (x >= 4398046511104.0)
+		return -1;
+
+	i = (unsigned long long)x;
+	frac = x - (double)i;
+	if (fabs(frac - 0.5) < 0.001)
+		return -1;
+	if (frac > 0.5)
+		i++;
+
+	for (d = 0; d < prec; d++) {
+		*--p = '0' + (i % 10);
+		i /= 10;
+	}
+	if (prec)
+		*--p = '.';
+	do {
+		*--p = '0' + (i % 10);
+		i /= 10;
+	} while (i);
+	/* like printf, -0.0001 is "-0.000" */
+	if (signbit(v))
+		*--p = '-';
+
+	outbuf_write(ob, p, tmp + sizeof(tmp) - p);
+
+	return 0;
+}
+
+
+/* fmt through vsnprintf, straight into the buffer */
+static void outbuf_vformat(struct outbuf_struct *ob, const char *fmt, va_list ap)
+{
+	va_list aq;
+	size_t room;
+	int n;
+
+	outbuf_reserve(ob, 64);
+	room = ob->size - ob->used;
+
+	va_copy(aq, ap);
+	n = vsnprintf(ob->buf + ob->used, room, fmt, aq);
+	va_end(aq);
+	if ((n >= 0) && ((size_t)n >= room)) {
+		outbuf_reserve(ob, n + 1);
+		vsnprintf(ob->buf + ob->used, n + 1, fmt, ap);
+	}
+
+	if (n > 0)
+		ob->used += n;
+}
+
+
+static void outbuf_format(struct outbuf_struct *ob, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	outbuf_vformat(ob, fmt, ap);
+	va_end(ap);
+}
+
+
+/*
+ * Whether fmt only has conversions we do ourselves: %d, %i, %ld, %lld,
+ * %s, %f, %lf, %.<n>f and %%, without flags or width.
+ */
+static int outbuf_plain(const char *fmt)
+{
+	const char *p = fmt;
+	int l;
+
+	while ((p = strchr(p, '%'))) {
+		p++;
+		if (*p == '%') {
+			p++;
+			continue;
+		}
+		if (*p == '.') {
+			p++;
+			if (!isdigit((unsigned char)*p))
+				return 0;
+			while (isdigit((unsigned char)*p))
+				p++;
+			if (*p++ != 'f')
+				return 0;
+			continue;
+		}
+		for (l = 0; (*p == 'l') && (l < 2); p++)
+			l++;
+		if ((*p == 'd') || (*p == 'i') ||
+		    ((*p == 'f') && (l < 2)) || ((*p == 's') && !l)) {
+			p++;
+			continue;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void outbuf_vprintf(struct outbuf_struct *ob, const char *fmt, va_list ap)
+{
+	const char *p = fmt;
+
+	if (!outbuf_plain(fmt)) {
+		outbuf_vformat(ob, fmt, ap);
+		return;
+	}
+
+	while (*p) {
+		const char *s = p;
+		const char *str;
+		double v;
+		int prec = 6;
+		int l = 0;
+
+		/* text up to the next conversion */
+		while (*p && (*p != '%'))
+			p++;
+		if (p > s)
+			outbuf_write(ob, s, p - s);
+		if (!*p)
+			break;
+
+		p++;
+		if (*p == '.') {
+			p++;
+			prec = 0;
+			while (isdigit((unsigned char)*p))
+				prec = (prec * 10) + (*p++ - '0');
+		}
+		while (*p == 'l') {
+			l++;
+			p++;
+		}
+
+		switch (*p++) {
+		case '%':
+			outbuf_write(ob, "%", 1);
+			break;
+		case 'd':
+		case 'i':
+			if (l == 2)
+				outbuf_int(ob, va_arg(ap, long long));
+			else if (l)
+				outbuf_int(ob, va_arg(ap, long));
+			else
+				outbuf_int(ob, va_arg(ap, int));
+			break;
+		case 'f':
+			v = va_arg(ap, double);
+			if (outbuf_fixed(ob, v, prec))
+				outbuf_format(ob, "%.*f", prec, v);
+			break;
+		case 's':
+			str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+			outbuf_write(ob, str, strlen(str));
+			break;
+		}
+	}
+}
+
+
+void outbuf_printf(struct outbuf_struct *ob, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	outbuf_vprintf(ob, fmt, ap);
+	va_end(ap);
+}
+
+
+void outbuf_free(struct outbuf_struct *ob)
+{
+	free(ob->buf);
+	ob->buf = NULL;
+	ob->size = 0;
+	ob->used = 0;
+}
@@ -0,0 +1,417 @@
+/*
+ * parse.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Parsers for the /proc files we read on every sample. They make a
+ * single pass over the buffer, find line ends with memchr(), and build
+ * numbers digit by digit, without copying tokens anywhere. Every parser
+ * takes the buffer and its length, no '\0' is needed.
+ */
+
+static int is_space(char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\n');
+}
+
+
+/* start of the next line, or NULL */
+static const char *next_line(const char *p, const char *end)
+{
+	p = memchr(p, '\n', end - p);
+
+	return p ? p + 1 : NULL;
+}
+
+
+static const char *skip_space(const char *p, const char *end)
+{
+	while ((p < end) && is_space(*p) && (*p != '\n'))
+		p++;
+
+	return p;
+}
+
+
+/* skip n whitespace separated fields, stays on the current line */
+static const char *skip_fields(const char *p, const char *end, int n)
+{
+	while (n--) {
+		p = skip_space(p, end);
+		while ((p < end) && !is_space(*p))
+			p++;
+	}
+
+	return p;
+}
+
+
+/* unsigned decimal, NULL if there's no number */
+static const char *get_ull(const char *p, const char *end, unsigned long long *v)
+{
+	unsigned long long n = 0;
+	const char *s;
+
+	p = skip_space(p, end);
+	s = p;
+	while ((p < end) && (*p >= '0') && (*p <= '9'))
+		n = n * 10 + (*p++ - '0');
+
+	if (p == s)
+		return NULL;
+
+	*v = n;
+	return p;
+}
+
+
+/* "123.456" style fixed point numbers, no exponents */
+static const char *get_fixed(const char *p, const char *end, double *v)
+{
+	unsigned long long i;
+	double frac = 0.0;
+	double scale = 0.1;
+	int neg = 0;
+
+	p = skip_space(p, end);
+	if ((p < end) && (*p == '-')) {
+		neg = 1;
+		p++;
+	}
+
+	p = get_ull(p, end, &i);
+	if (!p)
+		return NULL;
+
+	if ((p < end) && (*p == '.')) {
+		p++;
+		while ((p < end) && (*p >= '0') && (*p <= '9')) {
+			frac += (*p++ - '0') * scale;
+			scale /= 10.0;
+		}
+	}
+
+	*v = neg ? -(i + frac) : (i + frac);
+	return p;
+}
+
+
+/* does the line at p start with key, followed by whitespace? */
+static int line_key(const char *p, const char *end, const char *key, size_t keylen)
+{
+	return ((size_t)(end - p) > keylen) && !memcmp(p, key, keylen)
+		&& is_space(p[keylen]);
+}
+
+
+/* /proc/vmstat: pgpgin and pgpgout */
+int parse_vmstat(const char *buf, size_t n, int *bi, int *bo)
+{
+	const char *end = buf + n;
+	const char *p = buf;
+	unsigned long long v;
+	int found = 0;
+
+	while (p && (p < end) && (found != 3)) {
+		if ((*p == 'p') && line_key(p, end, "pgpgin", 6)) {
+			if (get_ull(p + 6, end, &v)) {
+				*bi = v;
+				found |= 1;
+			}
+		} else if ((*p == 'p') && line_key(p, end, "pgpgout", 7)) {
+			if (get_ull(p + 7, end, &v)) {
+				*bo = v;
+				found |= 2;
+			}
+		}
+		p = next_line(p, end);
+	}
+
+	return (found == 3) ? 0 : -1;
+}
+
+
+/*
+ * /proc/schedstat: "cpu<N> f1 .. f9", where f7 is the time spent
+ * running and f8 the time spent waiting on the run queue. Calls fn for
+ * every cpu line, returns the number of cpu lines.
+ */
+int parse_schedstat(const char *buf, size_t n,
+		    void (*fn)(int cpu, double runtime, double waittime, void *data),
+		    void *data)
+{
+	const char *end = buf + n;
+	const char *p = buf;
+	int count = 0;
+
+	while (p && (p < end)) {
+		unsigned long long c;
+		unsigned long long rt;
+		unsigned long long wt;
+		const char *q;
+
+		if ((end - p > 3) && !memcmp(p, "cpu", 3) &&
+		    (q = get_ull(p + 3, end, &c)) &&
+		    (q = get_ull(skip_fields(q, end, 6), end, &rt)) &&
+		    (q = get_ull(q, end, &wt))) {
+			fn(c, rt, wt, data);
+			count++;
+		}
+		p = next_line(p, end);
+	}
+
+	return count;
+}
+
+
+/* /proc/<pid>/schedstat: "runtime waittime timeslices" */
+int parse_ps_schedstat(const char *buf, size_t n, double *runtime, double *waittime)
+{
+	const char *end = buf + n;
+	unsigned long long rt;
+	unsigned long long wt;
+	const char *p;
+
+	p = get_ull(buf, end, &rt);
+	if (!p || !get_ull(p, end, &wt))
+		return -1;
+
+	*runtime = rt;
+	*waittime = wt;
+	return 0;
+}
+
+
+/*
+ * /proc/<pid>/sched: the name is the first word of the first line. If
+ * starttime is not NULL, se.exec_start on the third line is stored there
+ * (in msec, like the kernel prints it).
+ */
+int parse_ps_sched(const char *buf, size_t n, char name[16], double *starttime)
+{
+	const char *end = buf + n;
+	const char *p = skip_space(buf, end);
+	const char *s = p;
+	size_t l;
+
+	while ((p < end) && !is_space(*p))
+		p++;
+	if (p == s)
+		return -1;
+
+	l = p - s;
+	if (l > 15)
+		l = 15;
+	memcpy(name, s, l);
+	name[l] = '\0';
+
+	if (!starttime)
+		return 0;
+
+	/* discard line 2 */
+	p = next_line(p, end);
+	if (p)
+		p = next_line(p, end);
+	if (!p)
+		return -1;
+
+	p = skip_fields(p, end, 2);
+	if (!get_fixed(p, end, starttime))
+		return -1;
+
+	return 0;
+}
+
+
+/*
+ * /proc/<pid>/stat: "pid (comm) state ppid ...". comm may contain
+ * spaces and parentheses, so look for the last ')'.
+ */
+int parse_ps_stat_ppid(const char *buf, size_t n, int *ppid)
+{
+	const char *end = buf + n;
+	const char *p = end;
+	unsigned long long v;
+
+	while ((p > buf) && (p[-1] != ')'))
+		p--;
+	if (p == buf)
+		return -1;
+
+	p = skip_fields(p, end, 1);
+	if (!get_ull(p, end, &v))
+		return -1;
+
+	*ppid = v;
+	return 0;
+}
+
+
+/*
+ * /proc/diskstats: "major minor name" and at least 11 counters. Calls
+ * fn with the name and the DISK_* fields of every device, returns the
+ * number of devices.
+ */
+int parse_diskstats(const char *buf, size_t n,
+		    void (*fn)(const char *name, size_t len, const unsigned long long *v, void *data),
+		    void *data)
+{
+	/* DISK_* field of each of the first 11 counters, -1 if unused */
+	static const int field[11] = {
+		DISK_RD_IOS, -1, DISK_RD_SECTORS, DISK_RD_TICKS,
+		DISK_WR_IOS, -1, DISK_WR_SECTORS, DISK_WR_TICKS,
+		DISK_IN_FLIGHT, DISK_IO_TICKS, DISK_QUEUE
+	};
+	const char *end = buf + n;
+	const char *p = buf;
+	int count = 0;
+
+	while (p && (p < end)) {
+		unsigned long long v[DISK_FIELDS];
+		unsigned long long u;
+		const char *name;
+		const char *q;
+		size_t l;
+		int i;
+
+		q = skip_fields(p, end, 2);
+		q = skip_space(q, end);
+		name = q;
+		while ((q < end) && !is_space(*q))
+			q++;
+		l = q - name;
+
+		for (i = 0; (i < 11) && (q = get_ull(q, end, &u)); i++)
+			if (field[i] >= 0)
+				v[field[i]] = u;
+
+		if ((i == 11) && l) {
+			fn(name, l, v, data);
+			count++;
+		}
+		p = next_line(p, end);
+	}
+
+	return count;
+}
+
+
+/*
+ * /proc/pressure/<resource>: the "total=" stall time in usec of the
+ * "some" and "full" lines. Kernels before 5.13 have no "full" line for
+ * cpu, it reads as 0 then.
+ */
+int parse_pressure(const char *buf, size_t n, double *some, double *full)
+{
+	const char *end = buf + n;
+	const char *p = buf;
+	int found = 0;
+
+	*full = 0.0;
+
+	/* "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" */
+	while (p && (p < end)) {
+		const char *t = skip_space(skip_fields(p, end, 4), end);
+		unsigned long long v;
+
+		if ((end - t > 6) && !memcmp(t, "total=", 6) && get_ull(t + 6, end, &v)) {
+			if (line_key(p, end, "some", 4)) {
+				*some = v;
+				found = 1;
+			} else if (line_key(p, end, "full", 4)) {
+				*full = v;
+			}
+		}
+		p = next_line(p, end);
+	}
+
+	return found ? 0 : -1;
+}
+
+
+/*
+ * cgroup v2 cpu.stat: "usage_usec" and, with the cpu controller on,
+ * "throttled_usec", which reads as 0 otherwise.
+ */
+int parse_cgroup_cpu(const char *buf, size_t n, double *usage, double *throttled)
+{
+	const char *end = buf + n;
+	const char *p = buf;
+	unsigned long long v;
+	int found = 0;
+
+	*throttled = 0.0;
+
+	while (p && (p < end)) {
+		if ((*p == 'u') && line_key(p, end, "usage_usec", 10)) {
+			if (get_ull(p + 10, end, &v)) {
+				*usage = v;
+				found = 1;
+			}
+		} else if ((*p == 't') && line_key(p, end, "throttled_usec", 14)) {
+			if (get_ull(p + 14, end, &v))
+				*throttled = v;
+		}
+		p = next_line(p, end);
+	}
+
+	return found ? 0 : -1;
+}
+
+
+/*
+ * cgroup v2 io.stat: "major:minor rbytes=N wbytes=N rios=N ..." for
+ * every device the cgroup did I/O on. Sums up the bytes of all of them.
+ */
+void parse_cgroup_io(const char *buf, size_t n, double *rbytes, double *wbytes)
+{
+	const char *end = buf + n;
+	const char *p = buf;
+
+	*rbytes = 0.0;
+	*wbytes = 0.0;
+
+	while (p && (p < end)) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *q = skip_fields(p, end, 1);
+
+		if (!eol)
+			eol = end;
+
+		while (q < eol) {
+			unsigned long long v;
+			const char *k = skip_space(q, eol);
+
+			q = k;
+			while ((q < eol) && !is_space(*q) && (*q != '='))
+				q++;
+			if ((q < eol) && (*q == '=') && get_ull(q + 1, eol, &v)) {
+				if ((q - k == 6) && !memcmp(k, "rbytes", 6))
+					*rbytes += v;
+				else if ((q - k == 6) && !memcmp(k, "wbytes", 6))
+					*wbytes += v;
+			}
+			while ((q < eol) && !is_space(*q))
+				q++;
+		}
+		p = next_line(p, end);
+	}
+}
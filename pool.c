@@ -0,0 +1,97 @@
+/*
+ * pool.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Fixed size object pools. Objects are handed out of large slabs in
+ * allocation order, so records created together sit together, and a
+ * fork storm costs one malloc() per slab instead of one per record.
+ * Released objects go to a free list, and all slabs are released at
+ * once when the pool is destroyed.
+ *
+ * Each slab starts with a pointer to the previous slab.
+ */
+#define POOL_HDR 16
+
+static size_t pool_objsize(struct pool_struct *p)
+{
+	return (p->size + 15) & ~15;
+}
+
+
+void *pool_alloc(struct pool_struct *p)
+{
+	size_t size = pool_objsize(p);
+	void *obj;
+
+	pthread_mutex_lock(&p->lock);
+
+	if (p->free) {
+		obj = p->free;
+		p->free = *(void **)obj;
+	} else {
+		if (!p->slab || (p->used + size > POOL_SLAB)) {
+			char *slab = malloc(POOL_SLAB);
+
+			if (!slab) {
+				perror("malloc(pool)");
+				exit (EXIT_FAILURE);
+			}
+			*(char **)slab = p->slab;
+			p->slab = slab;
+			p->used = POOL_HDR;
+		}
+		obj = p->slab + p->used;
+		p->used += size;
+	}
+
+	pthread_mutex_unlock(&p->lock);
+
+	memset(obj, 0, p->size);
+	return obj;
+}
+
+
+void pool_free(struct pool_struct *p, void *obj)
+{
+	if (!obj)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	*(void **)obj = p->free;
+	p->free = obj;
+	pthread_mutex_unlock(&p->lock);
+}
+
+
+/* release every object of the pool at once */
+void pool_destroy(struct pool_struct *p)
+{
+	while (p->slab) {
+		char *prev = *(char **)p->slab;
+
+		free(p->slab);
+		p->slab = prev;
+	}
+	p->used = 0;
+	p->free = NULL;
+}
@@ -0,0 +1,347 @@
+/*
+ * profile.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Collector self profiling (--profile). Every thread that samples says
+ * which phase of a tick it's in, and the time until it moves on to the
+ * next one is charged to that phase, together with the syscalls it
+ * made and the bytes it read. At the end of a tick the sums go into a
+ * table of the last len + 1 ticks, with the CPU time of the whole
+ * collector and its resident size, for p50/p99/max over the recording.
+ *
+ * Time is wall time per thread, added up over the threads: with
+ * threads > 1, PROF_PS can exceed the tick. The PSS thread runs on its
+ * own clock, its passes count towards the tick they end in.
+ *
+ * Drawing the chart is profiled too, with the time and bytes of each
+ * section of it, also when drawing a log with --render.
+ */
+int profile;
+
+static const char *prof_phase_name[PROF_PHASES] = {
+	"system", "scan", "ps", "rename", "pss", "stream"
+};
+
+/* what the threads charged to each phase this tick */
+static long long prof_ns[PROF_PHASES];
+static long long prof_calls[PROF_PHASES];
+static long long prof_bytes[PROF_PHASES];
+
+/* the phase this thread is in, and since when */
+static __thread int prof_cur = -1;
+static __thread long long prof_since;
+
+/* PROF_METRICS values per tick, a ring of prof_rows */
+static long long *prof_table;
+static int prof_rows;
+static int prof_ticks;
+static int prof_over;
+
+static long long prof_cpu;
+static int prof_statm;
+
+/* chart sections, in the order they were first drawn */
+#define PROF_SECTIONS 16
+static const char *prof_sec_name[PROF_SECTIONS];
+static long long prof_sec_ns[PROF_SECTIONS];
+static long long prof_sec_bytes[PROF_SECTIONS];
+static int prof_secs;
+static long long prof_sec_since;
+static long long prof_sec_offset;
+
+
+static long long prof_clock(clockid_t id)
+{
+	struct timespec now;
+
+	clock_gettime(id, &now);
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/* leave the current phase for phase, PROF_NONE to stop charging */
+void prof_phase(int phase)
+{
+	long long now;
+
+	if (!profile || (phase == prof_cur))
+		return;
+
+	now = prof_clock(CLOCK_MONOTONIC);
+	if (prof_cur >= 0)
+		__atomic_add_fetch(&prof_ns[prof_cur], now - prof_since, __ATOMIC_RELAXED);
+
+	prof_cur = phase;
+	prof_since = now;
+}
+
+
+/* calls syscalls were made in the current phase, reading bytes */
+void prof_io(int calls, long long bytes)
+{
+	if (!profile || (prof_cur < 0))
+		return;
+
+	__atomic_add_fetch(&prof_calls[prof_cur], calls, __ATOMIC_RELAXED);
+	if (bytes > 0)
+		__atomic_add_fetch(&prof_bytes[prof_cur], bytes, __ATOMIC_RELAXED);
+}
+
+
+/* resident size in kB, from /proc/self/statm */
+static long long prof_rss(void)
+{
+	char buf[128];
+	ssize_t n;
+	char *p;
+
+	if (!prof_statm)
+		prof_statm = open("/proc/self/statm", O_RDONLY);
+	if (prof_statm < 0)
+		return 0;
+
+	n = pread(prof_statm, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+
+	p = strchr(buf, ' ');
+	if (!p)
+		return 0;
+
+	return strtoll(p + 1, NULL, 10) * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/* the tick is done, file what it cost */
+void prof_tick(void)
+{
+	long long *row;
+	long long tick = 0;
+	long long cpu;
+	int p;
+
+	if (!profile)
+		return;
+
+	prof_phase(PROF_NONE);
+
+	if (!prof_table) {
+		prof_rows = len + 1;
+		prof_table = calloc(prof_rows, PROF_METRICS * sizeof(long long));
+		if (!prof_table) {
+			perror("calloc(profile)");
+			exit (EXIT_FAILURE);
+		}
+		prof_cpu = prof_clock(CLOCK_PROCESS_CPUTIME_ID);
+	}
+
+	row = &prof_table[(prof_ticks % prof_rows) * PROF_METRICS];
+	for (p = 0; p < PROF_PHASES; p++) {
+		long long ns = __atomic_exchange_n(&prof_ns[p], 0, __ATOMIC_RELAXED);
+
+		row[p * 3] = ns / 1000;
+		row[p * 3 + 1] = __atomic_exchange_n(&prof_calls[p], 0, __ATOMIC_RELAXED);
+		row[p * 3 + 2] = __atomic_exchange_n(&prof_bytes[p], 0, __ATOMIC_RELAXED);
+		/* the PSS thread doesn't hold up the tick */
+		if (p != PROF_PSS)
+			tick += ns;
+	}
+
+	cpu = prof_clock(CLOCK_PROCESS_CPUTIME_ID);
+	row[PROF_PHASES * 3] = tick / 1000;
+	row[PROF_PHASES * 3 + 1] = (cpu - prof_cpu) / 1000;
+	row[PROF_PHASES * 3 + 2] = prof_rss();
+	prof_cpu = cpu;
+
+	if (tick > interval)
+		prof_over++;
+	prof_ticks++;
+}
+
+
+/*
+ * The chart is written up to offset bytes, charge the time and bytes
+ * since the last call to section. NULL starts over.
+ */
+void prof_section(const char *section, long long offset)
+{
+	long long now;
+	int s;
+
+	if (!profile)
+		return;
+
+	now = prof_clock(CLOCK_MONOTONIC);
+	if (section) {
+		for (s = 0; s < prof_secs; s++)
+			if (!strcmp(prof_sec_name[s], section))
+				break;
+		if (s == PROF_SECTIONS)
+			return;
+		if (s == prof_secs)
+			prof_sec_name[prof_secs++] = section;
+		prof_sec_ns[s] += now - prof_sec_since;
+		prof_sec_bytes[s] += offset - prof_sec_offset;
+	}
+
+	prof_sec_since = now;
+	prof_sec_offset = offset;
+}
+
+
+static int prof_cmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* "system_usec", "tick_usec", ... */
+void prof_metric_name(int m, char *name, size_t size)
+{
+	static const char *field[3] = { "usec", "syscalls", "bytes" };
+	static const char *total[3] = { "tick_usec", "cpu_usec", "rss_kb" };
+
+	if (m < PROF_PHASES * 3)
+		snprintf(name, size, "%s_%s", prof_phase_name[m / 3], field[m % 3]);
+	else
+		snprintf(name, size, "%s", total[m - PROF_PHASES * 3]);
+}
+
+
+/*
+ * p50, p99 and max of metric m over the ticks we have. Returns how many
+ * ticks that is, 0 when we weren't profiling (or are drawing a log).
+ */
+int prof_stats(int m, long long *p50, long long *p99, long long *max)
+{
+	long long *v;
+	int n;
+	int i;
+
+	n = (prof_ticks < prof_rows) ? prof_ticks : prof_rows;
+	if (!n)
+		return 0;
+
+	v = malloc(n * sizeof(long long));
+	if (!v) {
+		perror("malloc(profile)");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++)
+		v[i] = prof_table[i * PROF_METRICS + m];
+	qsort(v, n, sizeof(long long), prof_cmp);
+
+	*p50 = v[(n - 1) * 50 / 100];
+	*p99 = v[(n - 1) * 99 / 100];
+	*max = v[n - 1];
+	free(v);
+
+	return n;
+}
+
+
+/* ticks that took longer than the sample interval */
+int prof_overruns(void)
+{
+	return prof_over;
+}
+
+
+/*
+ * The summary as tab separated tables, next to the chart or log.
+ * Returns 1 when there's nothing to write.
+ */
+int prof_write(const char *filename)
+{
+	long long ns = 0;
+	long long bytes = 0;
+	FILE *f;
+	int m;
+	int s;
+
+	if (!prof_ticks && !prof_secs)
+		return 1;
+
+	f = fopen(filename, "w");
+	if (!f) {
+		perror("open profile");
+		return -1;
+	}
+
+	if (prof_ticks) {
+		fprintf(f, "# bootchartd collector profile: hz=%f ticks=%d over_interval=%d overrun=%d dropped=%d\n",
+			hz, (prof_ticks < prof_rows) ? prof_ticks : prof_rows, prof_over, overrun, dropped);
+		fprintf(f, "metric\tp50\tp99\tmax\n");
+		for (m = 0; m < PROF_METRICS; m++) {
+			long long p50;
+			long long p99;
+			long long max;
+			char name[32];
+
+			prof_stats(m, &p50, &p99, &max);
+			prof_metric_name(m, name, sizeof(name));
+			fprintf(f, "%s\t%lld\t%lld\t%lld\n", name, p50, p99, max);
+		}
+	}
+
+	if (prof_secs) {
+		for (s = 0; s < prof_secs; s++) {
+			ns += prof_sec_ns[s];
+			bytes += prof_sec_bytes[s];
+		}
+		fprintf(f, "# bootchartd render profile: usec=%lld bytes=%lld samples=%d\n",
+			ns / 1000, bytes, samples);
+		fprintf(f, "section\tusec\tbytes\n");
+		for (s = 0; s < prof_secs; s++)
+			fprintf(f, "%s\t%lld\t%lld\n", prof_sec_name[s],
+				prof_sec_ns[s] / 1000, prof_sec_bytes[s]);
+	}
+
+	if (fclose(f)) {
+		perror("write profile");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void prof_free(void)
+{
+	free(prof_table);
+	prof_table = NULL;
+	prof_ticks = 0;
+	prof_over = 0;
+	prof_secs = 0;
+	memset(prof_sec_ns, 0, sizeof(prof_sec_ns));
+	memset(prof_sec_bytes, 0, sizeof(prof_sec_bytes));
+	if (prof_statm > 0)
+		close(prof_statm);
+	prof_statm = 0;
+}
@@ -0,0 +1,592 @@
+/*
+ * store.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Per sample system data, one series per value. Each series is a table
+ * of fixed size chunks that are only allocated when a sample is written
+ * into them, so the memory used follows the length of the recording and
+ * growing never moves samples that are already there.
+ */
+struct series_struct sampletime;
+struct series_struct blockstat_bi;
+struct series_struct blockstat_bo;
+struct series_struct entropy_avail;
+struct series_struct sampleskip;
+struct series_struct *cpu_runtime;
+struct series_struct *cpu_waittime;
+int cpus_max;
+struct series_struct psi_total[PSI_FIELDS];
+struct disk_struct *disks;
+int ndisks;
+
+/* per process sample blocks */
+static struct pool_struct block_pool = POOL_INIT(struct ps_block_struct);
+
+
+static void series_init(struct series_struct *s, int width, int n)
+{
+	memset(s, 0, sizeof(struct series_struct));
+	s->width = width;
+	s->nchunks = (n + SERIES_CHUNK - 1) / SERIES_CHUNK;
+	if (s->nchunks < 1)
+		s->nchunks = 1;
+
+	s->chunk = calloc(s->nchunks, sizeof(char *));
+	if (!s->chunk) {
+		perror("calloc(series)");
+		exit (EXIT_FAILURE);
+	}
+}
+
+
+static void series_free(struct series_struct *s)
+{
+	int i;
+
+	for (i = 0; i < s->nchunks; i++)
+		free(s->chunk[i]);
+	free(s->chunk);
+	memset(s, 0, sizeof(struct series_struct));
+}
+
+
+/* returns the slot for sample i, allocating it if needed */
+void *series_slot(struct series_struct *s, int i)
+{
+	int c = i / SERIES_CHUNK;
+
+	if (c >= s->nchunks) {
+		int n = s->nchunks;
+
+		while (n <= c)
+			n *= 2;
+		s->chunk = realloc(s->chunk, n * sizeof(char *));
+		if (!s->chunk) {
+			perror("realloc(series)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&s->chunk[s->nchunks], 0, (n - s->nchunks) * sizeof(char *));
+		s->nchunks = n;
+	}
+
+	if (!s->chunk[c]) {
+		s->chunk[c] = calloc(SERIES_CHUNK, s->width);
+		if (!s->chunk[c]) {
+			perror("calloc(series chunk)");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	return s->chunk[c] + (i % SERIES_CHUNK) * s->width;
+}
+
+
+/* make room for per cpu series up to and including cpu c */
+void store_cpus(int c)
+{
+	int n;
+
+	if (c < cpus_max)
+		return;
+
+	n = c + 1;
+	cpu_runtime = realloc(cpu_runtime, n * sizeof(struct series_struct));
+	cpu_waittime = realloc(cpu_waittime, n * sizeof(struct series_struct));
+	if (!cpu_runtime || !cpu_waittime) {
+		perror("realloc(cpu series)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (; cpus_max < n; cpus_max++) {
+		series_init(&cpu_runtime[cpus_max], sizeof(double), len + 1);
+		series_init(&cpu_waittime[cpus_max], sizeof(double), len + 1);
+	}
+}
+
+
+/* make room for device n, and everything before it */
+struct disk_struct *store_disk(int n)
+{
+	if (n >= ndisks) {
+		disks = realloc(disks, (n + 1) * sizeof(struct disk_struct));
+		if (!disks) {
+			perror("realloc(disk series)");
+			exit (EXIT_FAILURE);
+		}
+
+		for (; ndisks <= n; ndisks++) {
+			struct disk_struct *d = &disks[ndisks];
+			int f;
+
+			memset(d->name, 0, sizeof(d->name));
+			d->first = 0;
+			for (f = 0; f < DISK_FIELDS; f++)
+				series_init(&d->s[f], sizeof(double), len + 1);
+		}
+	}
+
+	return &disks[n];
+}
+
+
+/* move samples [base, base + n) of s to [0, n), drop everything else */
+static void series_rewind(struct series_struct *s, int base, int n)
+{
+	char *tmp;
+	int width = s->width;
+	int i;
+
+	tmp = calloc(n, width);
+	if (!tmp) {
+		perror("calloc(series rewind)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (i = 0; i < n; i++) {
+		const void *v = series_peek(s, base + i);
+
+		if (v)
+			memcpy(tmp + i * width, v, width);
+	}
+
+	series_free(s);
+	series_init(s, width, n);
+	for (i = 0; i < n; i++)
+		memcpy(series_slot(s, i), tmp + i * width, width);
+
+	free(tmp);
+}
+
+
+/*
+ * Ring mode: make samples [base, base + n) look like a plain recording
+ * of n samples, for the renderer. Sample numbers don't wrap after this.
+ */
+void store_rewind(int base, int n)
+{
+	int c;
+
+	series_rewind(&sampletime, base, n);
+	series_rewind(&blockstat_bi, base, n);
+	series_rewind(&blockstat_bo, base, n);
+	series_rewind(&entropy_avail, base, n);
+	series_rewind(&sampleskip, base, n);
+	for (c = 0; c < PSI_FIELDS; c++)
+		series_rewind(&psi_total[c], base, n);
+
+	for (c = 0; c < cpus_max; c++) {
+		series_rewind(&cpu_runtime[c], base, n);
+		series_rewind(&cpu_waittime[c], base, n);
+	}
+
+	for (c = 0; c < ndisks; c++) {
+		int f;
+
+		for (f = 0; f < DISK_FIELDS; f++)
+			series_rewind(&disks[c].s[f], base, n);
+		disks[c].first = (disks[c].first > base) ? disks[c].first - base : 0;
+	}
+}
+
+
+void store_init(void)
+{
+	long n;
+	int i;
+
+	series_init(&sampletime, sizeof(double), len + 1);
+	series_init(&blockstat_bi, sizeof(int), len + 1);
+	series_init(&blockstat_bo, sizeof(int), len + 1);
+	series_init(&entropy_avail, sizeof(int), len + 1);
+	series_init(&sampleskip, sizeof(int), len + 1);
+	for (i = 0; i < PSI_FIELDS; i++)
+		series_init(&psi_total[i], sizeof(double), len + 1);
+
+	/* more may show up in /proc/schedstat, we grow then */
+	n = sysconf(_SC_NPROCESSORS_CONF);
+	store_cpus((n > 0) ? n - 1 : 0);
+}
+
+
+void store_free(void)
+{
+	int c;
+
+	series_free(&sampletime);
+	series_free(&blockstat_bi);
+	series_free(&blockstat_bo);
+	series_free(&entropy_avail);
+	series_free(&sampleskip);
+	for (c = 0; c < PSI_FIELDS; c++)
+		series_free(&psi_total[c]);
+
+	for (c = 0; c < cpus_max; c++) {
+		series_free(&cpu_runtime[c]);
+		series_free(&cpu_waittime[c]);
+	}
+	free(cpu_runtime);
+	free(cpu_waittime);
+	cpu_runtime = cpu_waittime = NULL;
+	cpus_max = 0;
+
+	for (c = 0; c < ndisks; c++) {
+		int f;
+
+		for (f = 0; f < DISK_FIELDS; f++)
+			series_free(&disks[c].s[f]);
+	}
+	free(disks);
+	disks = NULL;
+	ndisks = 0;
+
+	pool_destroy(&block_pool);
+}
+
+
+/*
+ * Per process samples. A process that lives for one sample costs one
+ * 256 byte block instead of a full len + 1 array, and a long lived one
+ * about 4 to 8 bytes per sample instead of 24. Blocks come from a pool,
+ * all of them are released at once in store_free().
+ */
+static void block_put(struct ps_block_struct *b, long long v)
+{
+	unsigned long long u = ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+
+	while (u >= 0x80) {
+		b->data[b->size++] = (u & 0x7f) | 0x80;
+		u >>= 7;
+	}
+	b->data[b->size++] = u;
+}
+
+
+static long long block_get(const unsigned char *data, int *pos)
+{
+	unsigned long long u = 0;
+	unsigned char c;
+	int shift = 0;
+
+	do {
+		c = data[(*pos)++];
+		u |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return (long long)(u >> 1) ^ -(long long)(u & 1);
+}
+
+
+/* append the entry for sample st->next */
+static void store_put(struct ps_store_struct *st, double runtime, double waittime)
+{
+	struct ps_block_struct *b = st->tail;
+
+	/* an entry takes at most 2 x 10 bytes */
+	if (!b || (b->count == PS_BLOCK) || (b->size + 20 > PS_BLOCK_DATA)) {
+		b = pool_alloc(&block_pool);
+		b->first = st->next;
+		b->runtime = runtime;
+		b->waittime = waittime;
+		if (st->tail)
+			st->tail->next = b;
+		else
+			st->head = b;
+		st->tail = b;
+	} else {
+		block_put(b, (long long)runtime - (long long)st->runtime);
+		block_put(b, (long long)waittime - (long long)st->waittime);
+	}
+
+	b->count++;
+	st->runtime = runtime;
+	st->waittime = waittime;
+	st->next++;
+}
+
+
+void ps_store_append(struct ps_struct *ps, int sample, double runtime, double waittime)
+{
+	struct ps_store_struct *st = &ps->store;
+
+	if (!st->tail)
+		st->next = sample;
+	else if (sample < st->next)
+		return; /* already have this one */
+
+	if (stream)
+		stream_ps(ps, sample, runtime, waittime);
+
+	/* nothing we could see happened in the samples we missed */
+	while (st->next < sample)
+		store_put(st, st->runtime, st->waittime);
+
+	store_put(st, (long long)runtime, (long long)waittime);
+}
+
+
+/*
+ * Append an encoded block as it was written to a binary log. Returns
+ * -1 if it doesn't follow the blocks we have or doesn't decode.
+ */
+int ps_store_load(struct ps_struct *ps, const struct ps_block_struct *in)
+{
+	struct ps_store_struct *st = &ps->store;
+	struct ps_block_struct *b;
+	double runtime = in->runtime;
+	double waittime = in->waittime;
+	int ends = 0;
+	int pos = 0;
+	int n;
+
+	if ((in->count < 1) || (in->count > PS_BLOCK) ||
+	    (in->size < 0) || (in->size > PS_BLOCK_DATA) ||
+	    (st->tail && (in->first != st->next)))
+		return -1;
+
+	/* every entry is two complete varints */
+	for (n = 0; n < in->size; n++)
+		if (!(in->data[n] & 0x80))
+			ends++;
+	if ((ends != 2 * (in->count - 1)) ||
+	    (in->size && (in->data[in->size - 1] & 0x80)))
+		return -1;
+
+	for (n = 1; n < in->count; n++) {
+		runtime += block_get(in->data, &pos);
+		waittime += block_get(in->data, &pos);
+	}
+
+	b = pool_alloc(&block_pool);
+	memcpy(b, in, sizeof(struct ps_block_struct));
+	b->next = NULL;
+	if (st->tail)
+		st->tail->next = b;
+	else
+		st->head = b;
+	st->tail = b;
+
+	st->next = b->first + b->count;
+	st->runtime = runtime;
+	st->waittime = waittime;
+
+	return 0;
+}
+
+
+/* called from the PSS thread only */
+void ps_store_pss(struct ps_struct *ps, int sample, int pss)
+{
+	struct ps_store_struct *st = &ps->store;
+
+	if (stream)
+		stream_pss(ps, sample, pss);
+
+	if (st->npss && (st->pss[st->npss - 1].sample >= sample)) {
+		st->pss[st->npss - 1].pss = pss;
+		return;
+	}
+
+	if (st->npss == st->pss_alloc) {
+		st->pss_alloc = st->pss_alloc ? st->pss_alloc * 2 : 4;
+		st->pss = realloc(st->pss, st->pss_alloc * sizeof(struct ps_pss_struct));
+		if (!st->pss) {
+			perror("realloc(ps pss)");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	st->pss[st->npss].sample = sample;
+	st->pss[st->npss].pss = pss;
+	st->npss++;
+}
+
+
+/* drop what we have from before sample base, ring and stream mode */
+void ps_store_trim(struct ps_struct *ps, int base)
+{
+	struct ps_store_struct *st = &ps->store;
+	int n;
+
+	while (st->head && st->head->next &&
+	       (st->head->first + st->head->count <= base)) {
+		struct ps_block_struct *b = st->head;
+
+		st->head = b->next;
+		pool_free(&block_pool, b);
+	}
+	st->rblock = NULL;
+
+	for (n = 0; (n < st->npss) && (st->pss[n].sample < base); n++)
+		;
+	if (n) {
+		st->npss -= n;
+		memmove(st->pss, &st->pss[n], st->npss * sizeof(struct ps_pss_struct));
+	}
+	st->rpss = 0;
+}
+
+
+/* renumber so sample base becomes sample 0 */
+void ps_store_rebase(struct ps_struct *ps, int base)
+{
+	struct ps_store_struct *st = &ps->store;
+	struct ps_block_struct *b;
+	int n;
+
+	ps_store_trim(ps, base);
+
+	for (b = st->head; b; b = b->next)
+		b->first -= base;
+	st->next -= base;
+
+	for (n = 0; n < st->npss; n++)
+		st->pss[n].sample -= base;
+}
+
+
+void ps_store_free(struct ps_struct *ps)
+{
+	struct ps_store_struct *st = &ps->store;
+
+	while (st->head) {
+		struct ps_block_struct *b = st->head;
+
+		st->head = b->next;
+		pool_free(&block_pool, b);
+	}
+	free(st->pss);
+	memset(st, 0, sizeof(struct ps_store_struct));
+}
+
+
+/*
+ * Find run and wait time of sample i. Reading forward is cheap, and
+ * so is looking one sample back. Going back further restarts at the
+ * block holding i. Returns -1 if we have no data for sample i.
+ */
+static int store_seek(struct ps_store_struct *st, int i, double *runtime, double *waittime)
+{
+	struct ps_block_struct *b = st->rblock;
+
+	if (!st->head || (i < st->head->first) || (i >= st->next))
+		return -1;
+
+	if (b && st->rprev && (i == st->ri - 1)) {
+		*runtime = st->rprev_runtime;
+		*waittime = st->rprev_waittime;
+		return 0;
+	}
+
+	if (!b || (i < st->ri) || (i >= b->first + b->count)) {
+		if (!b || (i < b->first))
+			b = st->head;
+		while (i >= b->first + b->count)
+			b = b->next;
+
+		st->rblock = b;
+		st->ri = b->first;
+		st->rpos = 0;
+		st->rruntime = b->runtime;
+		st->rwaittime = b->waittime;
+		st->rprev = 0;
+	}
+
+	while (st->ri < i) {
+		st->rprev_runtime = st->rruntime;
+		st->rprev_waittime = st->rwaittime;
+		st->rprev = 1;
+		st->rruntime += block_get(b->data, &st->rpos);
+		st->rwaittime += block_get(b->data, &st->rpos);
+		st->ri++;
+	}
+
+	*runtime = st->rruntime;
+	*waittime = st->rwaittime;
+	return 0;
+}
+
+
+double ps_runtime(struct ps_struct *ps, int i)
+{
+	double runtime;
+	double waittime;
+
+	if (store_seek(&ps->store, i, &runtime, &waittime))
+		return 0.0;
+
+	return runtime;
+}
+
+
+double ps_waittime(struct ps_struct *ps, int i)
+{
+	double runtime;
+	double waittime;
+
+	if (store_seek(&ps->store, i, &runtime, &waittime))
+		return 0.0;
+
+	return waittime;
+}
+
+
+/*
+ * PSS at sample i. Linearly interpolated between two PSS samples, and
+ * the nearest value held at either end of the process lifetime.
+ */
+int ps_pss(struct ps_struct *ps, int i)
+{
+	struct ps_store_struct *st = &ps->store;
+	struct ps_pss_struct *a;
+	struct ps_pss_struct *b;
+	int n = st->npss;
+	int k;
+
+	if ((i < ps->first) || (i > ps->last))
+		return 0;
+
+	/* taken after we last saw the process */
+	while (n && (st->pss[n - 1].sample > ps->last))
+		n--;
+	if (!n)
+		return 0;
+
+	k = st->rpss;
+	if ((k > n) || ((k > 0) && (st->pss[k - 1].sample >= i)))
+		k = 0;
+	while ((k < n) && (st->pss[k].sample < i))
+		k++;
+	st->rpss = k;
+
+	if (k == n)
+		return st->pss[n - 1].pss;
+
+	b = &st->pss[k];
+	if ((b->sample == i) || (k == 0))
+		return b->pss;
+
+	a = &st->pss[k - 1];
+	return a->pss + (b->pss - a->pss)
+		* (sample_time(i) - sample_time(a->sample))
+		/ (sample_time(b->sample) - sample_time(a->sample));
+}
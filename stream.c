@@ -0,0 +1,611 @@
+/*
+ * stream.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Streaming binary log. Every collector thread hands fixed size
+ * records to an encoder thread through a single producer, single
+ * consumer ring of its own, so sampling never takes a lock or waits
+ * for the disk. The encoder turns the records into varint deltas and
+ * appends them to the log in RECS sections as it goes. Processes are
+ * dropped from memory once they exited and are written out, so memory
+ * use doesn't grow with the length of the recording, and a crash only
+ * loses the last second or so. bootchartd --render reads the result.
+ */
+int stream;
+int stream_lost;
+
+#define STREAM_RING 16384          /* records per ring, a power of two */
+#define STREAM_CHUNK (64 * 1024)   /* largest RECS section we write */
+#define STREAM_REC_MAX 128         /* largest encoded record */
+
+struct stream_rec_struct {
+	int type;
+	int sample;
+	int id;       /* sid, cpu or disk */
+	int v[6];
+	double d[DISK_FIELDS];
+	char name[16];
+	char *str;    /* CGINFO path, the encoder frees it */
+};
+
+struct stream_ring_struct {
+	struct stream_rec_struct *rec;
+	/* written by the producer and the encoder, keep them apart */
+	unsigned int head __attribute__((aligned(64)));
+	unsigned int tail __attribute__((aligned(64)));
+};
+
+/* one ring per sampling thread, the PSS thread has the last one */
+static struct stream_ring_struct *rings;
+static int nrings;
+static __thread struct stream_ring_struct *sr_self;
+
+static pthread_t encoder;
+static int running;
+static int exiting;
+static int failed;
+
+/* encoder state, only touched by the encoder thread */
+static unsigned char out[STREAM_CHUNK];
+static size_t out_size;
+static struct stream_state_struct *ps_state;
+static int ps_state_size;
+static long long *cpu_state;
+static int cpu_state_size;
+static long long *disk_state;
+static int disk_state_size;
+static long long psi_state[PSI_FIELDS];
+static int sample_state = -1;
+static long long bi_state;
+static long long bo_state;
+static long long entropy_state;
+
+
+/* called by every thread that samples, before it does */
+void stream_thread(int n)
+{
+	if (rings && (n < nrings))
+		sr_self = &rings[n];
+}
+
+
+/* returns -1 if the record was lost */
+static int stream_push(const struct stream_rec_struct *r)
+{
+	struct stream_ring_struct *sr = sr_self ? sr_self : &rings[0];
+	unsigned int head = sr->head;
+
+	/* the encoder fell behind, don't wait for it */
+	if (head - __atomic_load_n(&sr->tail, __ATOMIC_ACQUIRE) == STREAM_RING) {
+		__atomic_add_fetch(&stream_lost, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	sr->rec[head & (STREAM_RING - 1)] = *r;
+	__atomic_store_n(&sr->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+static void put_uv(unsigned long long u)
+{
+	while (u >= 0x80) {
+		out[out_size++] = (u & 0x7f) | 0x80;
+		u >>= 7;
+	}
+	out[out_size++] = u;
+}
+
+
+static void put_sv(long long v)
+{
+	put_uv(((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+
+
+static void put_f64(double d)
+{
+	unsigned long long v;
+	int i;
+
+	memcpy(&v, &d, sizeof(v));
+	for (i = 0; i < 8; i++)
+		out[out_size++] = v >> (i * 8);
+}
+
+
+static void stream_flush(void)
+{
+	if (!out_size)
+		return;
+
+	if (!failed && binlog_stream_recs(out, out_size)) {
+		perror("write binary log");
+		failed = 1;
+	}
+	out_size = 0;
+}
+
+
+static struct stream_state_struct *ps_state_get(int sid)
+{
+	if (sid >= ps_state_size) {
+		int n = ps_state_size ? ps_state_size : 1024;
+
+		while (n <= sid)
+			n *= 2;
+		ps_state = realloc(ps_state, n * sizeof(struct stream_state_struct));
+		if (!ps_state) {
+			perror("realloc(stream state)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&ps_state[ps_state_size], 0,
+		       (n - ps_state_size) * sizeof(struct stream_state_struct));
+		ps_state_size = n;
+	}
+
+	return &ps_state[sid];
+}
+
+
+static long long *cpu_state_get(int c)
+{
+	if (c >= cpu_state_size) {
+		int n = c + 1;
+
+		cpu_state = realloc(cpu_state, n * 2 * sizeof(long long));
+		if (!cpu_state) {
+			perror("realloc(stream state)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&cpu_state[cpu_state_size * 2], 0,
+		       (n - cpu_state_size) * 2 * sizeof(long long));
+		cpu_state_size = n;
+	}
+
+	return &cpu_state[c * 2];
+}
+
+
+static long long *disk_state_get(int n)
+{
+	if (n >= disk_state_size) {
+		int size = n + 1;
+
+		disk_state = realloc(disk_state, size * DISK_FIELDS * sizeof(long long));
+		if (!disk_state) {
+			perror("realloc(stream state)");
+			exit (EXIT_FAILURE);
+		}
+		memset(&disk_state[disk_state_size * DISK_FIELDS], 0,
+		       (size - disk_state_size) * DISK_FIELDS * sizeof(long long));
+		disk_state_size = size;
+	}
+
+	return &disk_state[n * DISK_FIELDS];
+}
+
+
+/* the layout of each record is described in binlog.c */
+static void stream_encode(const struct stream_rec_struct *r)
+{
+	struct stream_state_struct *st;
+	size_t l = r->str ? strlen(r->str) : 0;
+	long long *cs;
+	int f;
+
+	if (out_size + STREAM_REC_MAX + l > sizeof(out))
+		stream_flush();
+
+	out[out_size++] = r->type;
+
+	switch (r->type) {
+	case STREAM_SAMPLE:
+		put_sv(r->sample - sample_state);
+		put_f64(r->d[0]);
+		put_uv(r->v[0]);
+		put_sv(r->v[1] - bi_state);
+		put_sv(r->v[2] - bo_state);
+		put_sv(r->v[3] - entropy_state);
+		sample_state = r->sample;
+		bi_state = r->v[1];
+		bo_state = r->v[2];
+		entropy_state = r->v[3];
+		break;
+	case STREAM_CPU:
+		cs = cpu_state_get(r->id);
+		put_uv(r->id);
+		put_sv((long long)r->d[0] - cs[0]);
+		put_sv((long long)r->d[1] - cs[1]);
+		cs[0] = (long long)r->d[0];
+		cs[1] = (long long)r->d[1];
+		break;
+	case STREAM_PS:
+		st = ps_state_get(r->id);
+		put_uv(r->id);
+		put_sv(r->sample - st->sample);
+		put_sv((long long)r->d[0] - st->runtime);
+		put_sv((long long)r->d[1] - st->waittime);
+		st->sample = r->sample;
+		st->runtime = (long long)r->d[0];
+		st->waittime = (long long)r->d[1];
+		break;
+	case STREAM_PSS:
+		st = ps_state_get(r->id);
+		put_uv(r->id);
+		put_sv(r->sample - st->pss_sample);
+		put_sv(r->v[0] - st->pss);
+		st->pss_sample = r->sample;
+		st->pss = r->v[0];
+		break;
+	case STREAM_PSINFO:
+		put_uv(r->id);
+		put_uv(r->v[0]);
+		put_sv(r->v[1]);
+		put_sv(r->v[2]);
+		put_sv(r->sample);
+		put_sv(r->v[3]);
+		put_uv(r->v[4]);
+		memcpy(&out[out_size], r->name, 16);
+		out_size += 16;
+		put_f64(r->d[0]);
+		put_f64(r->d[1]);
+		put_f64(r->d[2]);
+		put_f64(r->d[3]);
+		put_sv(r->v[5]);
+		break;
+	case STREAM_CLOCK:
+		put_f64(r->d[0]);
+		put_f64(r->d[1]);
+		break;
+	case STREAM_DISKINFO:
+		put_uv(r->id);
+		memcpy(&out[out_size], r->name, 16);
+		out_size += 16;
+		put_sv(r->sample);
+		break;
+	case STREAM_PSI:
+		for (f = 0; f < PSI_FIELDS; f++) {
+			put_sv((long long)r->d[f] - psi_state[f]);
+			psi_state[f] = (long long)r->d[f];
+		}
+		break;
+	case STREAM_DISK:
+		cs = disk_state_get(r->id);
+		put_uv(r->id);
+		for (f = 0; f < DISK_FIELDS; f++) {
+			put_sv((long long)r->d[f] - cs[f]);
+			cs[f] = (long long)r->d[f];
+		}
+		break;
+	case STREAM_CGINFO:
+		put_uv(r->id);
+		put_f64(r->d[0]);
+		put_f64(r->d[1]);
+		put_sv(r->v[0]);
+		put_uv(l);
+		memcpy(&out[out_size], r->str, l);
+		out_size += l;
+		free(r->str);
+		break;
+	}
+}
+
+
+/*
+ * Encode what's in the ring, up to the first record of a sample past
+ * upto. Returns how many records there were.
+ */
+static int stream_drain(struct stream_ring_struct *sr, int upto)
+{
+	unsigned int head = __atomic_load_n(&sr->head, __ATOMIC_ACQUIRE);
+	unsigned int tail = sr->tail;
+	int n = 0;
+
+	while (tail != head) {
+		struct stream_rec_struct *r = &sr->rec[tail & (STREAM_RING - 1)];
+
+		if (r->sample > upto)
+			break;
+		stream_encode(r);
+		tail++;
+		n++;
+		/* let the producer reuse the slots as we go */
+		if (!(n % 256))
+			__atomic_store_n(&sr->tail, tail, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&sr->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+
+/*
+ * Drain all rings, and write out what we have about once a second.
+ * Polls, so the collector threads never have to wake us up.
+ *
+ * The SAMPLE records are in ring 0, after that thread's own records
+ * of the sample. The other rings can be a sample or more ahead of it,
+ * what's past the next sample waits for its SAMPLE record, so the log
+ * stays in order. Once we're told to stop it all goes.
+ */
+static void *stream_worker(void *arg)
+{
+	struct timespec req = { 0, 2000000 };
+	double flushed = gettime_ns();
+	sigset_t set;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		int done = __atomic_load_n(&exiting, __ATOMIC_ACQUIRE);
+		int n = 0;
+		int i;
+
+		n += stream_drain(&rings[0], INT_MAX);
+		for (i = 1; i < nrings; i++)
+			n += stream_drain(&rings[i], done ? INT_MAX : sample_state + 1);
+
+		if (gettime_ns() - flushed >= 1.0) {
+			stream_flush();
+			flushed = gettime_ns();
+		}
+
+		if (done && !n)
+			break;
+		if (!n)
+			nanosleep(&req, NULL);
+	}
+
+	stream_flush();
+
+	return arg;
+}
+
+
+int stream_start(const char *filename)
+{
+	int i;
+
+	if (binlog_stream_open(filename))
+		return -1;
+
+	/* the shards, and the PSS thread */
+	nrings = threads + 1;
+	rings = calloc(nrings, sizeof(struct stream_ring_struct));
+	if (!rings) {
+		perror("calloc(stream rings)");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < nrings; i++) {
+		rings[i].rec = malloc(STREAM_RING * sizeof(struct stream_rec_struct));
+		if (!rings[i].rec) {
+			perror("malloc(stream ring)");
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	if (pthread_create(&encoder, NULL, stream_worker, NULL)) {
+		perror("pthread_create(stream)");
+		exit (EXIT_FAILURE);
+	}
+	running = 1;
+
+	return 0;
+}
+
+
+/* the system wide numbers of a sample, once it's complete */
+void stream_sample(int sample)
+{
+	struct stream_rec_struct r;
+	static int clock_sent;
+	int c;
+
+	if (!running)
+		return;
+
+	memset(&r, 0, sizeof(r));
+
+	if (!clock_sent) {
+		r.type = STREAM_CLOCK;
+		r.d[0] = graph_start;
+		r.d[1] = log_start;
+		stream_push(&r);
+		clock_sent = 1;
+	}
+
+	r.type = STREAM_SAMPLE;
+	r.sample = sample;
+	r.d[0] = sample_time(sample);
+	r.v[0] = series_int(&sampleskip, sample);
+	r.v[1] = series_int(&blockstat_bi, sample);
+	r.v[2] = series_int(&blockstat_bo, sample);
+	r.v[3] = series_int(&entropy_avail, sample);
+	stream_push(&r);
+
+	/* belong to the sample record right before them */
+	r.type = STREAM_CPU;
+	for (c = 0; c < cpus; c++) {
+		r.id = c;
+		r.d[0] = series_double(&cpu_runtime[c], sample);
+		r.d[1] = series_double(&cpu_waittime[c], sample);
+		stream_push(&r);
+	}
+
+	if (psi) {
+		r.type = STREAM_PSI;
+		for (c = 0; c < PSI_FIELDS; c++)
+			r.d[c] = series_double(&psi_total[c], sample);
+		stream_push(&r);
+	}
+
+	r.type = STREAM_DISK;
+	for (c = 0; c < ndisks; c++) {
+		int f;
+
+		if (disks[c].first > sample)
+			continue;
+		r.id = c;
+		for (f = 0; f < DISK_FIELDS; f++)
+			r.d[f] = series_double(&disks[c].s[f], sample);
+		stream_push(&r);
+	}
+}
+
+
+/* a disk we found, before its first DISK record */
+void stream_disk_info(int n)
+{
+	struct stream_rec_struct r;
+
+	if (!running)
+		return;
+
+	memset(&r, 0, sizeof(r));
+	r.type = STREAM_DISKINFO;
+	r.id = n;
+	r.sample = disks[n].first;
+	memcpy(r.name, disks[n].name, 16);
+	stream_push(&r);
+}
+
+
+/*
+ * Everything but the samples of a process. Sent when we first have a
+ * sample of it, and again with the final numbers before it's dropped.
+ */
+void stream_ps_info(struct ps_struct *ps)
+{
+	struct stream_rec_struct r;
+
+	if (!running)
+		return;
+
+	memset(&r, 0, sizeof(r));
+	r.type = STREAM_PSINFO;
+	r.id = ps->sid;
+	r.sample = ps->first;
+	r.v[0] = ps->parent ? ps->parent->sid : 0;
+	r.v[1] = ps->pid;
+	r.v[2] = ps->ppid;
+	r.v[3] = ps->last;
+	r.v[4] = ps->announced; /* the final numbers */
+	r.v[5] = ps->tgid;
+	memcpy(r.name, ps->name, 16);
+	r.d[0] = ps->starttime;
+	r.d[1] = ps->exittime;
+	r.d[2] = ps->blkio;
+	r.d[3] = ps->swapin;
+	stream_push(&r);
+	ps->announced = 1;
+
+	if (!ps->cgroup)
+		return;
+
+	/* the path is too long for a record, it goes along on the heap */
+	memset(&r, 0, sizeof(r));
+	r.type = STREAM_CGINFO;
+	r.id = ps->sid;
+	r.v[0] = ps->pss_max;
+	r.d[0] = ps->rbytes;
+	r.d[1] = ps->wbytes;
+	r.str = strdup(ps->cgroup);
+	if (r.str && stream_push(&r))
+		free(r.str);
+}
+
+
+void stream_ps(struct ps_struct *ps, int sample, double runtime, double waittime)
+{
+	struct stream_rec_struct r;
+
+	if (!running)
+		return;
+
+	if (!ps->announced)
+		stream_ps_info(ps);
+
+	memset(&r, 0, sizeof(r));
+	r.type = STREAM_PS;
+	r.id = ps->sid;
+	r.sample = sample;
+	r.d[0] = runtime;
+	r.d[1] = waittime;
+	stream_push(&r);
+}
+
+
+/* called from the PSS thread, or the sampling one in cgroups mode */
+void stream_pss(struct ps_struct *ps, int sample, int pss)
+{
+	struct stream_rec_struct r;
+
+	if (!running)
+		return;
+
+	memset(&r, 0, sizeof(r));
+	r.type = STREAM_PSS;
+	r.id = ps->sid;
+	r.sample = sample;
+	r.v[0] = pss;
+	stream_push(&r);
+}
+
+
+/*
+ * Stop the encoder once it wrote everything, then close the log with
+ * the sections only known at the end. The collector threads must be
+ * done by now.
+ */
+int stream_stop(void)
+{
+	int i;
+
+	if (!running)
+		return 0;
+
+	__atomic_store_n(&exiting, 1, __ATOMIC_RELEASE);
+	pthread_join(encoder, NULL);
+	running = 0;
+
+	for (i = 0; i < nrings; i++)
+		free(rings[i].rec);
+	free(rings);
+	rings = NULL;
+	free(ps_state);
+	free(cpu_state);
+	free(disk_state);
+	ps_state = NULL;
+	cpu_state = NULL;
+	disk_state = NULL;
+
+	if (binlog_stream_close())
+		failed = 1;
+
+	return failed ? -1 : 0;
+}
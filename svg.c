@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -31,9 +32,10 @@
 #define max(x, y) (((x) > (y)) ? (x) : (y))
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 
-static char str[8092];
+/* the chart is formatted into a large buffer, written out when full */
+static struct outbuf_struct svg_out;
 
-#define svg(a...) do { snprintf(str, 8092, ## a); fputs(str, of); fflush(of); } while (0)
+#define svg(a...) outbuf_printf(&svg_out, ## a)
 
 static char *colorwheel[12] = {
 	"rgb(255,32,32)",  // red
@@ -57,6 +59,42 @@ static int kcount = 0;
 static float psize = 0;
 static float ksize = 0;
 static float esize = 0;
+static float dsize = 0;
+static float isize = 0;
+static float hsize = 0;
+
+
+/* --profile: what drawing the chart took since the last mark */
+static void svg_mark(const char *section)
+{
+	if (profile)
+		prof_section(section, outbuf_tell(&svg_out));
+}
+
+
+/* --profile: what each phase of a tick cost, over all ticks */
+static void svg_profile(void)
+{
+	long long p50;
+	long long p99;
+	long long max;
+	int ticks;
+	int m;
+
+	ticks = prof_stats(0, &p50, &p99, &max);
+	if (!ticks)
+		return;
+
+	svg("<!-- profile ticks=\"%d\" over_interval=\"%d\" -->\n", ticks, prof_overruns());
+	for (m = 0; m < PROF_METRICS; m++) {
+		char name[32];
+
+		prof_stats(m, &p50, &p99, &max);
+		prof_metric_name(m, name, sizeof(name));
+		svg("<!-- profile %s p50=\"%lld\" p99=\"%lld\" max=\"%lld\" -->\n",
+		    name, p50, p99, max);
+	}
+}
 
 
 static void svg_header(void)
@@ -65,13 +103,13 @@ static void svg_header(void)
 	float h;
 
 	/* min width is about 1600px due to the label */
-	w = 150.0 + 10.0 + time_to_graph(sampletime[samples-1] - graph_start);
+	w = 150.0 + 10.0 + time_to_graph(sample_time(samples-1) - graph_start);
 	w = ((w < 1600.0) ? 1600.0 : w);
 
 	/* height is variable based on pss, psize, ksize */
 	h = 400.0 + (scale_y * 30.0) /* base graphs and title */
 	    + (pss ? (100.0 * scale_y) + (scale_y * 7.0) : 0.0) /* pss estimate */
-	    + psize + ksize + esize;
+	    + psize + ksize + esize + dsize + isize + hsize;
 
 	svg("<?xml version=\"1.0\" standalone=\"no\"?>\n");
 	svg("<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" ");
@@ -94,7 +132,15 @@ static void svg_header(void)
 	svg("<!-- x=\"%f\" y=\"%f\" -->\n", scale_x, scale_y);
 	svg("<!-- rel=\"%d\" f=\"%d\" -->\n", relative, filter);
 	svg("<!-- p=\"%d\" e=\"%d\" -->\n", pss, entropy);
-	svg("<!-- o=\"%s\" i=\"%s\" -->\n\n", output_path, init_path);
+	svg("<!-- o=\"%s\" i=\"%s\" -->\n", output_path, init_path);
+	svg("<!-- collector cpu=\"%.03fs\" -->\n", collector_cpu);
+	svg("<!-- fds budget=\"%d\" hits=\"%d\" misses=\"%d\" reopens=\"%d\" evictions=\"%d\" -->\n",
+	    fd_budget, fd_hits, fd_misses, fd_reopens, fd_evictions);
+	if (adaptive)
+		svg("<!-- adaptive=\"%d\" probes=\"%d\" skipped=\"%d\" cpu saved=\"~%.03fs\" -->\n",
+		    adaptive, probes, probes_skipped, probes_saved());
+	svg_profile();
+	svg("\n");
 
 	/* style sheet */
 	svg("<defs>\n  <style type=\"text/css\">\n    <![CDATA[\n");
@@ -104,15 +150,25 @@ static void svg_header(void)
 	svg("      rect.wait  { fill: rgb(240,240,0); stroke-width: 0; fill-opacity: 0.7; }\n");
 	svg("      rect.bi    { fill: rgb(240,128,128); stroke-width: 0; fill-opacity: 0.7; }\n");
 	svg("      rect.bo    { fill: rgb(192,64,64); stroke-width: 0; fill-opacity: 0.7; }\n");
+	svg("      rect.util  { fill: rgb(64,160,64); stroke-width: 0; fill-opacity: 0.7; }\n");
+	svg("      rect.psicpu { fill: rgb(64,64,240); stroke-width: 0; fill-opacity: 0.35; }\n");
+	svg("      rect.psiio  { fill: rgb(192,64,64); stroke-width: 0; fill-opacity: 0.35; }\n");
+	svg("      rect.psimem { fill: rgb(64,160,64); stroke-width: 0; fill-opacity: 0.35; }\n");
+	svg("      rect.full  { fill-opacity: 0.9; }\n");
+	svg("      rect.heat  { stroke-width: 0; }\n");
 	svg("      rect.ps    { fill: rgb(192,192,192); stroke: rgb(128,128,128); fill-opacity: 0.7; }\n");
+	svg("      rect.thread { fill: rgb(224,224,224); stroke: rgb(160,160,160); fill-opacity: 0.7; stroke-dasharray: 2,2; }\n");
 	svg("      rect.krnl  { fill: rgb(240,240,0); stroke: rgb(128,128,128); fill-opacity: 0.7; }\n");
 	svg("      rect.box   { fill: rgb(240,240,240); stroke: rgb(192,192,192); }\n");
+	svg("      rect.gap   { fill: rgb(255,255,255); stroke-width: 0; fill-opacity: 0.8; }\n");
 	svg("      rect.clrw  { stroke-width: 0; fill-opacity: 0.7;}\n");
 	svg("      line       { stroke: rgb(64,64,64); stroke-width: 1; }\n");
 	svg("//    line.sec1  { }\n");
 	svg("      line.sec5  { stroke-width: 2; }\n");
 	svg("      line.sec01 { stroke: rgb(224,224,224); stroke-width: 1; }\n");
 	svg("      line.dot   { stroke-dasharray: 2 4; }\n");
+	svg("      line.lat   { stroke: rgb(160,32,160); stroke-width: 2; }\n");
+	svg("      line.queue { stroke: rgb(32,32,160); stroke-width: 1; stroke-dasharray: 4 2; }\n");
 	svg("      line.idle  { stroke: rgb(64,64,64); stroke-dasharray: 10 6; stroke-opacity: 0.7; }\n");
 
 	svg("      .run       { font-size: 8; font-style: italic; }\n");
@@ -127,57 +183,142 @@ static void svg_header(void)
 }
 
 
-static void svg_title(void)
+/*
+ * Everything the title shows about the system, and the initcall lines
+ * from dmesg. Read when the chart is drawn, or loaded from a binary log.
+ */
+struct sysdesc_struct sysdesc;
+char *initcalls;
+int initcalls_size;
+int cpu_group_kind;
+int *cpu_group;
+int cpu_groups;
+
+
+/* NUMA node and package of every cpu we have samples of */
+static void svg_topology_read(void)
+{
+	char filename[PATH_MAX];
+	int *node;
+	int *package;
+	int nodes = 0;
+	int packages = 0;
+	int c;
+
+	free(cpu_group);
+	cpu_group = NULL;
+	cpu_groups = 0;
+	cpu_group_kind = CPU_GROUP_NONE;
+	if (cpus < 1)
+		return;
+
+	node = calloc(cpus, sizeof(int));
+	package = calloc(cpus, sizeof(int));
+	if (!node || !package) {
+		perror("calloc(topology)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (c = 0; c < cpus; c++) {
+		struct dirent *ent;
+		FILE *f;
+		DIR *d;
+
+		/* the cpu directory links to its node as "node<N>" */
+		path_printf(filename, sizeof(filename), "%s/sys/devices/system/cpu/cpu%d",
+			    root_path, c);
+		d = opendir(filename);
+		while (d && (ent = readdir(d)))
+			if (!strncmp(ent->d_name, "node", 4) && isdigit(ent->d_name[4]))
+				node[c] = atoi(ent->d_name + 4);
+		if (d)
+			closedir(d);
+
+		path_printf(filename, sizeof(filename), "%s/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+			    root_path, c);
+		f = fopen(filename, "r");
+		if (f) {
+			if (fscanf(f, "%d", &package[c]) != 1)
+				package[c] = 0;
+			fclose(f);
+		}
+
+		if (node[c] != node[0])
+			nodes = 1;
+		if (package[c] != package[0])
+			packages = 1;
+	}
+
+	if (nodes) {
+		cpu_group = node;
+		free(package);
+		cpu_group_kind = CPU_GROUP_NODE;
+	} else {
+		cpu_group = package;
+		free(node);
+		cpu_group_kind = packages ? CPU_GROUP_PACKAGE : CPU_GROUP_NONE;
+	}
+	cpu_groups = cpus;
+}
+
+void svg_sysdesc_read(void)
 {
-	char cmdline[256] = "";
 	char filename[PATH_MAX];
 	char buf[256];
 	char rootbdev[16] = "Unknown";
-	char model[256] = "Unknown";
-	char date[256] = "Unknown";
-	char cpu[256] = "Unknown";
-	char build[256] = "Unknown";
 	char *c;
 	FILE *f;
 	time_t t;
 	struct utsname uts;
 
+	strcpy(sysdesc.disk, "Unknown");
+	strcpy(sysdesc.cpu, "Unknown");
+	strcpy(sysdesc.build, "Unknown");
+
 	/* grab /proc/cmdline */
-	f = fopen("/proc/cmdline", "r");
+	path_printf(filename, sizeof(filename), "%s/proc/cmdline", root_path);
+	f = fopen(filename, "r");
 	if (f) {
-		if (!fgets(cmdline, 255, f))
-			sprintf(cmdline, "Unknown");
+		if (!fgets(sysdesc.cmdline, 255, f))
+			sprintf(sysdesc.cmdline, "Unknown");
 		fclose(f);
 	}
 
 	/* extract root fs so we can find disk model name in sysfs */
-	c = strstr(cmdline, "root=/dev/");
+	c = strstr(sysdesc.cmdline, "root=/dev/");
 	if (c) {
 		strncpy(rootbdev, &c[10], 3);
 		rootbdev[3] = '\0';
 	}
-	sprintf(filename, "/sys/block/%s/device/model", rootbdev);
+	path_printf(filename, sizeof(filename), "%s/sys/block/%s/device/model",
+		    root_path, rootbdev);
 	f = fopen(filename, "r");
 	if (f) {
-		if (!fgets(model, 255, f))
+		if (!fgets(sysdesc.disk, 255, f))
 			fprintf(stderr, "Error reading disk model for %s\n", rootbdev);
 		fclose(f);
 	}
 
 	/* various utsname parameters */
-	if (uname(&uts))
+	if (uname(&uts)) {
 		fprintf(stderr, "Error getting uname info\n");
+		memset(&uts, 0, sizeof(uts));
+	}
+	snprintf(sysdesc.host, sizeof(sysdesc.host), "%s", uts.nodename);
+	snprintf(sysdesc.system, sizeof(sysdesc.system), "%s %s %s %s",
+		 uts.sysname, uts.release, uts.version, uts.machine);
 
 	/* date */
 	t = time(NULL);
-	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S %z", localtime(&t));
+	strftime(sysdesc.date, sizeof(sysdesc.date), "%a, %d %b %Y %H:%M:%S %z", localtime(&t));
 
 	/* CPU type */
-	f = fopen("/proc/cpuinfo", "r");
+	path_printf(filename, sizeof(filename), "%s/proc/cpuinfo", root_path);
+	f = fopen(filename, "r");
 	if (f) {
 		while (fgets(buf, 255, f)) {
 			if (strstr(buf, "model name")) {
-				strncpy(cpu, &buf[13], 255);
+				snprintf(sysdesc.cpu, sizeof(sysdesc.cpu), "%s", &buf[13]);
 				break;
 			}
 		}
@@ -188,22 +329,57 @@ static void svg_title(void)
 	f = fopen("/etc/system-release", "r");
 	if (f) {
 		if (fgets(buf, 255, f))
-			strncpy(build, buf, 255);
+			snprintf(sysdesc.build, sizeof(sysdesc.build), "%s", buf);
 		fclose(f);
 	}
 
+	svg_topology_read();
+
+	/* keep the initcall lines of dmesg, can't plot them in relative mode */
+	free(initcalls);
+	initcalls = NULL;
+	initcalls_size = 0;
+	if (!initcall || relative)
+		return;
+
+	f = popen("dmesg", "r");
+	if (!f)
+		return;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		int l;
+
+		if (!strstr(buf, "] initcall "))
+			continue;
+
+		l = strlen(buf);
+		initcalls = realloc(initcalls, initcalls_size + l + 1);
+		if (!initcalls) {
+			perror("realloc(initcalls)");
+			exit (EXIT_FAILURE);
+		}
+		memcpy(initcalls + initcalls_size, buf, l + 1);
+		initcalls_size += l;
+	}
+
+	pclose(f);
+}
+
+
+static void svg_title(void)
+{
 	svg("<text class=\"t1\" x=\"0\" y=\"30\">Bootchart for %s - %s</text>\n",
-	    uts.nodename, date);
-	svg("<text class=\"t2\" x=\"20\" y=\"50\">System: %s %s %s %s</text>\n",
-	    uts.sysname, uts.release, uts.version, uts.machine);
+	    sysdesc.host, sysdesc.date);
+	svg("<text class=\"t2\" x=\"20\" y=\"50\">System: %s</text>\n",
+	    sysdesc.system);
 	svg("<text class=\"t2\" x=\"20\" y=\"65\">CPU: %s</text>\n",
-	    cpu);
+	    sysdesc.cpu);
 	svg("<text class=\"t2\" x=\"20\" y=\"80\">Disk: %s</text>\n",
-	    model);
+	    sysdesc.disk);
 	svg("<text class=\"t2\" x=\"20\" y=\"95\">Boot options: %s</text>\n",
-	    cmdline);
+	    sysdesc.cmdline);
 	svg("<text class=\"t2\" x=\"20\" y=\"110\">Build: %s</text>\n",
-	    build);
+	    sysdesc.build);
 	svg("<text class=\"t2\" x=\"20\" y=\"125\">Log start time: %.03fs</text>\n", log_start);
 	svg("<text class=\"t2\" x=\"20\" y=\"140\">Idle time: ");
 
@@ -213,11 +389,11 @@ static void svg_title(void)
 		svg("Not detected");
 	svg("</text>\n");
 	svg("<text class=\"sec\" x=\"20\" y=\"155\">Graph data: %.03f samples/sec, recorded %i total, dropped %i samples, %i processes, %i filtered</text>\n",
-	    hz, len, overrun, pscount, pfiltered);
+	    hz, samples, dropped, pscount, pfiltered);
 }
 
 
-static void svg_graph_box(int height)
+static void svg_graph_box(double height)
 {
 	double d = 0.0;
 	int i = 0;
@@ -225,10 +401,10 @@ static void svg_graph_box(int height)
 	/* outside box, fill */
 	svg("<rect class=\"box\" x=\"%.03f\" y=\"0\" width=\"%.03f\" height=\"%.03f\" />\n",
 	    time_to_graph(0.0),
-	    time_to_graph(sampletime[samples-1] - graph_start),
+	    time_to_graph(sample_time(samples-1) - graph_start),
 	    ps_to_graph(height));
 
-	for (d = graph_start; d <= sampletime[samples-1];
+	for (d = graph_start; d <= sample_time(samples-1);
 	     d += (scale_x < 2.0 ? 60.0 : scale_x < 10.0 ? 1.0 : 0.1)) {
 		/* lines for each second */
 		if (i % 50 == 0)
@@ -256,6 +432,14 @@ static void svg_graph_box(int height)
 
 		i++;
 	}
+
+	/* blank out where ticks were lost, we have no data there */
+	for (i = 1; i < samples; i++)
+		if (series_int(&sampleskip, i))
+			svg("  <rect class=\"gap\" x=\"%.03f\" y=\"0\" width=\"%.03f\" height=\"%.03f\" />\n",
+			    time_to_graph(sample_time(i - 1) - graph_start),
+			    time_to_graph(sample_time(i) - sample_time(i - 1)),
+			    ps_to_graph(height));
 }
 
 
@@ -275,10 +459,10 @@ static void svg_pss_graph(void)
 		svg("  <line class=\"sec01\" x1=\"%.03f\" y1=\"%.0f\" x2=\"%.03f\" y2=\"%.0f\"/>\n",
 			time_to_graph(.0),
 			kb_to_graph(i),
-			time_to_graph(sampletime[samples-1] - graph_start),
+			time_to_graph(sample_time(samples-1) - graph_start),
 			kb_to_graph(i));
 		svg("  <text class=\"sec\" x=\"%.03f\" y=\"%.0f\">%dM</text>\n",
-		    time_to_graph(sampletime[samples-1] - graph_start) + 5,
+		    time_to_graph(sample_time(samples-1) - graph_start) + 5,
 		    kb_to_graph(i), (1000000 - i) / 1000);
 	}
 	svg("\n");
@@ -297,14 +481,14 @@ static void svg_pss_graph(void)
 			ps = ps->next_ps;
 			if (!ps)
 				continue;
-			if (ps->sample[i].pss <= (100 * scale_y))
-				top += ps->sample[i].pss;
+			if (ps_pss(ps, i) <= (100 * scale_y))
+				top += ps_pss(ps, i);
 		};
 		svg("    <rect class=\"clrw\" style=\"fill: %s\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
 		    "rgb(64,64,64)",
-		    time_to_graph(sampletime[i - 1] - graph_start),
+		    time_to_graph(sample_time(i - 1) - graph_start),
 		    kb_to_graph(1000000.0 - top),
-		    time_to_graph(sampletime[i] - sampletime[i - 1]),
+		    time_to_graph(sample_time(i) - sample_time(i - 1)),
 		    kb_to_graph(top - bottom));
 
 		bottom = top;
@@ -316,13 +500,13 @@ static void svg_pss_graph(void)
 			if (!ps)
 				continue;
 			/* don't draw anything smaller than 2mb */
-			if (ps->sample[i].pss > (100 * scale_y)) {
-				top = bottom + ps->sample[i].pss;
+			if (ps_pss(ps, i) > (100 * scale_y)) {
+				top = bottom + ps_pss(ps, i);
 				svg("    <rect class=\"clrw\" style=\"fill: %s\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
 				    colorwheel[ps->pid % 12],
-				    time_to_graph(sampletime[i - 1] - graph_start),
+				    time_to_graph(sample_time(i - 1) - graph_start),
 				    kb_to_graph(1000000.0 - top),
-				    time_to_graph(sampletime[i] - sampletime[i - 1]),
+				    time_to_graph(sample_time(i) - sample_time(i - 1)),
 				    kb_to_graph(top - bottom));
 				bottom = top;
 			}
@@ -343,8 +527,8 @@ static void svg_pss_graph(void)
 			ps = ps->next_ps;
 			if (!ps)
 				continue;
-			if (ps->sample[i].pss <= (100 * scale_y))
-				top += ps->sample[i].pss;
+			if (ps_pss(ps, i) <= (100 * scale_y))
+				top += ps_pss(ps, i);
 		};
 
 		bottom = top;
@@ -356,12 +540,12 @@ static void svg_pss_graph(void)
 			if (!ps)
 				continue;
 			/* don't draw anything smaller than 2mb */
-			if (ps->sample[i].pss > (100 * scale_y)) {
-				top = bottom + ps->sample[i].pss;
+			if (ps_pss(ps, i) > (100 * scale_y)) {
+				top = bottom + ps_pss(ps, i);
 				/* draw a label with the process / PID */
-				if ((i == 1) || (ps->sample[i - 1].pss <= (100 * scale_y)))
+				if ((i == 1) || (ps_pss(ps, i - 1) <= (100 * scale_y)))
 					svg("  <text x=\"%.03f\" y=\"%.03f\">%s [%i]</text>\n",
-					    time_to_graph(sampletime[i] - graph_start),
+					    time_to_graph(sample_time(i) - graph_start),
 					    kb_to_graph(1000000.0 - bottom - ((top -  bottom) / 2)),
 					    ps->name,
 					    ps->pid);
@@ -379,7 +563,7 @@ static void svg_pss_graph(void)
 			continue;
 		svg("<!-- %s [%d] pss=", ps->name, ps->pid);
 		for (i = 0; i < samples ; i++) {
-			svg("%d," , ps->sample[i].pss);
+			svg("%d," , ps_pss(ps, i));
 		}
 		svg(" -->\n");
 	}
@@ -420,13 +604,13 @@ static void svg_io_bi_bar(void)
 		start = max(i - ((range / 2) - 1), 0);
 		stop = min(i + (range / 2), samples - 1);
 
-		tot = (double)(blockstat[stop].bi - blockstat[start].bi)
+		tot = (double)(series_int(&blockstat_bi, stop) - series_int(&blockstat_bi, start))
 		      / (stop - start);
 		if (tot > max) {
 			max = tot;
 			max_here = i;
 		}
-		tot = (double)(blockstat[stop].bo - blockstat[start].bo)
+		tot = (double)(series_int(&blockstat_bo, stop) - series_int(&blockstat_bo, start))
 		      / (stop - start);
 		if (tot > max)
 			max = tot;
@@ -442,21 +626,21 @@ static void svg_io_bi_bar(void)
 		start = max(i - ((range / 2) - 1), 0);
 		stop = min(i + (range / 2), samples);
 
-		tot = (double)(blockstat[stop].bi - blockstat[start].bi)
+		tot = (double)(series_int(&blockstat_bi, stop) - series_int(&blockstat_bi, start))
 		      / (stop - start);
 		pbi = tot / max;
 
-		if (pbi > 0.001)
+		if ((pbi > 0.001) && !series_int(&sampleskip, i))
 			svg("<rect class=\"bi\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[i - 1] - graph_start),
+			    time_to_graph(sample_time(i - 1) - graph_start),
 			    (scale_y * 5) - (pbi * (scale_y * 5)),
-			    time_to_graph(sampletime[i] - sampletime[i - 1]),
+			    time_to_graph(sample_time(i) - sample_time(i - 1)),
 			    pbi * (scale_y * 5));
 
 		/* labels around highest value */
 		if (i == max_here) {
 			svg("  <text class=\"sec\" x=\"%.03f\" y=\"%.03f\">%0.2fmb/sec</text>\n",
-			    time_to_graph(sampletime[i] - graph_start) + 5,
+			    time_to_graph(sample_time(i) - graph_start) + 5,
 			    ((scale_y * 5) - (pbi * (scale_y * 5))) + 15,
 			    max / 1024.0 / (interval / 1000000000.0));
 		}
@@ -497,11 +681,11 @@ static void svg_io_bo_bar(void)
 		start = max(i - ((range / 2) - 1), 0);
 		stop = min(i + (range / 2), samples - 1);
 
-		tot = (double)(blockstat[stop].bi - blockstat[start].bi)
+		tot = (double)(series_int(&blockstat_bi, stop) - series_int(&blockstat_bi, start))
 		      / (stop - start);
 		if (tot > max)
 			max = tot;
-		tot = (double)(blockstat[stop].bo - blockstat[start].bo)
+		tot = (double)(series_int(&blockstat_bo, stop) - series_int(&blockstat_bo, start))
 		      / (stop - start);
 		if (tot > max) {
 			max = tot;
@@ -519,21 +703,21 @@ static void svg_io_bo_bar(void)
 		start = max(i - ((range / 2) - 1), 0);
 		stop = min(i + (range / 2), samples);
 
-		tot = (double)(blockstat[stop].bo - blockstat[start].bo)
+		tot = (double)(series_int(&blockstat_bo, stop) - series_int(&blockstat_bo, start))
 		      / (stop - start);
 		pbo = tot / max;
 
-		if (pbo > 0.001)
+		if ((pbo > 0.001) && !series_int(&sampleskip, i))
 			svg("<rect class=\"bo\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[i - 1] - graph_start),
+			    time_to_graph(sample_time(i - 1) - graph_start),
 			    (scale_y * 5) - (pbo * (scale_y * 5)),
-			    time_to_graph(sampletime[i] - sampletime[i - 1]),
+			    time_to_graph(sample_time(i) - sample_time(i - 1)),
 			    pbo * (scale_y * 5));
 
 		/* labels around highest bo value */
 		if (i == max_here) {
 			svg("  <text class=\"sec\" x=\"%.03f\" y=\"%.03f\">%0.2fmb/sec</text>\n",
-			    time_to_graph(sampletime[i] - graph_start) + 5,
+			    time_to_graph(sample_time(i) - graph_start) + 5,
 			    ((scale_y * 5) - (pbo * (scale_y * 5))),
 			    max / 1024.0 / (interval / 1000000000.0));
 		}
@@ -560,23 +744,23 @@ static void svg_cpu_bar(void)
 		ptrt = trt = 0.0;
 
 		for (c = 0; c < cpus; c++)
-			trt += cpustat[c].sample[i].runtime - cpustat[c].sample[i - 1].runtime;
+			trt += series_double(&cpu_runtime[c], i) - series_double(&cpu_runtime[c], i - 1);
 
 		trt = trt / 1000000000.0;
 
 		trt = trt / (double)cpus;
 
 		if (trt > 0.0)
-			ptrt = trt / (sampletime[i] - sampletime[i - 1]);
+			ptrt = trt / (sample_time(i) - sample_time(i - 1));
 
 		if (ptrt > 1.0)
 			ptrt = 1.0;
 
-		if (ptrt > 0.001) {
+		if ((ptrt > 0.001) && !series_int(&sampleskip, i)) {
 			svg("<rect class=\"cpu\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[i - 1] - graph_start),
+			    time_to_graph(sample_time(i - 1) - graph_start),
 			    (scale_y * 5) - (ptrt * (scale_y * 5)),
-			    time_to_graph(sampletime[i] - sampletime[i - 1]),
+			    time_to_graph(sample_time(i) - sample_time(i - 1)),
 			    ptrt * (scale_y * 5));
 		}
 	}
@@ -602,23 +786,23 @@ static void svg_wait_bar(void)
 		ptwt = twt = 0.0;
 
 		for (c = 0; c < cpus; c++)
-			twt += cpustat[c].sample[i].waittime - cpustat[c].sample[i - 1].waittime;
+			twt += series_double(&cpu_waittime[c], i) - series_double(&cpu_waittime[c], i - 1);
 
 		twt = twt / 1000000000.0;
 
 		twt = twt / (double)cpus;
 
 		if (twt > 0.0)
-			ptwt = twt / (sampletime[i] - sampletime[i - 1]);
+			ptwt = twt / (sample_time(i) - sample_time(i - 1));
 
 		if (ptwt > 1.0)
 			ptwt = 1.0;
 
-		if (ptwt > 0.001) {
+		if ((ptwt > 0.001) && !series_int(&sampleskip, i)) {
 			svg("<rect class=\"wait\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[i - 1] - graph_start),
+			    time_to_graph(sample_time(i - 1) - graph_start),
 			    ((scale_y * 5) - (ptwt * (scale_y * 5))),
-			    time_to_graph(sampletime[i] - sampletime[i - 1]),
+			    time_to_graph(sample_time(i) - sample_time(i - 1)),
 			    ptwt * (scale_y * 5));
 		}
 	}
@@ -637,13 +821,386 @@ static void svg_entropy_bar(void)
 
 	/* bars for each sample, scale 0-4096 */
 	for (i = 1; i < samples; i++) {
-		/* svg("<!-- entropy %.03f %i -->\n", sampletime[i], entropy_avail[i]); */
+		if (series_int(&sampleskip, i))
+			continue;
+		/* svg("<!-- entropy %.03f %i -->\n", sample_time(i), series_int(&entropy_avail, i)); */
 		svg("<rect class=\"cpu\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-		    time_to_graph(sampletime[i - 1] - graph_start),
-		    ((scale_y * 5) - ((entropy_avail[i] / 4096.) * (scale_y * 5))),
-		    time_to_graph(sampletime[i] - sampletime[i - 1]),
-		    (entropy_avail[i] / 4096.) * (scale_y * 5));
+		    time_to_graph(sample_time(i - 1) - graph_start),
+		    ((scale_y * 5) - ((series_int(&entropy_avail, i) / 4096.) * (scale_y * 5))),
+		    time_to_graph(sample_time(i) - sample_time(i - 1)),
+		    (series_int(&entropy_avail, i) / 4096.) * (scale_y * 5));
+	}
+}
+
+
+/*
+ * Per cpu heatmap: a thin row per cpu, darker the more of the sample it
+ * ran. Rows are ordered by NUMA node or package. With more than
+ * HEAT_ROWS cpus, neighbours in the same group share a row that shows
+ * the busiest of them, so a single busy cpu still stands out.
+ */
+#define HEAT_ROWS 64
+#define HEAT_LEVELS 16
+
+static int *heat_order;     /* cpus, by group */
+static int *heat_row;       /* first entry of heat_order of each row, and the end */
+static int heat_rows;
+
+static int heat_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+	int gx = (x < cpu_groups) ? cpu_group[x] : 0;
+	int gy = (y < cpu_groups) ? cpu_group[y] : 0;
+
+	if (gx != gy)
+		return (gx > gy) - (gx < gy);
+
+	return (x > y) - (x < y);
+}
+
+
+static int heat_group(int r)
+{
+	int c = heat_order[heat_row[r]];
+
+	return (c < cpu_groups) ? cpu_group[c] : 0;
+}
+
+
+static void heat_layout(void)
+{
+	int per = (cpus + HEAT_ROWS - 1) / HEAT_ROWS;
+	int i;
+
+	heat_order = malloc((cpus + 1) * sizeof(int));
+	heat_row = malloc((cpus + 1) * sizeof(int));
+	if (!heat_order || !heat_row) {
+		perror("malloc(heatmap)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (i = 0; i < cpus; i++)
+		heat_order[i] = i;
+	qsort(heat_order, cpus, sizeof(int), heat_cmp);
+
+	/* rows of up to per cpus, never across groups */
+	heat_rows = 0;
+	for (i = 0; i < cpus; i++) {
+		int g = (heat_order[i] < cpu_groups) ? cpu_group[heat_order[i]] : 0;
+
+		if (!heat_rows || (i - heat_row[heat_rows - 1] == per) ||
+		    (g != heat_group(heat_rows - 1)))
+			heat_row[heat_rows++] = i;
+	}
+	heat_row[heat_rows] = cpus;
+}
+
+
+/* share of sample i that cpu c ran */
+static double cpu_busy(int c, int i)
+{
+	double dt = sample_time(i) - sample_time(i - 1);
+	double p;
+
+	if (dt <= 0.0)
+		return 0.0;
+
+	p = (series_double(&cpu_runtime[c], i) - series_double(&cpu_runtime[c], i - 1))
+		/ 1000000000.0 / dt;
+
+	return (p > 1.0) ? 1.0 : ((p < 0.0) ? 0.0 : p);
+}
+
+
+static void svg_cpu_heatmap(void)
+{
+	static const char *kind[3] = { "cpus", "package", "node" };
+	double rowh = scale_y / 4.0;
+	int r;
+
+	svg("<!-- CPU heatmap -->\n");
+
+	svg("<text class=\"t2\" x=\"5\" y=\"-15\">CPU utilization per cpu%s</text>\n",
+	    (heat_rows < cpus) ? ", busiest of each row" : "");
+
+	/* surrounding box */
+	svg_graph_box(heat_rows / 4.0);
+
+	for (r = 0; r < heat_rows; r++) {
+		int level = 0;
+		int start = 1;
+		int i;
+
+		/* a rect for each run of samples with the same shade */
+		for (i = 1; i <= samples; i++) {
+			int l = 0;
+			int k;
+
+			if ((i < samples) && !series_int(&sampleskip, i)) {
+				double p = 0.0;
+
+				for (k = heat_row[r]; k < heat_row[r + 1]; k++)
+					if (cpu_busy(heat_order[k], i) > p)
+						p = cpu_busy(heat_order[k], i);
+				l = (int)(p * HEAT_LEVELS + 0.5);
+			}
+
+			if ((l == level) && (i < samples))
+				continue;
+
+			if (level)
+				svg("<rect class=\"heat\" style=\"fill: rgb(%.0f,%.0f,240)\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+				    to_color((double)level / HEAT_LEVELS),
+				    to_color((double)level / HEAT_LEVELS),
+				    time_to_graph(sample_time(start - 1) - graph_start),
+				    r * rowh,
+				    time_to_graph(sample_time(i - 1) - sample_time(start - 1)),
+				    rowh);
+			level = l;
+			start = i;
+		}
+
+		/* label the groups */
+		if (cpu_group_kind && (!r || (heat_group(r) != heat_group(r - 1)))) {
+			if (r)
+				svg("  <line class=\"sec5\" x1=\"0\" y1=\"%.03f\" x2=\"%.03f\" y2=\"%.03f\" />\n",
+				    r * rowh,
+				    time_to_graph(sample_time(samples - 1) - graph_start),
+				    r * rowh);
+			svg("  <text class=\"sec\" x=\"5\" y=\"%.03f\">%s %d</text>\n",
+			    r * rowh + 8.0, kind[cpu_group_kind], heat_group(r));
+		}
+	}
+}
+
+
+/*
+ * Pressure stall graph: a band per resource, cpu at the top, with the
+ * share of each sample that some tasks were stalled and, darker on top
+ * of that, that all of them were.
+ */
+static void svg_psi_bar(void)
+{
+	static const char *name[3] = { "cpu", "io", "memory" };
+	static const char *class[3] = { "psicpu", "psiio", "psimem" };
+	double band = scale_y * 2.0;
+	int r;
+	int i;
+
+	svg("<!-- Pressure stall graph -->\n");
+
+	svg("<text class=\"t2\" x=\"5\" y=\"-15\">Pressure stall - some, full</text>\n");
+
+	/* surrounding box */
+	svg_graph_box(6);
+
+	for (r = 0; r < 3; r++) {
+		double bottom = band * (r + 1);
+		double max = 0.0;
+
+		for (i = 1; i < samples; i++) {
+			double dt = sample_time(i) - sample_time(i - 1);
+			int f;
+
+			if ((dt <= 0.0) || series_int(&sampleskip, i))
+				continue;
+
+			for (f = 0; f < 2; f++) {
+				double p = (series_double(&psi_total[r * 2 + f], i)
+					    - series_double(&psi_total[r * 2 + f], i - 1)) / 1000000.0 / dt;
+
+				if (p > 1.0)
+					p = 1.0;
+				if (p > max)
+					max = p;
+				if (p > 0.001)
+					svg("<rect class=\"%s%s\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+					    class[r], f ? " full" : "",
+					    time_to_graph(sample_time(i - 1) - graph_start),
+					    bottom - (p * band),
+					    time_to_graph(dt),
+					    p * band);
+			}
+		}
+
+		if (r)
+			svg("  <line class=\"sec01\" x1=\"0\" y1=\"%.03f\" x2=\"%.03f\" y2=\"%.03f\" />\n",
+			    band * r,
+			    time_to_graph(sample_time(samples - 1) - graph_start),
+			    band * r);
+		svg("  <text class=\"sec\" x=\"5\" y=\"%.03f\">%s, max %.0f%%</text>\n",
+		    band * r + 10.0, name[r], max * 100.0);
+	}
+}
+
+
+/* change of a disk counter over sample i, we have none before first */
+static double disk_delta(const struct disk_struct *d, int f, int i)
+{
+	if (i - 1 < d->first)
+		return 0.0;
+
+	return series_double(&d->s[f], i) - series_double(&d->s[f], i - 1);
+}
+
+
+/* only disks that did any I/O while we were recording */
+static int disk_shown(const struct disk_struct *d)
+{
+	int last = samples - 1;
+
+	if (d->first >= last)
+		return 0;
+
+	return (series_double(&d->s[DISK_RD_IOS], last) != series_double(&d->s[DISK_RD_IOS], d->first)) ||
+	       (series_double(&d->s[DISK_WR_IOS], last) != series_double(&d->s[DISK_WR_IOS], d->first));
+}
+
+
+static void svg_disk_io_bar(const struct disk_struct *d)
+{
+	double max = 0.0;
+	double max_iops = 0.0;
+	int max_here = 0;
+	int i;
+
+	svg("<!-- Disk %s throughput graph -->\n", d->name);
+
+	svg("<text class=\"t2\" x=\"5\" y=\"-15\">Disk %s - throughput (read, write)</text>\n", d->name);
+
+	/* surrounding box */
+	svg_graph_box(5);
+
+	/* in bytes per second */
+	for (i = 1; i < samples; i++) {
+		double dt = sample_time(i) - sample_time(i - 1);
+		double tot;
+		double iops;
+
+		if (dt <= 0.0)
+			continue;
+
+		tot = (disk_delta(d, DISK_RD_SECTORS, i) + disk_delta(d, DISK_WR_SECTORS, i)) * 512.0 / dt;
+		iops = (disk_delta(d, DISK_RD_IOS, i) + disk_delta(d, DISK_WR_IOS, i)) / dt;
+		if (tot > max) {
+			max = tot;
+			max_here = i;
+		}
+		if (iops > max_iops)
+			max_iops = iops;
+	}
+
+	if (max <= 0.0)
+		return;
+
+	/* reads at the bottom, writes stacked on top */
+	for (i = 1; i < samples; i++) {
+		double dt = sample_time(i) - sample_time(i - 1);
+		double prd;
+		double pwr;
+
+		if ((dt <= 0.0) || series_int(&sampleskip, i))
+			continue;
+
+		prd = disk_delta(d, DISK_RD_SECTORS, i) * 512.0 / dt / max;
+		pwr = disk_delta(d, DISK_WR_SECTORS, i) * 512.0 / dt / max;
+
+		if (prd > 0.001)
+			svg("<rect class=\"bi\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+			    time_to_graph(sample_time(i - 1) - graph_start),
+			    (scale_y * 5) - (prd * (scale_y * 5)),
+			    time_to_graph(dt),
+			    prd * (scale_y * 5));
+		if (pwr > 0.001)
+			svg("<rect class=\"bo\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+			    time_to_graph(sample_time(i - 1) - graph_start),
+			    (scale_y * 5) - ((prd + pwr) * (scale_y * 5)),
+			    time_to_graph(dt),
+			    pwr * (scale_y * 5));
+	}
+
+	svg("  <text class=\"sec\" x=\"%.03f\" y=\"%.03f\">%0.2fmb/sec, max %.0f IOPS</text>\n",
+	    time_to_graph(sample_time(max_here) - graph_start) + 5,
+	    15.0,
+	    max / 1024.0 / 1024.0, max_iops);
+}
+
+
+/* a step of a line graph over sample i, at fraction p of the box */
+static void svg_disk_step(const char *class, int i, double p)
+{
+	svg("  <line class=\"%s\" x1=\"%.03f\" y1=\"%.03f\" x2=\"%.03f\" y2=\"%.03f\" />\n",
+	    class,
+	    time_to_graph(sample_time(i - 1) - graph_start),
+	    (scale_y * 5) - (p * (scale_y * 5)),
+	    time_to_graph(sample_time(i) - graph_start),
+	    (scale_y * 5) - (p * (scale_y * 5)));
+}
+
+
+static void svg_disk_util_bar(const struct disk_struct *d)
+{
+	double max_lat = 0.0;
+	double max_queue = 0.0;
+	int i;
+
+	svg("<!-- Disk %s utilization graph -->\n", d->name);
+
+	svg("<text class=\"t2\" x=\"5\" y=\"-15\">Disk %s - utilization, latency and queue depth</text>\n", d->name);
+
+	/* surrounding box */
+	svg_graph_box(5);
+
+	/* latency in ms per request, queue depth in requests */
+	for (i = 1; i < samples; i++) {
+		double dt = sample_time(i) - sample_time(i - 1);
+		double ios = disk_delta(d, DISK_RD_IOS, i) + disk_delta(d, DISK_WR_IOS, i);
+		double q;
+
+		if (dt <= 0.0)
+			continue;
+
+		if (ios > 0.0) {
+			double lat = (disk_delta(d, DISK_RD_TICKS, i) + disk_delta(d, DISK_WR_TICKS, i)) / ios;
+
+			if (lat > max_lat)
+				max_lat = lat;
+		}
+		q = disk_delta(d, DISK_QUEUE, i) / 1000.0 / dt;
+		if (q > max_queue)
+			max_queue = q;
+	}
+
+	for (i = 1; i < samples; i++) {
+		double dt = sample_time(i) - sample_time(i - 1);
+		double ios = disk_delta(d, DISK_RD_IOS, i) + disk_delta(d, DISK_WR_IOS, i);
+		double putil;
+
+		if ((dt <= 0.0) || series_int(&sampleskip, i))
+			continue;
+
+		/* the time the disk had requests in flight */
+		putil = disk_delta(d, DISK_IO_TICKS, i) / 1000.0 / dt;
+		if (putil > 1.0)
+			putil = 1.0;
+		if (putil > 0.001)
+			svg("<rect class=\"util\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+			    time_to_graph(sample_time(i - 1) - graph_start),
+			    (scale_y * 5) - (putil * (scale_y * 5)),
+			    time_to_graph(dt),
+			    putil * (scale_y * 5));
+
+		if ((ios > 0.0) && (max_lat > 0.0))
+			svg_disk_step("lat", i,
+				      (disk_delta(d, DISK_RD_TICKS, i) + disk_delta(d, DISK_WR_TICKS, i))
+				      / ios / max_lat);
+		if (max_queue > 0.0)
+			svg_disk_step("queue", i, disk_delta(d, DISK_QUEUE, i) / 1000.0 / dt / max_queue);
 	}
+
+	svg("  <text class=\"sec\" x=\"%.03f\" y=\"%.03f\">max latency %.01fms, max queue depth %.01f</text>\n",
+	    5.0, 15.0, max_lat, max_queue);
 }
 
 
@@ -678,6 +1235,19 @@ static struct ps_struct *get_next_ps(struct ps_struct *ps)
 }
 
 
+/* tasks mode: keep a process if one of its threads gets a bar */
+static int ps_threads_shown(struct ps_struct *ps)
+{
+	struct ps_struct *t;
+
+	for (t = ps->children; t; t = t->next)
+		if ((t->tgid == ps->pid) && (t->first != t->last) && (t->total > 0.001))
+			return 1;
+
+	return 0;
+}
+
+
 static int ps_filter(struct ps_struct *ps)
 {
 	if (!filter)
@@ -687,12 +1257,12 @@ static int ps_filter(struct ps_struct *ps)
 	if (ps->first == ps->last)
 		return -1;
 
-	/* don't filter kthreadd */
-	if (ps->pid == 2)
+	/* don't filter init, it's the root of our tree, or kthreadd */
+	if (ps->pid == 1 || ps->pid == 2)
 		return 0;
 
 	/* drop stuff that doesn't use any real CPU time */
-	if (ps->total <= 0.001)
+	if ((ps->total <= 0.001) && !ps_threads_shown(ps))
 		return -1;
 
 	return 0;
@@ -701,7 +1271,8 @@ static int ps_filter(struct ps_struct *ps)
 
 static void svg_do_initcall(int count_only)
 {
-	FILE *f;
+	char *next;
+	char *l;
 	double t;
 	char func[256];
 	int ret;
@@ -730,17 +1301,12 @@ static void svg_do_initcall(int count_only)
 	 * when appropriate.
 	 */
 
-	f = popen("dmesg", "r");
-	if (!f)
-		return;
-
-	while (!feof(f)) {
+	for (l = initcalls; l && *l; l = next) {
 		int c;
 		int z = 0;
-		char l[256];
 
-		if (fgets(l, sizeof(l) - 1, f) == NULL)
-			continue;
+		next = strchr(l, '\n');
+		next = next ? next + 1 : l + strlen(l);
 
 		c = sscanf(l, "[%lf] initcall %s %*s %d %*s %d %*s",
 			   &t, func, &ret, &usecs);
@@ -786,8 +1352,18 @@ static void svg_do_initcall(int count_only)
 
 		kcount++;
 	}
+}
+
 
-	fclose(f);
+/* the last part of a cgroup path, the root is "/" */
+static const char *cg_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	if (p)
+		path = p + 1;
+
+	return path[0] ? path : "/";
 }
 
 
@@ -797,11 +1373,11 @@ static void svg_ps_bars(void)
 	int i = 0;
 	int j = 0;
 	int wt;
-	int pid;
 
 	svg("<!-- Process graph -->\n");
 
-	svg("<text class=\"t2\" x=\"5\" y=\"-15\">Processes</text>\n");
+	svg("<text class=\"t2\" x=\"5\" y=\"-15\">%s</text>\n",
+	    cgroups ? "Control groups" : "Processes");
 
 	/* surrounding box */
 	svg_graph_box(pcount);
@@ -818,10 +1394,20 @@ static void svg_ps_bars(void)
 		/* leave some trace of what we actually filtered etc. */
 		svg("<!-- %s [%i] ppid=%i runtime=%.03fs -->\n", ps->name, ps->pid,
 		    ps->ppid, ps->total);
+		if (taskstats)
+			svg("<!-- %s [%i] blkio_delay=%.03fs swapin_delay=%.03fs -->\n", ps->name, ps->pid,
+			    ps->blkio / 1000000000.0, ps->swapin / 1000000000.0);
+		if (ps->cgroup)
+			svg("<!-- %s [%i] cgroup=%s io_stall=%.03fs memory_stall=%.03fs -->\n", ps->name, ps->pid,
+			    ps->cgroup[0] ? ps->cgroup : "/",
+			    ps->blkio / 1000000000.0, ps->swapin / 1000000000.0);
+		if (ps->exittime)
+			svg("<!-- %s [%i] start=%.06fs exit=%.06fs -->\n", ps->name, ps->pid,
+			    ps->starttime - graph_start, ps->exittime - graph_start);
 
 		/* it would be nice if we could use exec_start from /proc/pid/sched,
 		 * but it's unreliable and gives bogus numbers */
-		starttime = sampletime[ps->first];
+		starttime = sample_time(ps->first);
 
 		if (!ps_filter(ps)) {
 			/* remember where _to_ our children need to draw a line */
@@ -842,10 +1428,12 @@ static void svg_ps_bars(void)
 			continue;
 		}
 
-		svg("  <rect class=\"ps\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+		/* threads are drawn lighter, under their process */
+		svg("  <rect class=\"%s\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
+		    ps->tgid ? "thread" : "ps",
 		    time_to_graph(starttime - graph_start),
 		    ps_to_graph(j),
-		    time_to_graph(sampletime[ps->last] - starttime),
+		    time_to_graph(sample_time(ps->last) - starttime),
 		    ps_to_graph(1));
 
 		/* paint cpu load over these */
@@ -854,11 +1442,11 @@ static void svg_ps_bars(void)
 			double wt, wrt;
 
 			/* calculate over interval */
-			rt = ps->sample[t].runtime - ps->sample[t-1].runtime;
-			wt = ps->sample[t].waittime - ps->sample[t-1].waittime;
+			rt = ps_runtime(ps, t) - ps_runtime(ps, t-1);
+			wt = ps_waittime(ps, t) - ps_waittime(ps, t-1);
 
-			prt = (rt / 1000000000) / (sampletime[t] - sampletime[t-1]);
-			wrt = (wt / 1000000000) / (sampletime[t] - sampletime[t-1]);
+			prt = (rt / 1000000000) / (sample_time(t) - sample_time(t-1));
+			wrt = (wt / 1000000000) / (sample_time(t) - sample_time(t-1));
 
 			/* this can happen if timekeeping isn't accurate enough */
 			if (prt > 1.0)
@@ -868,35 +1456,55 @@ static void svg_ps_bars(void)
 
 			if ((prt < 0.1) && (wrt < 0.1)) /* =~ 26 (color threshold) */
 				continue;
+			if (series_int(&sampleskip, t))
+				continue;
 
 			svg("    <rect class=\"wait\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[t - 1] - graph_start),
+			    time_to_graph(sample_time(t - 1) - graph_start),
 			    ps_to_graph(j),
-			    time_to_graph(sampletime[t] - sampletime[t - 1]),
+			    time_to_graph(sample_time(t) - sample_time(t - 1)),
 			    ps_to_graph(wrt));
 
 			/* draw cpu over wait - TODO figure out how/why run + wait > interval */
 			svg("    <rect class=\"cpu\" x=\"%.03f\" y=\"%.03f\" width=\"%.03f\" height=\"%.03f\" />\n",
-			    time_to_graph(sampletime[t - 1] - graph_start),
+			    time_to_graph(sample_time(t - 1) - graph_start),
 			    ps_to_graph(j + (1.0 - prt)),
-			    time_to_graph(sampletime[t] - sampletime[t - 1]),
+			    time_to_graph(sample_time(t) - sample_time(t - 1)),
 			    ps_to_graph(prt));
 		}
 
 		/* determine where to display the process name */
-		if (sampletime[ps->last] - sampletime[ps->first] < 1.5)
+		if (sample_time(ps->last) - sample_time(ps->first) < 1.5)
 			/* too small to fit label inside the box */
 			wt = ps->last;
 		else
 			wt = ps->first;
 
-		/* text label of process name */
-		svg("  <text x=\"%.03f\" y=\"%.03f\">%s [%i] <tspan class=\"run\">%.03fs</tspan></text>\n",
-		    time_to_graph(sampletime[wt] - graph_start) + 5.0,
-		    ps_to_graph(j) + 14.0,
-		    ps->name,
-		    ps->pid,
-		    (ps->sample[ps->last].runtime - ps->sample[ps->first].runtime) / 1000000000.0);
+		/* text label of process name, threads as [tgid:tid] */
+		if (ps->cgroup)
+			svg("  <text x=\"%.03f\" y=\"%.03f\">%s <tspan class=\"run\">%.03fs</tspan> read %.01fM written %.01fM peak %.01fM</text>\n",
+			    time_to_graph(sample_time(wt) - graph_start) + 5.0,
+			    ps_to_graph(j) + 14.0,
+			    cg_name(ps->cgroup),
+			    (ps_runtime(ps, ps->last) - ps_runtime(ps, ps->first)) / 1000000000.0,
+			    ps->rbytes / 1048576.0,
+			    ps->wbytes / 1048576.0,
+			    ps->pss_max / 1024.0);
+		else if (ps->tgid)
+			svg("  <text x=\"%.03f\" y=\"%.03f\">%s [%i:%i] <tspan class=\"run\">%.03fs</tspan></text>\n",
+			    time_to_graph(sample_time(wt) - graph_start) + 5.0,
+			    ps_to_graph(j) + 14.0,
+			    ps->name,
+			    ps->tgid,
+			    ps->pid,
+			    (ps_runtime(ps, ps->last) - ps_runtime(ps, ps->first)) / 1000000000.0);
+		else
+			svg("  <text x=\"%.03f\" y=\"%.03f\">%s [%i] <tspan class=\"run\">%.03fs</tspan></text>\n",
+			    time_to_graph(sample_time(wt) - graph_start) + 5.0,
+			    ps_to_graph(j) + 14.0,
+			    ps->name,
+			    ps->pid,
+			    (ps_runtime(ps, ps->last) - ps_runtime(ps, ps->first)) / 1000000000.0);
 		/* paint lines to the parent process */
 		if (ps->parent) {
 			/* horizontal part */
@@ -921,18 +1529,14 @@ static void svg_ps_bars(void)
 	}
 
 	/* last pass - determine when idle */
-	pid = getpid();
 	/* make sure we start counting from the point where we actually have
 	 * data: assume that bootchart's first sample is when data started
 	 */
-	ps = ps_first;
-	while (ps->next_ps) {
+	ps = collector_pid ? ps_first->next_ps : NULL;
+	while (ps && (ps->pid != collector_pid))
 		ps = ps->next_ps;
-		if (ps->pid == pid)
-			break;
-	}
 
-	for (i = ps->first; i < samples - (hz / 2); i++) {
+	for (i = ps ? ps->first : 0; i < samples - (hz / 2); i++) {
 		double crt;
 		double brt;
 		int c;
@@ -940,8 +1544,8 @@ static void svg_ps_bars(void)
 		/* subtract bootchart cpu utilization from total */
 		crt = 0.0;
 		for (c = 0; c < cpus; c++)
-			crt += cpustat[c].sample[i + ((int)hz / 2)].runtime - cpustat[c].sample[i].runtime;
-		brt = ps->sample[i + ((int)hz / 2)].runtime - ps->sample[i].runtime;
+			crt += series_double(&cpu_runtime[c], i + ((int)hz / 2)) - series_double(&cpu_runtime[c], i);
+		brt = ps ? ps_runtime(ps, i + ((int)hz / 2)) - ps_runtime(ps, i) : 0.0;
 
 		/*
 		 * our definition of "idle":
@@ -950,7 +1554,7 @@ static void svg_ps_bars(void)
 		 * defaults to 4.0%, which experimentally, is where atom idles
 		 */
 		if ((crt - brt) < (interval / 2.0)) {
-			idletime = sampletime[i] - graph_start;
+			idletime = sample_time(i) - graph_start;
 			svg("\n<!-- idle detected at %.03f seconds -->\n",
 			    idletime);
 			svg("<line class=\"idle\" x1=\"%.03f\" y1=\"%.03f\" x2=\"%.03f\" y2=\"%.03f\" />\n",
@@ -1038,11 +1642,19 @@ static void svg_top_ten_pss(void)
 }
 
 
-void svg_do(void)
+/* draw the chart to of, -1 if writing it failed */
+int svg_do(void)
 {
 	struct ps_struct *ps;
+	double off;
+	int ret;
+	int i;
+
+	outbuf_init(&svg_out, of);
+	svg_mark(NULL);
 
-	memset(&str, 0, sizeof(str));
+	if (!sysdesc.date[0])
+		svg_sysdesc_read();
 
 	ps = ps_first;
 
@@ -1061,8 +1673,23 @@ void svg_do(void)
 
 	esize = (entropy ? scale_y * 7 : 0);
 
+	isize = (psi ? scale_y * 8 : 0);
+
+	if (heatmap && cpus) {
+		heat_layout();
+		hsize = (heat_rows / 4.0 + 2.0) * scale_y;
+	}
+
+	dsize = 0;
+	for (i = 0; i < ndisks; i++)
+		if (disk_shown(&disks[i]))
+			dsize += scale_y * 14;
+
+	svg_mark("layout");
+
 	/* after this, we can draw the header with proper sizing */
 	svg_header();
+	svg_mark("header");
 
 	svg("<g transform=\"translate(10,400)\">\n");
 	svg_io_bi_bar();
@@ -1071,51 +1698,103 @@ void svg_do(void)
 	svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 7.0));
 	svg_io_bo_bar();
 	svg("</g>\n\n");
+	svg_mark("io_bars");
 
 	svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 14.0));
 	svg_cpu_bar();
 	svg("</g>\n\n");
+	svg_mark("cpu_bar");
 
 	svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 21.0));
 	svg_wait_bar();
 	svg("</g>\n\n");
+	svg_mark("wait_bar");
 
-	if (kcount) {
+	if (hsize) {
 		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0));
+		svg_cpu_heatmap();
+		svg("</g>\n\n");
+
+		free(heat_order);
+		free(heat_row);
+		heat_order = NULL;
+		heat_row = NULL;
+		svg_mark("heatmap");
+	}
+
+	if (psi) {
+		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + hsize);
+		svg_psi_bar();
+		svg("</g>\n\n");
+		svg_mark("psi_bar");
+	}
+
+	off = 400.0 + (scale_y * 28.0) + hsize + isize;
+	for (i = 0; i < ndisks; i++) {
+		if (!disk_shown(&disks[i]))
+			continue;
+
+		svg("<g transform=\"translate(10,%.03f)\">\n", off);
+		svg_disk_io_bar(&disks[i]);
+		svg("</g>\n\n");
+
+		svg("<g transform=\"translate(10,%.03f)\">\n", off + (scale_y * 7.0));
+		svg_disk_util_bar(&disks[i]);
+		svg("</g>\n\n");
+
+		off += scale_y * 14.0;
+		svg_mark("disk_bars");
+	}
+
+	if (kcount) {
+		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + hsize + isize + dsize);
 		svg_do_initcall(0);
 		svg("</g>\n\n");
+		svg_mark("initcalls");
 	}
 
-	svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + ksize);
+	svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + hsize + isize + dsize + ksize);
 	svg_ps_bars();
 	svg("</g>\n\n");
+	svg_mark("ps_bars");
 
 	svg("<g transform=\"translate(10,  0)\">\n");
 	svg_title();
 	svg("</g>\n\n");
+	svg_mark("title");
 
 	svg("<g transform=\"translate(10,200)\">\n");
 	svg_top_ten_cpu();
 	svg("</g>\n\n");
+	svg_mark("top_ten");
 	
 	if (entropy) {
-		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + ksize + psize);
+		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + hsize + isize + dsize + ksize + psize);
 		svg_entropy_bar();
 		svg("</g>\n\n");
+		svg_mark("entropy_bar");
 	}
 
 	if (pss) {
-		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + ksize + psize + esize);
+		svg("<g transform=\"translate(10,%.03f)\">\n", 400.0 + (scale_y * 28.0) + hsize + isize + dsize + ksize + psize + esize);
 		svg_pss_graph();
 		svg("</g>\n\n");
+		svg_mark("pss_graph");
 
 		svg("<g transform=\"translate(410,200)\">\n");
 		svg_top_ten_pss();
 		svg("</g>\n\n");
+		svg_mark("top_ten");
 	}
 
 
 	/* svg footer */
 	svg("\n</svg>\n");
+	svg_mark("footer");
+
+	ret = outbuf_flush(&svg_out);
+	outbuf_free(&svg_out);
+
+	return ret;
 }
 
@@ -0,0 +1,320 @@
+/*
+ * taskstats.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+
+
+#include "bootchart.h"
+
+/*
+ * Per process CPU and delay accounting through the taskstats generic
+ * netlink family. One request/reply on a socket we keep open replaces
+ * the open/pread of /proc/<pid>/schedstat, and with a cpumask listener
+ * the kernel also hands us the final numbers of every task that exits.
+ *
+ * Run queue, block IO and swap delays need delay accounting enabled
+ * (CONFIG_TASK_DELAY_ACCT and "delayacct" on the kernel cmdline or
+ * kernel.task_delayacct=1).
+ */
+static __thread int ts_query = -1;
+static int ts_exits = -1;
+static __u16 ts_family;
+static __thread __u32 ts_seq;
+
+#define GENLMSG_DATA(g) ((void *)((char *)NLMSG_DATA(g) + GENL_HDRLEN))
+#define NLA_DATA(n) ((void *)((char *)(n) + NLA_HDRLEN))
+
+struct ts_msg {
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	char buf[256];
+};
+
+/*
+ * reply buffer, large enough for a taskstats struct plus headers. Like
+ * the query socket, each collector thread gets its own.
+ */
+static __thread char ts_buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+
+static int ts_socket(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (fd == -1)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static int ts_send(int fd, __u16 type, __u8 cmd, __u16 attr,
+		   const void *data, int size)
+{
+	struct ts_msg msg;
+	struct sockaddr_nl addr;
+	struct nlattr *na;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	msg.n.nlmsg_type = type;
+	msg.n.nlmsg_flags = NLM_F_REQUEST;
+	msg.n.nlmsg_seq = ++ts_seq;
+	msg.g.cmd = cmd;
+	msg.g.version = 1;
+
+	na = (struct nlattr *)GENLMSG_DATA(&msg);
+	na->nla_type = attr;
+	na->nla_len = NLA_HDRLEN + size;
+	memcpy(NLA_DATA(na), data, size);
+	msg.n.nlmsg_len += NLMSG_ALIGN(na->nla_len);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (sendto(fd, &msg, msg.n.nlmsg_len, 0,
+		   (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)msg.n.nlmsg_len)
+		return -1;
+
+	return 0;
+}
+
+
+/* find the dynamically assigned "TASKSTATS" genetlink family id */
+static int ts_resolve_family(int fd)
+{
+	struct nlmsghdr *n;
+	struct nlattr *na;
+	ssize_t len;
+	int left;
+
+	if (ts_send(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+		    TASKSTATS_GENL_NAME, strlen(TASKSTATS_GENL_NAME) + 1))
+		return -1;
+
+	len = recv(fd, ts_buf, sizeof(ts_buf), 0);
+	n = (struct nlmsghdr *)ts_buf;
+	if ((len <= 0) || !NLMSG_OK(n, len) || (n->nlmsg_type == NLMSG_ERROR))
+		return -1;
+
+	na = (struct nlattr *)GENLMSG_DATA(n);
+	left = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	while (left >= NLA_HDRLEN) {
+		if (na->nla_type == CTRL_ATTR_FAMILY_ID) {
+			ts_family = *(__u16 *)NLA_DATA(na);
+			return 0;
+		}
+		left -= NLA_ALIGN(na->nla_len);
+		na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+	}
+
+	return -1;
+}
+
+
+/*
+ * Pull the struct taskstats out of a reply. The kernel nests it as
+ * AGGR_PID/AGGR_TGID { PID/TGID, STATS }.
+ */
+static struct taskstats *ts_parse(struct nlmsghdr *n, int *type)
+{
+	struct nlattr *na;
+	int left;
+
+	if (n->nlmsg_type == NLMSG_ERROR || n->nlmsg_type != ts_family)
+		return NULL;
+
+	na = (struct nlattr *)GENLMSG_DATA(n);
+	left = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	while (left >= NLA_HDRLEN) {
+		if ((na->nla_type == TASKSTATS_TYPE_AGGR_PID) ||
+		    (na->nla_type == TASKSTATS_TYPE_AGGR_TGID)) {
+			struct nlattr *nested = NLA_DATA(na);
+			int nleft = na->nla_len - NLA_HDRLEN;
+
+			while (nleft >= NLA_HDRLEN) {
+				if (nested->nla_type == TASKSTATS_TYPE_STATS) {
+					if (type)
+						*type = na->nla_type;
+					return NLA_DATA(nested);
+				}
+				nleft -= NLA_ALIGN(nested->nla_len);
+				nested = (struct nlattr *)((char *)nested + NLA_ALIGN(nested->nla_len));
+			}
+		}
+		left -= NLA_ALIGN(na->nla_len);
+		na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+	}
+
+	return NULL;
+}
+
+
+static void ts_fill(struct ps_taskstats_struct *out, struct taskstats *t)
+{
+	out->pid = t->ac_pid;
+	out->runtime = t->cpu_run_real_total;
+	out->waittime = t->cpu_delay_total;
+	out->blkio = t->blkio_delay_total;
+	out->swapin = t->swapin_delay_total;
+}
+
+
+int taskstats_open(void)
+{
+	char mask[32];
+
+	ts_query = ts_socket();
+	if (ts_query == -1)
+		return -1;
+
+	if (ts_resolve_family(ts_query)) {
+		close(ts_query);
+		ts_query = -1;
+		return -1;
+	}
+
+	/*
+	 * Exit records are optional - registering a listener needs
+	 * CAP_NET_ADMIN. Without it we still get per-pid queries.
+	 */
+	ts_exits = ts_socket();
+	if (ts_exits == -1)
+		return 0;
+
+	snprintf(mask, sizeof(mask), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+	if (ts_send(ts_exits, ts_family, TASKSTATS_CMD_GET,
+		    TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, mask, strlen(mask) + 1)) {
+		close(ts_exits);
+		ts_exits = -1;
+	}
+
+	return 0;
+}
+
+
+void taskstats_close_thread(void)
+{
+	if (ts_query != -1)
+		close(ts_query);
+	ts_query = -1;
+}
+
+
+void taskstats_close(void)
+{
+	if (ts_exits != -1)
+		close(ts_exits);
+	ts_exits = -1;
+	taskstats_close_thread();
+}
+
+
+/*
+ * Query the current numbers for one pid. Returns -1 if the task is
+ * gone (or we lost the socket).
+ */
+int taskstats_get(int pid, struct ps_taskstats_struct *out)
+{
+	struct taskstats *t;
+	struct nlmsghdr *n;
+	__u32 p = pid;
+	ssize_t len;
+
+	if (!ts_family)
+		return -1;
+
+	/* first query from this thread */
+	if (ts_query == -1) {
+		ts_query = ts_socket();
+		if (ts_query == -1)
+			return -1;
+	}
+
+	if (ts_send(ts_query, ts_family, TASKSTATS_CMD_GET,
+		    TASKSTATS_CMD_ATTR_PID, &p, sizeof(p)))
+		return -1;
+
+	len = recv(ts_query, ts_buf, sizeof(ts_buf), 0);
+	prof_io(2, len);
+	n = (struct nlmsghdr *)ts_buf;
+	if ((len <= 0) || !NLMSG_OK(n, len))
+		return -1;
+
+	t = ts_parse(n, NULL);
+	if (!t)
+		return -1;
+
+	ts_fill(out, t);
+	return 0;
+}
+
+
+/*
+ * Fetch the next exit record, if any. Returns 0 when there is nothing
+ * left to read right now.
+ */
+int taskstats_read_exit(struct ps_taskstats_struct *out)
+{
+	static struct nlmsghdr *n;
+	static ssize_t left;
+	static char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+	if (ts_exits == -1)
+		return 0;
+
+	while (1) {
+		struct taskstats *t;
+		int type;
+
+		if (!left || !NLMSG_OK(n, left)) {
+			left = recv(ts_exits, buf, sizeof(buf), MSG_DONTWAIT);
+			prof_io(1, left);
+			if (left <= 0) {
+				left = 0;
+				return 0;
+			}
+			n = (struct nlmsghdr *)buf;
+		}
+
+		t = ts_parse(n, &type);
+		n = NLMSG_NEXT(n, left);
+
+		/* per thread records only, the tgid ones sum all threads */
+		if (!t || type != TASKSTATS_TYPE_AGGR_PID)
+			continue;
+
+		ts_fill(out, t);
+		return 1;
+	}
+}
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# bench-collector.sh - what sampling costs, per number of processes
+#
+# Usage: bench-collector.sh [NPROCS...]
+#
+# For every NPROCS, makes a synthetic /proc with tests/genproc, keeps
+# it changing while bootchartd --root samples it with --profile, and
+# prints the tick time percentiles and bootchartd's resident size.
+# The environment sets the rest:
+#
+#   SAMPLES   samples per run [100]
+#   HZ        sample frequency [25]
+#   CPUS      cpus of the synthetic system [8]
+#   CHURN     processes that exit and start per second [10]
+#   RUNNING   fraction of the processes running per tick [0.1]
+#   THREADS   sampling threads to try, one run each ["1"]
+#   OPTS      more bootchartd options, like "-a 4" or "-u"
+#   BOOTCHARTD, GENPROC   the programs [./bootchartd, ./tests/genproc]
+#
+
+BOOTCHARTD=${BOOTCHARTD:-./bootchartd}
+GENPROC=${GENPROC:-./tests/genproc}
+SAMPLES=${SAMPLES:-100}
+HZ=${HZ:-25}
+CPUS=${CPUS:-8}
+CHURN=${CHURN:-10}
+RUNNING=${RUNNING:-0.1}
+THREADS=${THREADS:-1}
+
+[ $# -gt 0 ] || set -- 100 1000 10000
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+printf "%8s %7s %10s %10s %10s %8s %7s\n" \
+	procs threads "p50 usec" "p99 usec" "max usec" "rss kB" dropped
+
+for n in "$@"; do
+	for t in $THREADS; do
+		"$GENPROC" -c $CPUS "$dir/root" $n || exit 1
+		rm -rf "$dir/out"
+		mkdir "$dir/out"
+
+		# changes go on for the whole run, and a bit
+		"$GENPROC" -e $(( SAMPLES / HZ + 2 )) -f $HZ -r $CHURN \
+			-u $RUNNING "$dir/root" &
+		gen=$!
+
+		"$BOOTCHARTD" -C "$dir/root" -o "$dir/out" -r -l -O \
+			-n $SAMPLES -f $HZ -T $t $OPTS >/dev/null 2>"$dir/err"
+		r=$?
+		kill $gen 2>/dev/null
+		wait $gen 2>/dev/null
+		if [ $r != 0 ]; then
+			cat "$dir/err" >&2
+			exit 1
+		fi
+
+		awk -F '\t' -v n=$n -v t=$t '
+			/^# bootchartd collector profile/ {
+				match($0, /dropped=[0-9]+/)
+				dropped = substr($0, RSTART + 8, RLENGTH - 8)
+			}
+			$1 == "tick_usec" { p50 = $2; p99 = $3; max = $4 }
+			$1 == "rss_kb" { rss = $4 }
+			END {
+				printf "%8d %7d %10d %10d %10d %8d %7d\n",
+				       n, t, p50, p99, max, rss, dropped
+			}' "$dir"/out/*.profile
+	done
+done
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# bench-render.sh - what drawing the chart costs, per size of recording
+#
+# Usage: bench-render.sh [NPROCS:NSAMPLES[:m]...]
+#
+# For every size, writes a synthetic log with tests/genlog (":m" for
+# one without PSS samples), draws it with bootchartd --render
+# --profile, and prints the time and bytes of every part of the chart:
+# the IO and CPU bars, the process bars, the PSS graph and so on. The
+# environment sets the rest:
+#
+#   OPTS      more bootchartd options, like "-F" or "-H"
+#   BOOTCHARTD, GENLOG   the programs [./bootchartd, ./tests/genlog]
+#
+
+BOOTCHARTD=${BOOTCHARTD:-./bootchartd}
+GENLOG=${GENLOG:-./tests/genlog}
+
+[ $# -gt 0 ] || set -- 1000:2000 10000:2000 10000:8000:m
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+for spec in "$@"; do
+	n=${spec%%:*}
+	rest=${spec#*:}
+	s=${rest%%:*}
+	gen=
+	[ "${rest#*:}" = m ] && gen=-m
+
+	"$GENLOG" $gen "$dir/bench.log" $n $s || exit 1
+	rm -rf "$dir/out"
+	mkdir "$dir/out"
+	if ! "$BOOTCHARTD" -L "$dir/bench.log" -o "$dir/out" -O $OPTS \
+		>/dev/null 2>"$dir/err"; then
+		cat "$dir/err" >&2
+		exit 1
+	fi
+
+	echo "$n processes, $s samples${gen:+, no PSS}, log $(wc -c < "$dir/bench.log") bytes:"
+	awk -F '\t' '
+		/^# bootchartd render profile/ { render = 1; next }
+		render && $1 == "section" { printf "  %-12s %10s %12s\n", $1, "usec", $3; next }
+		render { printf "  %-12s %10d %12d\n", $1, $2, $3; usec += $2; bytes += $3 }
+		END { printf "  %-12s %10d %12d\n", "total", usec, bytes }' \
+		"$dir"/out/*.profile
+done
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# corrupt.sh - damaged logs are refused, not drawn off the rails
+#
+# Run by "make check". A tests/genlog log is cut short at, and has
+# bytes overwritten at, offsets all over it. bootchartd --render may
+# draw it or refuse it, but has to exit, and not by a signal.
+#
+
+BOOTCHARTD=${BOOTCHARTD:-./bootchartd}
+GENLOG=${GENLOG:-./tests/genlog}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+"$GENLOG" -l 20 "$dir/good.log" 20 60 || exit 1
+size=$(wc -c < "$dir/good.log")
+step=$(( size / 97 + 1 ))
+
+render() {
+	rm -rf "$dir/out"
+	mkdir "$dir/out"
+	timeout 20 "$BOOTCHARTD" -L "$dir/bad.log" -o "$dir/out" >/dev/null 2>&1
+	r=$?
+	if [ $r -gt 1 ]; then
+		printf "FAIL: %s: bootchartd exited with %d\n" "$1" $r
+		fail=1
+	fi
+}
+
+off=0
+while [ $off -lt $size ]; do
+	head -c $off "$dir/good.log" > "$dir/bad.log"
+	render "cut at $off"
+
+	for byte in 000 177 377; do
+		cp "$dir/good.log" "$dir/bad.log"
+		printf "\\$byte\\$byte\\$byte\\$byte" |
+			dd of="$dir/bad.log" bs=1 seek=$off conv=notrunc 2>/dev/null
+		render "\\$byte at $off"
+	done
+	off=$(( off + step ))
+done
+
+[ $fail = 0 ] && echo "PASS: $(( size / step + 1 )) offsets"
+exit $fail
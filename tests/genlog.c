@@ -0,0 +1,235 @@
+/*
+ * genlog.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+/*
+ * A synthetic binary log, to draw charts of any size from:
+ *
+ *   genlog [-c cpus] [-l life] [-m] [-s seed] LOG NPROCS NSAMPLES
+ *
+ * fills in the samples, cpu and block IO counters and NPROCS processes
+ * in a tree, living about life samples each, and writes them to LOG
+ * for "bootchartd --render". -m leaves out the PSS samples. The same
+ * arguments give the same log, down to the system description, so the
+ * charts drawn from it can be compared.
+ *
+ * It's linked with all of bootchartd but bootchart.c, so it writes the
+ * log exactly as bootchartd would.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+
+#include "bootchart.h"
+
+
+static unsigned long long rnd_state = 88172645463325252ULL;
+
+
+static unsigned int rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+
+	return (unsigned int)rnd_state;
+}
+
+
+static void gen_system(int ns, int ncpu)
+{
+	double *runtime;
+	int s;
+	int c;
+
+	store_cpus(ncpu - 1);
+	cpus = ncpu;
+
+	runtime = calloc(ncpu, sizeof(double));
+	if (!runtime) {
+		perror("calloc(runtime)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (s = 0; s < ns; s++) {
+		series_set_double(&sampletime, s, log_start + s / hz);
+		series_set_int(&blockstat_bi, s, s * 40 + (rnd() % 400));
+		series_set_int(&blockstat_bo, s, s * 10 + (rnd() % 100));
+		for (c = 0; c < ncpu; c++) {
+			runtime[c] += (rnd() % 1000) / 1000.0 * interval;
+			series_set_double(&cpu_runtime[c], s, runtime[c]);
+			series_set_double(&cpu_waittime[c], s, runtime[c] / 4);
+		}
+	}
+	free(runtime);
+
+	strcpy(sysdesc.host, "genlog");
+	strcpy(sysdesc.system, "Linux 6.0.0 #1 SMP x86_64");
+	strcpy(sysdesc.cpu, "Synthetic CPU");
+	strcpy(sysdesc.disk, "Unknown");
+	strcpy(sysdesc.cmdline, "root=/dev/sda1 quiet");
+	strcpy(sysdesc.build, "Unknown");
+	strcpy(sysdesc.date, "Thu, 01 Jan 1970 00:00:00 +0000");
+}
+
+
+static void gen_procs(int nprocs, int ns, int life)
+{
+	struct ps_struct **all;
+	int i;
+	int s;
+
+	all = calloc(nprocs, sizeof(struct ps_struct *));
+	if (!all) {
+		perror("calloc(all)");
+		exit (EXIT_FAILURE);
+	}
+
+	for (i = 0; i < nprocs; i++) {
+		struct ps_struct *ps = log_ps_alloc();
+		struct ps_struct *parent;
+		double runtime = 0.0;
+		double waittime = 0.0;
+		int kb = 1000 + rnd() % 50000;
+
+		all[i] = ps;
+		ps->pid = i + 1;
+		ps->sid = i + 1;
+
+		/* init lives throughout, the others start and exit at random */
+		if (i == 0) {
+			ps->first = 0;
+			ps->last = ns - 1;
+		} else {
+			ps->first = rnd() % ns;
+			ps->last = ps->first + (int)(rnd() % (2 * life + 1));
+			if (ps->last >= ns)
+				ps->last = ns - 1;
+		}
+		snprintf(ps->name, sizeof(ps->name), "svc%d", i % 997);
+		ps->starttime = sample_time(ps->first);
+		if (ps->last < ns - 1)
+			ps->exittime = sample_time(ps->last) + 0.01;
+
+		for (s = ps->first; s <= ps->last; s++) {
+			/* a quarter of them run in bursts */
+			if (((i & 3) == 0) && ((s / 10 + i) % 4 == 0))
+				runtime += (rnd() % 1000) / 1000.0 * interval;
+			if (rnd() % 8 == 0)
+				waittime += interval / 10;
+			ps_store_append(ps, s, runtime, waittime);
+
+			if (pss && ((s - ps->first) % 25 == 0)) {
+				kb += (int)(rnd() % 2000) - 900;
+				if (kb < 0)
+					kb = 0;
+				ps_store_pss(ps, s, kb);
+				if (kb > ps->pss_max)
+					ps->pss_max = kb;
+			}
+		}
+		ps->total = runtime / 1000000000.0;
+
+		/* below init, or an earlier process that was alive then */
+		if (i) {
+			parent = all[0];
+			if (i > 1) {
+				struct ps_struct *p = all[rnd() % i];
+
+				if ((p->first <= ps->first) && (p->last >= ps->first))
+					parent = p;
+			}
+			ps->parent = parent;
+			ps->ppid = parent->pid;
+			if (!parent->children)
+				parent->children = ps;
+			else
+				parent->last_child->next = ps;
+			parent->last_child = ps;
+			all[i - 1]->next_ps = ps;
+		} else {
+			ps_first->next_ps = ps;
+		}
+	}
+
+	free(all);
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: genlog [-c cpus] [-l life] [-m] [-s seed] LOG NPROCS NSAMPLES\n");
+	exit (EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int ncpu = 8;
+	int life = 200;
+	int nprocs;
+	int ns;
+	int i;
+
+	pss = 1;
+	while ((i = getopt(argc, argv, "c:l:ms:h")) != -1) {
+		switch (i) {
+		case 'c':
+			ncpu = atoi(optarg);
+			break;
+		case 'l':
+			life = atoi(optarg);
+			break;
+		case 'm':
+			pss = 0;
+			break;
+		case 's':
+			rnd_state += strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 3 != argc)
+		usage();
+
+	nprocs = atoi(argv[optind + 1]);
+	ns = atoi(argv[optind + 2]);
+	if ((nprocs < 1) || (ns < 2) || (ncpu < 1) || (life < 0))
+		usage();
+
+	hz = 25.0;
+	interval = 1000000000.0 / hz;
+	len = ns;
+	samples = ns;
+	graph_start = 0.5;
+	log_start = 1.0;
+
+	ps_first = calloc(1, sizeof(struct ps_struct));
+	if (!ps_first) {
+		perror("calloc(ps_first)");
+		exit (EXIT_FAILURE);
+	}
+	store_init();
+
+	gen_system(ns, ncpu);
+	gen_procs(nprocs, ns, life);
+
+	if (binlog_write(argv[optind]))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
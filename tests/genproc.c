@@ -0,0 +1,456 @@
+/*
+ * genproc.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+/*
+ * A synthetic /proc for "bootchartd --root", to see what sampling any
+ * number of processes costs without having them:
+ *
+ *   genproc [-c cpus] [-s seed] ROOT NPROCS
+ *
+ * makes ROOT/proc with NPROCS processes in a random tree, and
+ *
+ *   genproc -e secs [-f hz] [-r churn] [-u running] [-s seed] ROOT
+ *
+ * then keeps it changing while bootchartd samples it: hz times a
+ * second, the running fraction of the processes use a tick of CPU,
+ * and churn processes a second exit and are replaced by new ones.
+ *
+ *   genproc -x pid ROOT
+ *
+ * has a new process, named "reused", take over pid from the one that
+ * had it. Files are replaced by rename, bootchartd never sees half of
+ * one.
+ */
+
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+struct proc_struct {
+	int pid;
+	unsigned long long runtime;
+	unsigned long long waittime;
+};
+
+static char root[PATH_MAX / 2];
+static int cpus = 4;
+static double hz = 25.0;
+
+static struct proc_struct *procs;
+static int nprocs;
+static int next_pid = 2;
+
+static unsigned long long rnd_state = 88172645463325252ULL;
+
+
+static unsigned int rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+
+	return (unsigned int)rnd_state;
+}
+
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+
+static void mkpath(const char *fmt, int pid)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), fmt, root, pid, pid);
+	if (mkdir(path, 0755) && (errno != EEXIST)) {
+		perror(path);
+		exit (EXIT_FAILURE);
+	}
+}
+
+
+/* replace root/name with s */
+static void put(const char *name, const char *s)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 4];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		exit (EXIT_FAILURE);
+	}
+	fputs(s, f);
+	if (fclose(f) || rename(tmp, path)) {
+		perror(path);
+		exit (EXIT_FAILURE);
+	}
+}
+
+
+static void put_schedstat(struct proc_struct *p)
+{
+	char name[64];
+	char buf[64];
+
+	snprintf(name, sizeof(name), "proc/%d/schedstat", p->pid);
+	snprintf(buf, sizeof(buf), "%llu %llu 10\n", p->runtime, p->waittime);
+	put(name, buf);
+}
+
+
+/* all files of process p, started start seconds after boot */
+static void proc_files(struct proc_struct *p, int ppid, const char *comm, double start)
+{
+	char name[64];
+	char buf[256];
+	int pid = p->pid;
+
+	mkpath("%s/proc/%d", pid);
+	mkpath("%s/proc/%d/task", pid);
+	mkpath("%s/proc/%d/task/%d", pid);
+
+	snprintf(name, sizeof(name), "proc/%d/sched", pid);
+	snprintf(buf, sizeof(buf), "%s (%d, #threads: 1)\n"
+		 "-------------------------------------------------------------------\n"
+		 "se.exec_start                                :    %.6f\n",
+		 comm, pid, start * 1000.0);
+	put(name, buf);
+
+	snprintf(name, sizeof(name), "proc/%d/stat", pid);
+	snprintf(buf, sizeof(buf), "%d (%s) S %d %d %d 0 -1 0\n",
+		 pid, comm, ppid, pid, pid);
+	put(name, buf);
+
+	snprintf(name, sizeof(name), "proc/%d/smaps_rollup", pid);
+	snprintf(buf, sizeof(buf), "00400000-7fff0000 ---p 00000000 00:00 0 [rollup]\n"
+		 "Rss:                4096 kB\nPss:                %u kB\n",
+		 100 + rnd() % 10000);
+	put(name, buf);
+
+	put_schedstat(p);
+}
+
+
+static void proc_new(int pid, int ppid)
+{
+	struct proc_struct *p;
+	char comm[16];
+
+	procs = realloc(procs, (nprocs + 1) * sizeof(struct proc_struct));
+	if (!procs) {
+		perror("realloc(procs)");
+		exit (EXIT_FAILURE);
+	}
+	p = &procs[nprocs++];
+	p->pid = pid;
+	p->runtime = rnd() % 10000000;
+	p->waittime = rnd() % 1000000;
+
+	snprintf(comm, sizeof(comm), "svc%d", pid % 1000);
+	proc_files(p, ppid, comm, 1.0 + pid / 1000000.0);
+}
+
+
+/*
+ * The process with pid exits, and a new one below init gets its pid:
+ * same files, another name, and its CPU time starts from 0.
+ */
+static void proc_reuse(int pid)
+{
+	struct proc_struct p;
+
+	p.pid = pid;
+	p.runtime = 0;
+	p.waittime = 0;
+	proc_files(&p, 1, "reused", now());
+}
+
+
+static void proc_gone(int i)
+{
+	char cmd[PATH_MAX + 32];
+	int r;
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s/proc/%d'", root, procs[i].pid);
+	r = system(cmd);
+	if (r)
+		fprintf(stderr, "genproc: %s failed\n", cmd);
+
+	procs[i] = procs[--nprocs];
+}
+
+
+/* the system wide files, as of t seconds since boot */
+static void put_system(double t)
+{
+	char *buf;
+	size_t n = 0;
+	size_t size;
+	int c;
+
+	size = 64 + cpus * 256;
+	buf = malloc(size);
+	if (!buf) {
+		perror("malloc(schedstat)");
+		exit (EXIT_FAILURE);
+	}
+
+	n += snprintf(buf + n, size - n, "version 15\ntimestamp 4294892357\n");
+	for (c = 0; c < cpus; c++) {
+		n += snprintf(buf + n, size - n, "cpu%d 0 0 0 0 0 0 %llu %llu 100\n",
+			      c, (unsigned long long)(t * 4e8) + c,
+			      (unsigned long long)(t * 1e8));
+		n += snprintf(buf + n, size - n, "domain0 %x 0 0 0 0 0 0 0 0\n",
+			      (1 << (cpus < 31 ? cpus : 31)) - 1);
+	}
+	put("proc/schedstat", buf);
+
+	snprintf(buf, size, "nr_free_pages 1000\npgpgin %llu\npgpgout %llu\n",
+		 (unsigned long long)(t * 1000), (unsigned long long)(t * 300));
+	put("proc/vmstat", buf);
+
+	snprintf(buf, size, "%.2f %.2f\n", t, t * cpus);
+	put("proc/uptime", buf);
+
+	free(buf);
+}
+
+
+static void create(int n)
+{
+	char cmd[PATH_MAX + 32];
+	int pid;
+	int r;
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s/proc'", root);
+	r = system(cmd);
+	if (r) {
+		fprintf(stderr, "genproc: %s failed\n", cmd);
+		exit (EXIT_FAILURE);
+	}
+	mkdir(root, 0755);
+	mkpath("%s/proc", 0);
+
+	put("proc/cmdline", "root=/dev/sda1 quiet\n");
+	put("proc/cpuinfo", "model name\t: Synthetic CPU\n");
+
+	/* a tree: everyone's parent is in the first quarter before them */
+	proc_new(1, 0);
+	for (pid = 2; pid <= n; pid++)
+		proc_new(pid, 1 + (rnd() % (pid / 4 > 1 ? pid / 4 : 1)));
+
+	put_system(1.0);
+}
+
+
+/* pick up the processes create() made, or a previous run left */
+static void load(void)
+{
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *d;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/proc", root);
+	d = opendir(path);
+	if (!d) {
+		perror(path);
+		exit (EXIT_FAILURE);
+	}
+
+	while ((ent = readdir(d))) {
+		struct proc_struct *p;
+		char buf[64];
+		FILE *f;
+		int pid = atoi(ent->d_name);
+
+		if (pid <= 0)
+			continue;
+
+		procs = realloc(procs, (nprocs + 1) * sizeof(struct proc_struct));
+		if (!procs) {
+			perror("realloc(procs)");
+			exit (EXIT_FAILURE);
+		}
+		p = &procs[nprocs++];
+		p->pid = pid;
+		p->runtime = 0;
+		p->waittime = 0;
+		if (pid >= next_pid)
+			next_pid = pid + 1;
+
+		/* carry on from where the counters are */
+		snprintf(path, sizeof(path), "%s/proc/%d/schedstat", root, pid);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(buf, sizeof(buf), f) &&
+		    (sscanf(buf, "%llu %llu", &p->runtime, &p->waittime) != 2))
+			p->runtime = p->waittime = 0;
+		fclose(f);
+	}
+	closedir(d);
+
+	/* keep init first, it never exits */
+	for (i = 1; i < nprocs; i++) {
+		if (procs[i].pid == 1) {
+			struct proc_struct p = procs[0];
+
+			procs[0] = procs[i];
+			procs[i] = p;
+		}
+	}
+}
+
+
+static void evolve(double secs, double churn, double running)
+{
+	double start = now();
+	double owed = 0.0;
+	double t;
+	long tick = 0;
+
+	load();
+	if (nprocs < 2) {
+		fprintf(stderr, "genproc: no processes in %s/proc\n", root);
+		exit (EXIT_FAILURE);
+	}
+
+	while ((t = now() - start) < secs) {
+		struct timespec ts;
+		double next;
+		int n = nprocs * running;
+		int i;
+
+		/* a tick of CPU for a random share of them */
+		for (i = 0; i < n; i++) {
+			struct proc_struct *p = &procs[rnd() % nprocs];
+
+			p->runtime += 1e9 / hz;
+			if (rnd() % 8 == 0)
+				p->waittime += 1e8 / hz;
+			put_schedstat(p);
+		}
+
+		/* some exit, and as many new ones start below survivors */
+		owed += churn / hz;
+		while ((owed >= 1.0) && (nprocs > 2)) {
+			int ppid;
+
+			owed -= 1.0;
+			/* init, the first one after load(), stays */
+			proc_gone(1 + (rnd() % (nprocs - 1)));
+			ppid = procs[rnd() % nprocs].pid;
+			proc_new(next_pid++, ppid);
+		}
+
+		put_system(1.0 + t);
+
+		next = ++tick / hz - (now() - start);
+		if (next > 0) {
+			ts.tv_sec = (time_t)next;
+			ts.tv_nsec = (long)((next - ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: genproc [-c cpus] [-s seed] ROOT NPROCS\n"
+			"       genproc -e secs [-f hz] [-r churn] [-u running] [-s seed] ROOT\n"
+			"       genproc -x pid ROOT\n");
+	exit (EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+	double secs = -1.0;
+	double churn = 10.0;
+	double running = 0.1;
+	int reuse = 0;
+	int i;
+
+	while ((i = getopt(argc, argv, "c:e:f:r:s:u:x:h")) != -1) {
+		switch (i) {
+		case 'c':
+			cpus = atoi(optarg);
+			break;
+		case 'e':
+			secs = atof(optarg);
+			break;
+		case 'f':
+			hz = atof(optarg);
+			break;
+		case 'r':
+			churn = atof(optarg);
+			break;
+		case 's':
+			rnd_state += strtoull(optarg, NULL, 0);
+			break;
+		case 'u':
+			running = atof(optarg);
+			break;
+		case 'x':
+			reuse = atoi(optarg);
+			if (reuse < 2)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((optind >= argc) || (cpus < 1) || (hz <= 0.0) ||
+	    (strlen(argv[optind]) >= sizeof(root)))
+		usage();
+	strcpy(root, argv[optind]);
+
+	if (reuse) {
+		proc_reuse(reuse);
+		return EXIT_SUCCESS;
+	}
+
+	if (secs >= 0.0) {
+		evolve(secs, churn, running);
+		return EXIT_SUCCESS;
+	}
+
+	if ((optind + 1 >= argc) || (atoi(argv[optind + 1]) < 1))
+		usage();
+	create(atoi(argv[optind + 1]));
+
+	return EXIT_SUCCESS;
+}
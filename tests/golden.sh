@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# golden.sh - draw charts of synthetic logs, compare them to good ones
+#
+# Run by "make check". Every chart in the list below is drawn from a
+# tests/genlog log and has to come out the same as tests/golden/.
+# After a change that's meant to change the charts, look at them and
+# run "tests/golden.sh update" from the build directory to replace the
+# good ones.
+#
+
+srcdir=${srcdir:-.}
+BOOTCHARTD=${BOOTCHARTD:-./bootchartd}
+GENLOG=${GENLOG:-./tests/genlog}
+
+# bootchartd runs from the output directory, so the chart says -o .
+bin=$(cd "$(dirname "$BOOTCHARTD")" && pwd)/$(basename "$BOOTCHARTD")
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+# name|genlog options|processes samples|bootchartd options
+while IFS='|' read name gen size opts; do
+	"$GENLOG" $gen "$dir/$name.log" $size || exit 1
+	rm -rf "$dir/out"
+	mkdir "$dir/out"
+	if ! (cd "$dir/out" && "$bin" -L "../$name.log" -o . $opts >/dev/null 2>&1); then
+		echo "FAIL: $name: drawing the chart failed"
+		fail=1
+		continue
+	fi
+
+	if [ "$1" = update ]; then
+		cp "$dir"/out/*.svg "$srcdir/tests/golden/$name.svg" || exit 1
+		echo "updated $name"
+	elif cmp -s "$dir"/out/*.svg "$srcdir/tests/golden/$name.svg"; then
+		echo "PASS: $name"
+	else
+		echo "FAIL: $name differs from tests/golden/$name.svg:"
+		diff -u "$srcdir/tests/golden/$name.svg" "$dir"/out/*.svg | head -20
+		fail=1
+	fi
+done <<END
+pss|-l 20|20 60|
+nopss|-l 30 -m -c 16|60 120|-F
+heatmap|-l 20 -m -c 8|20 60|-H -x 37 -y 13
+END
+
+exit $fail
@@ -0,0 +1,341 @@
+/*
+ * parse.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+/*
+ * The /proc parsers of parse.c against captured samples, run by
+ * "make check". Every sample is also handed over cut short at every
+ * length, in a buffer of exactly that size, so a parser that reads
+ * past the end shows up under valgrind or -fsanitize=address.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+
+#include "bootchart.h"
+
+
+static int failed;
+
+
+static void check(int ok, const char *what)
+{
+	if (ok)
+		return;
+	printf("FAIL: %s\n", what);
+	failed = 1;
+}
+
+
+/* a copy without the '\0', the parsers must not need one */
+static char *sample(const char *s, size_t n)
+{
+	char *buf = malloc(n ? n : 1);
+
+	if (!buf) {
+		perror("malloc(sample)");
+		exit (EXIT_FAILURE);
+	}
+	memcpy(buf, s, n);
+
+	return buf;
+}
+
+
+static const char vmstat[] =
+	"nr_free_pages 3215848\n"
+	"nr_zone_inactive_anon 2050\n"
+	"pgpgin 2253764\n"
+	"pgpgout 5163916\n"
+	"pswpin 0\n"
+	"pswpout 0\n";
+
+static const char schedstat_head[] =
+	"version 15\n"
+	"timestamp 4297519468\n";
+
+static const char schedstat_cpu[] =
+	"cpu%d 0 0 0 0 0 0 %llu %llu 45286\n"
+	"domain0 00000000,00000003 1198 1195 3 21 0 0 0 1195 0 0 0 0 0 0 0 0 0 "
+	"0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+	"domain1 ffffffff,ffffffff 2038 2027 9 443 2 0 0 2027 0 0 0 0 0 0 0 0 0 "
+	"0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n";
+
+static const char proc_diskstats[] =
+	"   7       0 loop0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+	"   8       0 sda 48361 11802 4337698 25318 69310 75871 5693496 98254 0 63808 125371 0 0 0 0\n"
+	"   8       1 sda1 1200 1460 0 0\n"
+	"   8       2 sda2 47101 10342 4329014 25162 69310 75871 5693496 98254 2 63600 123416\n"
+	" 259       0 nvme0n1 1 2 3 4 5 6 7 8\n";
+
+static const char pressure_cpu_old[] =
+	"some avg10=0.00 avg60=0.12 avg300=0.40 total=2635709692\n";
+
+static const char pressure_io[] =
+	"some avg10=0.00 avg60=0.00 avg300=0.00 total=56125934\n"
+	"full avg10=0.00 avg60=0.00 avg300=0.00 total=40129488\n";
+
+static const char ps_schedstat[] = "1226347118 38521904 2061\n";
+
+static const char ps_sched[] =
+	"systemd-journal (412, #threads: 1)\n"
+	"-------------------------------------------------------------------\n"
+	"se.exec_start                                :          9876.543210\n"
+	"se.vruntime                                  :            25.218417\n";
+
+static const char *ps_stat[] = {
+	"412 (systemd-journal) S 1 412 412 0 -1 4194560 2309 0 78 0 6 9 0 0 20 0 1\n",
+	"1730 (Web Content) S 1517 1517 1517 0 -1 4194560 50261 0 0 0 1270 191 0 0\n",
+	"2001 (a) b (c)) R 1730 2001 1517 0 -1 4194304 96 0 0 0 0 0 0 0 20 0 1\n",
+	"2002 (x) S 99 ) S 1730 2002 1517 0 -1 4194304 96 0 0 0 0 0 0 0 20 0 1\n",
+};
+
+static const char cgroup_cpu[] =
+	"usage_usec 58329418\n"
+	"user_usec 40113871\n"
+	"system_usec 18215547\n"
+	"nr_periods 0\n"
+	"nr_throttled 0\n"
+	"throttled_usec 1500\n";
+
+static const char cgroup_io[] =
+	"259:0 rbytes=1015808 wbytes=2220032 rios=73 wios=211 dbytes=0 dios=0\n"
+	"8:0 rbytes=4096 wbytes=0 rios=1 wios=0 dbytes=0 dios=0\n";
+
+
+struct cpus_struct {
+	int count;
+	int max;
+	double runtime;
+	double waittime;
+};
+
+
+static void cpu_fn(int cpu, double runtime, double waittime, void *data)
+{
+	struct cpus_struct *c = data;
+
+	c->count++;
+	if (cpu > c->max)
+		c->max = cpu;
+	if (cpu == 511) {
+		c->runtime = runtime;
+		c->waittime = waittime;
+	}
+}
+
+
+struct disks_struct {
+	int count;
+	char name[16];
+	unsigned long long v[DISK_FIELDS];
+};
+
+
+static void disk_fn(const char *name, size_t len, const unsigned long long *v, void *data)
+{
+	struct disks_struct *d = data;
+
+	d->count++;
+	if ((len == 3) && !memcmp(name, "sda", 3)) {
+		memcpy(d->name, name, len);
+		memcpy(d->v, v, sizeof(d->v));
+	}
+}
+
+
+static void test_vmstat(void)
+{
+	int bi = 0;
+	int bo = 0;
+
+	check(!parse_vmstat(vmstat, strlen(vmstat), &bi, &bo) &&
+	      (bi == 2253764) && (bo == 5163916), "vmstat pgpgin and pgpgout");
+	check(parse_vmstat(vmstat, strlen(vmstat) - 34, &bi, &bo) == -1,
+	      "vmstat without pgpgout");
+}
+
+
+/* 512 cpus with their sched domains, in the buffer bootchartd reads it to */
+static void test_schedstat(void)
+{
+	struct cpus_struct c;
+	char *buf;
+	size_t size = SCHEDSTAT_SIZE;
+	size_t n;
+	int i;
+
+	buf = malloc(size);
+	if (!buf) {
+		perror("malloc(schedstat)");
+		exit (EXIT_FAILURE);
+	}
+	n = snprintf(buf, size, "%s", schedstat_head);
+	for (i = 0; i < 512; i++)
+		n += snprintf(buf + n, size - n, schedstat_cpu, i,
+			      1000000ULL * i + 7, 1000ULL * i + 8);
+
+	memset(&c, 0, sizeof(c));
+	check((parse_schedstat(buf, n, cpu_fn, &c) == 512) && (c.count == 512) &&
+	      (c.max == 511), "schedstat of 512 cpus");
+	check((c.runtime == 511000007.0) && (c.waittime == 511008.0),
+	      "schedstat runtime and waittime of the last cpu");
+
+	memset(&c, 0, sizeof(c));
+	check(parse_schedstat(buf, strlen(schedstat_head), cpu_fn, &c) == 0,
+	      "schedstat without cpus");
+
+	free(buf);
+}
+
+
+static void test_diskstats(void)
+{
+	struct disks_struct d;
+
+	memset(&d, 0, sizeof(d));
+	check(parse_diskstats(proc_diskstats, strlen(proc_diskstats), disk_fn, &d) == 3,
+	      "diskstats skips lines with fewer than 11 counters");
+	check(!strcmp(d.name, "sda") && (d.v[DISK_RD_IOS] == 48361) &&
+	      (d.v[DISK_RD_SECTORS] == 4337698) && (d.v[DISK_WR_TICKS] == 98254) &&
+	      (d.v[DISK_IN_FLIGHT] == 0) && (d.v[DISK_QUEUE] == 125371),
+	      "diskstats counters of sda");
+}
+
+
+static void test_pressure(void)
+{
+	double some = -1.0;
+	double full = -1.0;
+
+	check(!parse_pressure(pressure_cpu_old, strlen(pressure_cpu_old), &some, &full) &&
+	      (some == 2635709692.0) && (full == 0.0), "pressure without a full line");
+	check(!parse_pressure(pressure_io, strlen(pressure_io), &some, &full) &&
+	      (some == 56125934.0) && (full == 40129488.0), "pressure some and full");
+	check(parse_pressure(pressure_io + 55, strlen(pressure_io) - 55, &some, &full) == -1,
+	      "pressure without a some line");
+}
+
+
+static void test_ps(void)
+{
+	double runtime = 0.0;
+	double waittime = 0.0;
+	double start = 0.0;
+	char name[16];
+	int ppid;
+
+	check(!parse_ps_schedstat(ps_schedstat, strlen(ps_schedstat), &runtime, &waittime) &&
+	      (runtime == 1226347118.0) && (waittime == 38521904.0), "process schedstat");
+	check(!parse_ps_sched(ps_sched, strlen(ps_sched), name, &start) &&
+	      !strcmp(name, "systemd-journal") && (start == 9876.54321), "process sched");
+
+	check(!parse_ps_stat_ppid(ps_stat[0], strlen(ps_stat[0]), &ppid) && (ppid == 1),
+	      "stat ppid");
+	check(!parse_ps_stat_ppid(ps_stat[1], strlen(ps_stat[1]), &ppid) && (ppid == 1517),
+	      "stat ppid, comm with a space");
+	check(!parse_ps_stat_ppid(ps_stat[2], strlen(ps_stat[2]), &ppid) && (ppid == 1730),
+	      "stat ppid, comm with spaces and parentheses");
+	check(!parse_ps_stat_ppid(ps_stat[3], strlen(ps_stat[3]), &ppid) && (ppid == 1730),
+	      "stat ppid, comm that looks like the fields after it");
+	check(parse_ps_stat_ppid(ps_stat[0], 10, &ppid) == -1, "stat cut in comm");
+}
+
+
+static void test_cgroup(void)
+{
+	double usage = 0.0;
+	double throttled = 0.0;
+	double rbytes = 0.0;
+	double wbytes = 0.0;
+
+	check(!parse_cgroup_cpu(cgroup_cpu, strlen(cgroup_cpu), &usage, &throttled) &&
+	      (usage == 58329418.0) && (throttled == 1500.0), "cgroup cpu.stat");
+	parse_cgroup_io(cgroup_io, strlen(cgroup_io), &rbytes, &wbytes);
+	check((rbytes == 1019904.0) && (wbytes == 2220032.0), "cgroup io.stat");
+}
+
+
+/* what a cut short sample parses as doesn't matter, only that it's in bounds */
+static void test_truncated(const char *s)
+{
+	size_t len = strlen(s);
+	size_t n;
+
+	for (n = 0; n <= len; n++) {
+		struct cpus_struct c;
+		struct disks_struct d;
+		char *buf = sample(s, n);
+		double a;
+		double b;
+		char name[16];
+		int i;
+		int j;
+
+		memset(&c, 0, sizeof(c));
+		memset(&d, 0, sizeof(d));
+		parse_vmstat(buf, n, &i, &j);
+		parse_schedstat(buf, n, cpu_fn, &c);
+		parse_diskstats(buf, n, disk_fn, &d);
+		parse_pressure(buf, n, &a, &b);
+		parse_ps_schedstat(buf, n, &a, &b);
+		parse_ps_sched(buf, n, name, &a);
+		parse_ps_stat_ppid(buf, n, &i);
+		parse_cgroup_cpu(buf, n, &a, &b);
+		parse_cgroup_io(buf, n, &a, &b);
+		free(buf);
+	}
+}
+
+
+int main(void)
+{
+	double a;
+	double b;
+	char *buf;
+	int i;
+
+	test_vmstat();
+	test_schedstat();
+	test_diskstats();
+	test_pressure();
+	test_ps();
+	test_cgroup();
+
+	/* nothing read is nothing found */
+	buf = sample("", 0);
+	check((parse_vmstat(buf, 0, &i, &i) == -1) && (parse_pressure(buf, 0, &a, &b) == -1) &&
+	      (parse_ps_schedstat(buf, 0, &a, &b) == -1) && (parse_ps_stat_ppid(buf, 0, &i) == -1) &&
+	      (parse_cgroup_cpu(buf, 0, &a, &b) == -1), "empty buffers");
+	free(buf);
+
+	test_truncated(vmstat);
+	test_truncated(schedstat_cpu);
+	test_truncated(proc_diskstats);
+	test_truncated(pressure_io);
+	test_truncated(ps_schedstat);
+	test_truncated(ps_sched);
+	for (i = 0; i < 4; i++)
+		test_truncated(ps_stat[i]);
+	test_truncated(cgroup_cpu);
+	test_truncated(cgroup_io);
+
+	if (failed)
+		return EXIT_FAILURE;
+
+	printf("PASS: parse\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# reuse.sh - a pid taken over by a new process is charted as a new one
+#
+# Run by "make check". bootchartd samples a tests/genproc tree, and
+# halfway through pid 7 exits and a new process named "reused" gets
+# its pid, with its CPU time from 0. The chart has to show both.
+#
+# A handle kept open on the old schedstat goes on reading the old file
+# here, where on /proc it would fail, so a tiny fd budget makes
+# bootchartd reopen them and find the new process' counters.
+#
+
+BOOTCHARTD=${BOOTCHARTD:-./bootchartd}
+GENPROC=${GENPROC:-./tests/genproc}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+for opts in "-d 4" "-d 4 -a 2"; do
+	"$GENPROC" "$dir/root" 20 || exit 1
+	rm -rf "$dir/out"
+	mkdir "$dir/out"
+
+	"$BOOTCHARTD" -C "$dir/root" -o "$dir/out" -r -F -n 50 -f 25 $opts \
+		>/dev/null 2>&1 &
+	pid=$!
+	sleep 1
+	"$GENPROC" -x 7 "$dir/root" || exit 1
+	if ! wait $pid; then
+		echo "FAIL: '$opts': bootchartd failed"
+		fail=1
+		continue
+	fi
+
+	if grep -q '>svc7 \[7\]' "$dir"/out/*.svg &&
+	   grep -q '>reused \[7\]' "$dir"/out/*.svg; then
+		echo "PASS: '$opts'"
+	else
+		echo "FAIL: '$opts': the old and new process 7 aren't both charted"
+		fail=1
+	fi
+done
+
+exit $fail
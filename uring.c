@@ -0,0 +1,362 @@
+/*
+ * uring.c
+ *
+ * Copyright (c) 2009 Intel Coproration
+ * Authors:
+ *   Auke Kok <auke-jan.h.kok@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+
+#include "bootchart.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * Batched reads through io_uring. All reads for one sample are queued
+ * and submitted with a single io_uring_enter(). Files are registered
+ * in a sparse table indexed by fd number, and all reads land in one
+ * registered buffer, so the kernel doesn't need to look up files or
+ * pin pages for every read.
+ */
+#define UR_ENTRIES 256
+
+static int ur_fd = -1;
+static unsigned ur_entries;
+
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static void *sq_ring;
+static void *cq_ring;
+static size_t sq_ring_size;
+static size_t cq_ring_size;
+static size_t sqes_size;
+
+/* registered file table, slot == fd */
+static int ur_nfiles;
+static char *ur_registered;
+
+/* read buffer, registered unless the kernel wouldn't pin it */
+static char *ur_buf;
+static size_t ur_buf_size;
+static int ur_buf_registered;
+
+
+static int ur_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int ur_enter(unsigned submit, unsigned complete, unsigned flags)
+{
+	prof_io(1, 0);
+	return syscall(__NR_io_uring_enter, ur_fd, submit, complete, flags, NULL, 0);
+}
+
+
+static int ur_register(unsigned op, void *arg, unsigned n)
+{
+	prof_io(1, 0);
+	return syscall(__NR_io_uring_register, ur_fd, op, arg, n);
+}
+
+
+int uring_open(void)
+{
+	struct io_uring_params p;
+	struct rlimit rl;
+	int *files;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	ur_fd = ur_setup(UR_ENTRIES, &p);
+	if (ur_fd == -1)
+		return -1;
+
+	ur_entries = p.sq_entries;
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_ring_size > sq_ring_size)
+			sq_ring_size = cq_ring_size;
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ur_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ur_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ur_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto fail;
+
+	sq_head = (unsigned *)((char *)sq_ring + p.sq_off.head);
+	sq_tail = (unsigned *)((char *)sq_ring + p.sq_off.tail);
+	sq_mask = (unsigned *)((char *)sq_ring + p.sq_off.ring_mask);
+	sq_array = (unsigned *)((char *)sq_ring + p.sq_off.array);
+	cq_head = (unsigned *)((char *)cq_ring + p.cq_off.head);
+	cq_tail = (unsigned *)((char *)cq_ring + p.cq_off.tail);
+	cq_mask = (unsigned *)((char *)cq_ring + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((char *)cq_ring + p.cq_off.cqes);
+
+	/* one sparse slot for every fd we may ever open */
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY)
+		rl.rlim_cur = 4096;
+	ur_nfiles = rl.rlim_cur;
+
+	files = malloc(ur_nfiles * sizeof(int));
+	ur_registered = calloc(ur_nfiles, 1);
+	if (!files || !ur_registered) {
+		perror("malloc(uring files)");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < ur_nfiles; i++)
+		files[i] = -1;
+	if (ur_register(IORING_REGISTER_FILES, files, ur_nfiles))
+		ur_nfiles = 0; /* no fixed files then, plain fds still work */
+	free(files);
+
+	return 0;
+
+fail:
+	uring_close();
+	return -1;
+}
+
+
+void uring_close(void)
+{
+	if (sqes && sqes != MAP_FAILED)
+		munmap(sqes, sqes_size);
+	if (cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring && sq_ring != MAP_FAILED)
+		munmap(sq_ring, sq_ring_size);
+	sqes = NULL;
+	cq_ring = sq_ring = NULL;
+
+	if (ur_fd != -1)
+		close(ur_fd);
+	ur_fd = -1;
+
+	free(ur_registered);
+	ur_registered = NULL;
+	ur_nfiles = 0;
+	free(ur_buf);
+	ur_buf = NULL;
+	ur_buf_size = 0;
+	ur_buf_registered = 0;
+}
+
+
+static void ur_update_file(int fd, int value)
+{
+	struct io_uring_files_update up;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = fd;
+	up.fds = (unsigned long)&value;
+
+	if (ur_register(IORING_REGISTER_FILES_UPDATE, &up, 1) == 1)
+		ur_registered[fd] = (value != -1);
+}
+
+
+/*
+ * Must be called before closing an fd we may have read through the
+ * ring, the registered slot holds a reference to the old file.
+ */
+void uring_forget(int fd)
+{
+	if ((fd < 0) || (fd >= ur_nfiles) || !ur_registered[fd])
+		return;
+
+	ur_update_file(fd, -1);
+}
+
+
+/*
+ * Make the read buffer at least size bytes. Returns 0 if it's
+ * registered, for fixed buffer reads, -1 if plain reads have to do,
+ * like when RLIMIT_MEMLOCK doesn't allow pinning it.
+ */
+static int ur_grow_buffer(size_t size)
+{
+	struct iovec iov;
+
+	if (size <= ur_buf_size)
+		return ur_buf_registered ? 0 : -1;
+
+	if (ur_buf) {
+		if (ur_buf_registered)
+			ur_register(IORING_UNREGISTER_BUFFERS, NULL, 0);
+		ur_buf_registered = 0;
+		free(ur_buf);
+	}
+
+	ur_buf_size = ur_buf_size ? ur_buf_size : 65536;
+	while (ur_buf_size < size)
+		ur_buf_size *= 2;
+
+	if (posix_memalign((void **)&ur_buf, 4096, ur_buf_size)) {
+		perror("malloc(uring buffer)");
+		exit (EXIT_FAILURE);
+	}
+
+	iov.iov_base = ur_buf;
+	iov.iov_len = ur_buf_size;
+	if (ur_register(IORING_REGISTER_BUFFERS, &iov, 1))
+		return -1;
+	ur_buf_registered = 1;
+
+	return 0;
+}
+
+
+/*
+ * Read all of reads[] from offset 0. Each read gets a '\0' terminated
+ * buffer of at most size - 1 bytes, and res is set like pread() would.
+ */
+int uring_read(struct uring_read_struct *reads, int n)
+{
+	size_t need = 0;
+	int fixed_bufs;
+	int done = 0;
+	int queued = 0;
+	int i;
+
+	if (ur_fd == -1)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		need += (reads[i].size + 63) & ~63;
+	fixed_bufs = !ur_grow_buffer(need);
+
+	need = 0;
+	for (i = 0; i < n; i++) {
+		reads[i].buf = ur_buf + need;
+		reads[i].res = -ECANCELED;
+		need += (reads[i].size + 63) & ~63;
+	}
+
+	while (done < n) {
+		unsigned tail = *sq_tail;
+		unsigned head;
+		int batch = 0;
+
+		/* fill the SQ ring as far as it goes */
+		while ((queued < n) &&
+		       (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) < ur_entries)) {
+			struct uring_read_struct *r = &reads[queued];
+			struct io_uring_sqe *sqe;
+			unsigned idx = tail & *sq_mask;
+
+			sqe = &sqes[idx];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+			sqe->fd = r->fd;
+			sqe->addr = (unsigned long)r->buf;
+			sqe->len = r->size - 1;
+			sqe->off = 0;
+			sqe->user_data = queued;
+
+			if ((r->fd < ur_nfiles) && !ur_registered[r->fd])
+				ur_update_file(r->fd, r->fd);
+			if ((r->fd < ur_nfiles) && ur_registered[r->fd])
+				sqe->flags |= IOSQE_FIXED_FILE;
+
+			sq_array[idx] = idx;
+			tail++;
+			queued++;
+			batch++;
+		}
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+		if (ur_enter(batch, batch, IORING_ENTER_GETEVENTS) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* reap */
+		head = *cq_head;
+		while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+			struct uring_read_struct *r = &reads[cqe->user_data];
+
+			r->res = cqe->res;
+			r->buf[(cqe->res > 0) ? cqe->res : 0] = '\0';
+			prof_io(0, cqe->res);
+			head++;
+			done++;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+#else
+
+/* no io_uring headers at build time, always use pread() */
+int uring_open(void)
+{
+	return -1;
+}
+
+void uring_close(void)
+{
+}
+
+void uring_forget(int fd)
+{
+	(void) fd;
+}
+
+int uring_read(struct uring_read_struct *reads, int n)
+{
+	(void) reads;
+	(void) n;
+	return -1;
+}
+
+#endif